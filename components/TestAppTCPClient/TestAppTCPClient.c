@@ -14,20 +14,75 @@
 #include "lib_macros/Test.h"
 #include "stdint.h"
 #include "system_config.h"
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "OS_Socket.h"
-#include "math.h"
+#include "TimeServer.h"
 
 #include "SysLoggerClient.h"
 #include "interfaces/if_OS_Socket.h"
 #include "util/loop_defines.h"
 #include "util/non_blocking_helper.h"
+#include "util/socket_io.h"
 #include <camkes.h>
 
 static const if_OS_Socket_t network_stack =
     IF_OS_SOCKET_ASSIGN(networkStack);
 
+// Helper instance serving the events of network_stack.
+static nb_helper_t nbHelper;
+
+static const if_OS_Timer_t timer =
+    IF_OS_TIMER_ASSIGN(
+        timeServer_rpc,
+        timeServer_notify);
+
+// Second connection to the TimeServer, its oneshot wakes up the waits with a
+// deadline. The notification of timer is taken by TimeServer_sleep().
+static const if_OS_Timer_t deadlineTimer =
+    IF_OS_TIMER_ASSIGN(
+        deadlineTimer_rpc,
+        deadlineTimer_notify);
+
+// Pages a.txt to p.txt the HTTP server on the test host provides, sockets
+// beyond that fetch them again.
+#define NUM_TEST_PAGES 16
+
+// Wait slots of the control thread and of the second waiting thread of
+// test_tcp_client_wait_slots().
+#define NUM_WAIT_SLOTS 2
+
+static const nb_helper_wait_slot_t waitSlots[NUM_WAIT_SLOTS] =
+{
+    {
+        event_received_send_ready_emit,
+        event_received_recv_ready_wait,
+        event_received_recv_ready_poll
+    },
+    {
+        event_received1_send_ready_emit,
+        event_received1_recv_ready_wait,
+        event_received1_recv_ready_poll
+    },
+};
+
+static void
+deadline_timer_handler(
+    void* ctx)
+{
+    nb_helper_deadline_expired(&nbHelper);
+
+    int ret = deadlineTimer_notify_reg_callback(&deadline_timer_handler, NULL);
+    if (0 != ret)
+    {
+        Debug_LOG_ERROR("Failed to re-register the deadline timer, code %d",
+                        ret);
+    }
+}
+
 void
 pre_init(void)
 {
@@ -37,25 +92,57 @@ pre_init(void)
     Debug_ASSERT(err == OS_SUCCESS);
 #endif
     // Initialize the helper lib with the required synchronization mechanisms.
-    nb_helper_init(
-        event_received_send_ready_emit,
-        event_received_recv_ready_wait,
-        SharedResourceMutex_lock,
-        SharedResourceMutex_unlock);
-
-    // Set up callback for new received socket events.
-    err = OS_Socket_regCallback(
+    err = nb_helper_init(
+              &nbHelper,
               &network_stack,
-              &nb_helper_collect_pending_ev_handler,
-              (void*) &network_stack);
+              OS_NETWORK_MAXIMUM_SOCKET_NO,
+              event_received_send_ready_emit,
+              event_received_recv_ready_wait,
+              SharedResourceMutex_lock,
+              SharedResourceMutex_unlock);
+    if (err != OS_SUCCESS)
+    {
+        Debug_LOG_ERROR("nb_helper_init() failed, code %d", err);
+    }
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    // Sockets of odd handles are waited on through the second slot.
+    err = nb_helper_init_wait_slots(&nbHelper, waitSlots, NUM_WAIT_SLOTS);
+    if (err != OS_SUCCESS)
+    {
+        Debug_LOG_ERROR("nb_helper_init_wait_slots() failed, code %d", err);
+    }
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    // Sleep on the TimeServer instead of spinning while waiting.
+    nb_helper_set_timer(&nbHelper, &timer);
+
+    // Block while waiting with a deadline, the deadline timer wakes us up.
+    int ret = deadlineTimer_notify_reg_callback(&deadline_timer_handler, NULL);
+    if (0 != ret)
+    {
+        Debug_LOG_ERROR("Failed to register the deadline timer, code %d", ret);
+    }
+    ASSERT_EQ_INT(0, ret);
+    nb_helper_set_deadline_timer(&nbHelper, &deadlineTimer);
+
+    // Optionally spin on the notification before blocking on it.
+    nb_helper_set_spin(
+        &nbHelper,
+        event_received_recv_ready_poll,
+        CFG_NB_HELPER_SPIN_MAX);
+
+    // Subscribe to the socket events of the network stack.
+    err = nb_helper_subscribe(
+              &nbHelper,
+              NB_HELPER_PERSISTENT_SUBSCRIPTION);
     if (err != OS_SUCCESS)
     {
-        Debug_LOG_ERROR(
-            "OS_Socket_regCallback() failed, code %d", err);
+        Debug_LOG_ERROR("nb_helper_subscribe() failed, code %d", err);
     }
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-    err = nb_helper_wait_for_network_stack_init(&network_stack);
+    err = nb_helper_wait_for_network_stack_init(&nbHelper);
     if (err != OS_SUCCESS)
     {
         Debug_LOG_ERROR("nb_helper_wait_for_network_stack_init() failed, code %d", err);
@@ -72,7 +159,7 @@ test_socket_create_neg()
     // verify that this exceeding creation will fail.
     TEST_START();
 
-    OS_Socket_Handle_t handle[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    static OS_Socket_Handle_t handle[OS_NETWORK_MAXIMUM_SOCKET_NO];
     OS_Error_t err;
 
     // Test unsupported domain
@@ -118,9 +205,7 @@ test_socket_create_neg()
     // Cleanup
     for (int i = 0; i < OS_NETWORK_MAXIMUM_SOCKET_NO; i++)
     {
-        OS_Error_t err = OS_Socket_close(handle[i]);
-        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-        err = nb_helper_reset_ev_struct_for_socket(handle[i]);
+        OS_Error_t err = nb_helper_socket_close(&nbHelper, handle[i]);
         ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
     }
 
@@ -139,7 +224,7 @@ test_socket_create_pos()
     // suggested to run test_socket_create_neg() prior to this
     TEST_START();
 
-    OS_Socket_Handle_t handle[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    static OS_Socket_Handle_t handle[OS_NETWORK_MAXIMUM_SOCKET_NO];
 
     // Let the following run twice in order to try to catch possible
     // production of RAII garbage
@@ -158,9 +243,7 @@ test_socket_create_pos()
 
         for (int i = 0; i < OS_NETWORK_MAXIMUM_SOCKET_NO; i++)
         {
-            OS_Error_t err = OS_Socket_close(handle[i]);
-            ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-            err = nb_helper_reset_ev_struct_for_socket(handle[i]);
+            OS_Error_t err = nb_helper_socket_close(&nbHelper, handle[i]);
             ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
         }
     }
@@ -182,10 +265,7 @@ test_socket_close_pos()
                          OS_SOCK_STREAM);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-    err = OS_Socket_close(handle);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
-    err = nb_helper_reset_ev_struct_for_socket(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     TEST_FINISH();
@@ -214,10 +294,7 @@ test_socket_close_neg()
     err = OS_Socket_close(invalid_handle);
     ASSERT_EQ_OS_ERR(OS_ERROR_INVALID_HANDLE, err);
 
-    err = OS_Socket_close(handle);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
-    err = nb_helper_reset_ev_struct_for_socket(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     TEST_FINISH();
@@ -246,13 +323,10 @@ test_socket_connect_pos()
     err = OS_Socket_connect(handle, &dstAddr);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-    err = nb_helper_wait_for_conn_est_ev_on_socket(handle);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
-    err = OS_Socket_close(handle);
+    err = nb_helper_wait_for_conn_est_ev_on_socket(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-    err = nb_helper_reset_ev_struct_for_socket(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     TEST_FINISH();
@@ -285,7 +359,7 @@ test_socket_connect_neg()
     err = OS_Socket_connect(handle, &dstAddr);
     ASSERT_EQ_OS_ERR(OS_ERROR_INVALID_PARAMETER, err);
 
-    err = OS_Socket_close(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     // Test connecting to an unreachable host.
@@ -300,7 +374,7 @@ test_socket_connect_neg()
     err = OS_Socket_connect(handle, &dstAddr);
     ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_HOST_UNREACHABLE, err);
 
-    err = OS_Socket_close(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     // Test connection refused, now with reachable address but port closed.
@@ -318,10 +392,10 @@ test_socket_connect_neg()
 
     // Wait until we receive the expected event that the connection to the
     // unreachable port failed.
-    err = nb_helper_wait_for_conn_est_ev_on_socket(handle);
+    err = nb_helper_wait_for_conn_est_ev_on_socket(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_CONN_REFUSED, err);
 
-    err = OS_Socket_close(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     // Test forbidden host (connection reset), firewall is configured to send a
@@ -347,13 +421,10 @@ test_socket_connect_neg()
     err = OS_Socket_connect(handle, &dstAddr);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-    err = nb_helper_wait_for_conn_est_ev_on_socket(handle);
+    err = nb_helper_wait_for_conn_est_ev_on_socket(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_CONN_REFUSED, err);
 
-    err = OS_Socket_close(handle);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
-    err = nb_helper_reset_ev_struct_for_socket(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     TEST_FINISH();
@@ -377,9 +448,6 @@ test_socket_non_blocking_neg()
                          OS_SOCK_STREAM);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-    err = nb_helper_reset_ev_struct_for_socket(handle);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
     OS_Socket_Addr_t dstAddr =
     {
         .addr = CFG_REACHABLE_HOST,
@@ -408,7 +476,7 @@ test_socket_non_blocking_neg()
     err = OS_Socket_sendto(handle, buffer, len, &len, &srcAddr);
     ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_PROTO, err);
 
-    err = OS_Socket_close(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     // Try to connect to a host that will let the connection timeout. After the
@@ -423,15 +491,14 @@ test_socket_non_blocking_neg()
               OS_SOCK_STREAM);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-    err = nb_helper_reset_ev_struct_for_socket(handle);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
     err = OS_Socket_connect(handle_connection_timeout, &dstAddr);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     // Wait until we receive the expected event that the connection to the
     // unreachable port failed.
-    err = nb_helper_wait_for_conn_est_ev_on_socket(handle_connection_timeout);
+    err = nb_helper_wait_for_conn_est_ev_on_socket(
+              &nbHelper,
+              handle_connection_timeout);
     ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_CONN_REFUSED, err);
 
     err = OS_Socket_read(handle_connection_timeout, buffer, len, &len);
@@ -446,10 +513,7 @@ test_socket_non_blocking_neg()
     err = OS_Socket_sendto(handle, buffer, len, &len, &srcAddr);
     ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_PROTO, err);
 
-    err = OS_Socket_close(handle_connection_timeout);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
-    err = nb_helper_reset_ev_struct_for_socket(handle_connection_timeout);
+    err = nb_helper_socket_close(&nbHelper, handle_connection_timeout);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     TEST_FINISH();
@@ -478,7 +542,7 @@ test_tcp_write_pos()
     err = OS_Socket_connect(handle, &dstAddr);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-    err = nb_helper_wait_for_conn_est_ev_on_socket(handle);
+    err = nb_helper_wait_for_conn_est_ev_on_socket(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     char* request = "GET /network/a.txt "
@@ -526,10 +590,7 @@ test_tcp_write_pos()
     // dataport and not the requested size.
     ASSERT_LE_SZ(len_actual, networkStack_rpc_get_size());
 
-    err = OS_Socket_close(handle);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
-    err = nb_helper_reset_ev_struct_for_socket(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     TEST_FINISH();
@@ -562,7 +623,7 @@ test_tcp_write_neg()
                     "HTTP/1.0\r\nHost: " CFG_TEST_HTTP_SERVER
                     "\r\nConnection: close\r\n\r\n";
 
-    err = nb_helper_wait_for_conn_est_ev_on_socket(handle);
+    err = nb_helper_wait_for_conn_est_ev_on_socket(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     const size_t len_request = strlen(request);
@@ -585,10 +646,7 @@ test_tcp_write_neg()
     err = OS_Socket_write(invalidHandle, request, len_request, &len_actual);
     ASSERT_EQ_OS_ERR(OS_ERROR_INVALID_HANDLE, err);
 
-    err = OS_Socket_close(handle);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
-    err = nb_helper_reset_ev_struct_for_socket(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     TEST_FINISH();
@@ -614,13 +672,10 @@ test_tcp_read_pos()
         .port = CFG_REACHABLE_PORT
     };
 
-    err = nb_helper_reset_ev_struct_for_socket(handle);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
     err = OS_Socket_connect(handle, &dstAddr);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-    err = nb_helper_wait_for_conn_est_ev_on_socket(handle);
+    err = nb_helper_wait_for_conn_est_ev_on_socket(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     char* request = "GET /network/a.txt "
@@ -638,7 +693,7 @@ test_tcp_read_pos()
     ASSERT_GT_SZ(sizeof(buffer), networkStack_rpc_get_size());
 
     // Wait until we receive a read event for the socket.
-    err = nb_helper_wait_for_read_ev_on_socket(handle);
+    err = nb_helper_wait_for_read_ev_on_socket(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     // Read a small chunk that should fit into the underlying dataport.
@@ -654,7 +709,7 @@ test_tcp_read_pos()
     len_request = sizeof(buffer);
 
     // Wait until we receive a read event for the socket.
-    err = nb_helper_wait_for_read_ev_on_socket(handle);
+    err = nb_helper_wait_for_read_ev_on_socket(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     err = OS_Socket_read(handle, buffer, len_request, &len_actual);
@@ -663,10 +718,7 @@ test_tcp_read_pos()
     // dataport and not the requested size.
     ASSERT_LE_SZ(len_actual, networkStack_rpc_get_size());
 
-    err = OS_Socket_close(handle);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
-    err = nb_helper_reset_ev_struct_for_socket(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     TEST_FINISH();
@@ -708,32 +760,83 @@ test_tcp_read_neg()
     err = OS_Socket_read(invalidHandle, buffer, len, &len);
     ASSERT_EQ_OS_ERR(OS_ERROR_INVALID_HANDLE, err);
 
-    err = OS_Socket_close(handle);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
-
-    err = nb_helper_reset_ev_struct_for_socket(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     TEST_FINISH();
 }
 
-void
-test_tcp_client()
+// Logs the wakeup counters before and after a test and how often the waiting
+// threads were woken up per delivered event in between. With a single global
+// wakeup every event batch woke up every waiting thread, that is the baseline.
+static void
+log_wakeup_stats(
+    const char* const test,
+    const nb_helper_stats_t* const before,
+    const nb_helper_stats_t* const after,
+    const unsigned int numWaiters)
 {
-    TEST_START();
+    const nb_helper_stats_t* const snapshots[] = { before, after };
+
+    for (int s = 0; s < 2; s++)
+    {
+        Debug_LOG_INFO(
+            "%s: nb_helper stats %s: events %u, batches %u, notifications %u, "
+            "wakeups %u, spurious wakeups %u, ready list visits %u, "
+            "stale events %u",
+            test,
+            (0 == s) ? "before" : "after",
+            snapshots[s]->eventsDelivered,
+            snapshots[s]->eventBatches,
+            snapshots[s]->notifications,
+            snapshots[s]->wakeups,
+            snapshots[s]->spuriousWakeups,
+            snapshots[s]->readyListVisits,
+            snapshots[s]->staleEvents);
+    }
 
+    const uint32_t events = after->eventsDelivered - before->eventsDelivered;
+    const uint32_t wakeups = after->wakeups - before->wakeups;
+
+    Debug_LOG_INFO(
+        "%s: %u wakeups (%u spurious) of %u threads for %u events, %u per 100 "
+        "events, %u with a global wakeup",
+        test,
+        wakeups,
+        after->spuriousWakeups - before->spuriousWakeups,
+        numWaiters,
+        events,
+        events ? (wakeups * 100) / events : 0,
+        (after->eventBatches - before->eventBatches) * numWaiters);
+}
+
+// Creates up to num sockets and connects them to the HTTP server on the test
+// host. Sequentially, every socket waits for its handshake to complete before
+// the next one is connected. In parallel, all sockets are connected first and
+// the handshakes are awaited together, so they cost about one round trip
+// instead of num. Returns the number of connected sockets, they are the first
+// ones of handle[]. The sockets behind the first one that failed are closed
+// again.
+static int
+connect_sockets(
+    OS_Socket_Handle_t handle[],
+    const int num,
+    const bool parallel,
+    const uint64_t deadlineMs)
+{
     const OS_Socket_Addr_t dstAddr =
     {
         .addr = GATEWAY_ADDR,
         .port = CFG_REACHABLE_PORT
     };
 
-    OS_Socket_Handle_t handle[OS_NETWORK_MAXIMUM_SOCKET_NO];
     OS_Error_t err;
-    int i;
+    int numCreated;
 
-    for (i = 0; i < OS_NETWORK_MAXIMUM_SOCKET_NO; i++)
+    for (numCreated = 0; numCreated < num; numCreated++)
     {
+        const int i = numCreated;
+
         err = OS_Socket_create(
                   &network_stack,
                   &handle[i],
@@ -755,61 +858,230 @@ test_tcp_client()
                 "OS_Socket_connect() failed, code %d for %d socket",
                 err,
                 i);
+            nb_helper_socket_close(&nbHelper, handle[i]);
             break;
         }
 
-        err = nb_helper_wait_for_conn_est_ev_on_socket(handle[i]);
+        if (parallel)
+        {
+            continue;
+        }
+
+        err = nb_helper_wait_for_conn_est_ev_on_socket_until(
+                  &nbHelper,
+                  handle[i],
+                  deadlineMs);
         if (err != OS_SUCCESS)
         {
             Debug_LOG_ERROR(
-                "nb_helper_wait_for_conn_est_ev_on_socket() failed, code %d for %d socket",
+                "nb_helper_wait_for_conn_est_ev_on_socket_until() failed, "
+                "code %d for %d socket",
                 err,
                 i);
+            nb_helper_socket_close(&nbHelper, handle[i]);
             break;
         }
     }
 
-    int socket_max = i;
-    Debug_LOG_INFO("Send request to host...");
+    if (!parallel)
+    {
+        return numCreated;
+    }
 
-    char* request = "GET /network/a.txt "
-                    "HTTP/1.0\r\nHost: " CFG_TEST_HTTP_SERVER
-                    "\r\nConnection: close\r\n\r\n";
+    // The sockets stay registered until their handshake is done.
+    static nb_helper_poll_t pollSet[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    static nb_helper_poll_t ready[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    nb_helper_poll_set_t set;
+    int numConnected = numCreated;
 
-    const size_t len_request = strlen(request);
-    size_t       len         = len_request;
+    err = nb_helper_poll_set_init(&nbHelper, &set, pollSet,
+                                  OS_NETWORK_MAXIMUM_SOCKET_NO);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    for (int i = 0; i < numCreated; i++)
+    {
+        err = nb_helper_poll_set_add(&nbHelper, &set, handle[i],
+                                     OS_SOCK_EV_CONN_EST, &handle[i]);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    while (set.numFds > 0)
+    {
+        size_t numReady = 0;
+        err = nb_helper_wait_any_until(
+                  &nbHelper,
+                  &set,
+                  deadlineMs,
+                  ready,
+                  OS_NETWORK_MAXIMUM_SOCKET_NO,
+                  &numReady);
+        if (err != OS_SUCCESS)
+        {
+            Debug_LOG_ERROR(
+                "nb_helper_wait_any_until() failed, code %d with %zu "
+                "handshakes pending",
+                err,
+                set.numFds);
+
+            // Keep the sockets below the first one still pending.
+            for (size_t p = 0; p < set.numFds; p++)
+            {
+                const int i = (OS_Socket_Handle_t*) set.fds[p].data - handle;
+                numConnected = (i < numConnected) ? i : numConnected;
+            }
+            break;
+        }
+
+        for (size_t r = 0; r < numReady; r++)
+        {
+            const int i = (OS_Socket_Handle_t*) ready[r].data - handle;
+
+            err = nb_helper_poll_set_remove(&nbHelper, &set, handle[i]);
+            ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+            if (!(ready[r].revents & OS_SOCK_EV_CONN_EST)
+                && (i < numConnected))
+            {
+                Debug_LOG_ERROR(
+                    "Connecting socket %d failed, events 0x%x",
+                    i,
+                    ready[r].revents);
+                numConnected = i;
+            }
+        }
+    }
+
+    // Sockets must not be closed while they are in the set.
+    while (set.numFds > 0)
+    {
+        err = nb_helper_poll_set_remove(&nbHelper, &set, set.fds[0].handle);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    for (int i = numConnected; i < numCreated; i++)
+    {
+        nb_helper_socket_close(&nbHelper, handle[i]);
+    }
+
+    return numConnected;
+}
+
+// Fetches a page over every socket the network stack provides. With prioritize
+// set, the first socket stands for a control connection of high priority and
+// the others for bulk transfers of low priority, and the helper hands out one
+// ready socket at a time. Returns false if the test failed.
+static bool
+fetch_pages(
+    const bool prioritize)
+{
+    // Kept off the stack, there may be hundreds of sockets.
+    static OS_Socket_Handle_t handle[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    OS_Error_t err;
+    int i;
+
+    // One deadline for the whole test, so the tail latency of the slowest
+    // socket is bounded and a lost event fails the test instead of hanging it.
+    uint64_t deadlineMs;
+    err = nb_helper_deadline_in(
+              &nbHelper,
+              CFG_TCP_CLIENT_DEADLINE_MS,
+              &deadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    uint64_t connectStartNs = 0;
+    uint64_t connectEndNs = 0;
+
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &connectStartNs);
+    const int socket_max = connect_sockets(
+                               handle,
+                               OS_NETWORK_MAXIMUM_SOCKET_NO,
+                               true,
+                               deadlineMs);
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &connectEndNs);
+
+    Debug_LOG_INFO("%d sockets connected in %u us",
+                   socket_max,
+                   (uint32_t) ((connectEndNs - connectStartNs) / 1000));
+
+    nb_helper_stats_t statsBefore;
+    nb_helper_get_stats(&nbHelper, &statsBefore);
+
+    if (prioritize)
+    {
+        for (i = 0; i < socket_max; i++)
+        {
+            err = nb_helper_set_priority(
+                      &nbHelper,
+                      handle[i],
+                      (0 == i) ? NB_HELPER_PRIO_HIGH : NB_HELPER_PRIO_LOW);
+            ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+        }
+        err = nb_helper_set_dispatch_limit(&nbHelper, 1);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    Debug_LOG_INFO("Send request to host...");
+
+    // The request line names a different page for each socket, the headers
+    // and the (empty) body are the same for all, so the request is sent as
+    // fragments with one RPC.
+    char requestLine[] = "GET /network/a.txt HTTP/1.0\r\n";
+    static const char requestHeaders[] = "Host: " CFG_TEST_HTTP_SERVER "\r\n"
+                                         "Connection: close\r\n\r\n";
+    static const char requestBody[] = "";
+
+    // Time from sending the request to the first event for the response, the
+    // latency the spinning of the helper is meant to cut down.
+    static uint64_t requestSentNs[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    // Time the socket was done with its page, as seen by the application.
+    static uint64_t responseDoneNs[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    static bool     responseSeen[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    uint64_t rttSumNs = 0;
+    uint64_t rttMaxNs = 0;
+
+    memset(requestSentNs, 0, sizeof(requestSentNs));
+    memset(responseDoneNs, 0, sizeof(responseDoneNs));
+    memset(responseSeen, 0, sizeof(responseSeen));
 
     /* Send the request to the host */
     for (i = 0; i < socket_max; i++)
     {
-        size_t offs = 0;
-        Debug_LOG_INFO("Writing request to socket %d for %.*s", i, 17, request);
-        request[13] = 'a' + i;
+        requestLine[13] = 'a' + (i % NUM_TEST_PAGES);
+        Debug_LOG_INFO("Writing request to socket %d for %.*s", i, 17,
+                       requestLine);
+
+        socket_io_vec_t fragments[] =
+        {
+            { requestLine, sizeof(requestLine) - 1 },
+            { requestHeaders, sizeof(requestHeaders) - 1 },
+            { requestBody, sizeof(requestBody) - 1 }
+        };
+        socket_io_vec_t* vec = fragments;
+        size_t numVec = sizeof(fragments) / sizeof(fragments[0]);
+
         do
         {
-            const size_t lenRemaining = len_request - offs;
+            const size_t lenRemaining = socket_io_vec_len(vec, numVec);
             size_t lenWritten = 0;
 
-            err = OS_Socket_write(
-                      handle[i],
-                      &request[offs],
-                      lenRemaining,
-                      &lenWritten);
+            err = socket_io_writev(handle[i], vec, numVec, &lenWritten);
 
             if (err != OS_SUCCESS)
             {
-                Debug_LOG_ERROR("OS_Socket_write() failed, code %d", err);
-                OS_Socket_close(handle[i]);
-                nb_helper_reset_ev_struct_for_socket(handle[i]);
-                return;
+                Debug_LOG_ERROR("socket_io_writev() failed, code %d", err);
+                nb_helper_socket_close(&nbHelper, handle[i]);
+                return false;
             }
 
             // Verify that the length written is at most the requested length.
             ASSERT_LE_SZ(lenWritten, lenRemaining);
 
-            offs += lenWritten;
+            socket_io_vec_consume(&vec, &numVec, lenWritten);
         }
-        while (offs < len_request);
+        while (socket_io_vec_len(vec, numVec) > 0);
+
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC,
+                           &requestSentNs[i]);
     }
     Debug_LOG_INFO("read response...");
 
@@ -828,22 +1100,73 @@ test_tcp_client()
     Once a webpage is read , display the contents.
     */
 
-    int flag = 0;
+    // Sockets done with their page, to be closed.
+    static bool done[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    int numDone = 0;
     char buffer[2048] = {0};
+    size_t len;
 
-    do
+    // Wait for all unfinished sockets at once and serve them in the order they
+    // become ready, so a slow socket does not stall the others. A socket
+    // stays registered until it is done.
+    static nb_helper_poll_t pollSet[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    static nb_helper_poll_t ready[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    nb_helper_poll_set_t set;
+
+    memset(done, 0, sizeof(done));
+
+    err = nb_helper_poll_set_init(&nbHelper, &set, pollSet,
+                                  OS_NETWORK_MAXIMUM_SOCKET_NO);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    for (i = 0; i < socket_max; i++)
     {
-        for (i = 0; i < socket_max; i++)
+        err = nb_helper_poll_set_add(&nbHelper, &set, handle[i],
+                                     OS_SOCK_EV_READ, &handle[i]);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    while (set.numFds > 0)
+    {
+        size_t numReady = 0;
+        err = nb_helper_wait_any_until(
+                  &nbHelper,
+                  &set,
+                  deadlineMs,
+                  ready,
+                  OS_NETWORK_MAXIMUM_SOCKET_NO,
+                  &numReady);
+        if (err == OS_ERROR_TIMEOUT)
         {
+            Debug_LOG_ERROR(
+                "Deadline of %d ms passed with %zu sockets still open",
+                CFG_TCP_CLIENT_DEADLINE_MS,
+                set.numFds);
+            break;
+        }
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        for (size_t r = 0; r < numReady; r++)
+        {
+            i = (OS_Socket_Handle_t*) ready[r].data - handle;
             len = sizeof(buffer);
+
+            if (!responseSeen[i])
+            {
+                uint64_t nowNs = 0;
+                TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &nowNs);
+
+                const uint64_t rttNs = nowNs - requestSentNs[i];
+                rttSumNs += rttNs;
+                rttMaxNs = (rttNs > rttMaxNs) ? rttNs : rttMaxNs;
+                responseSeen[i] = true;
+            }
+
             /* Keep calling read until we receive OS_ERROR_NETWORK_CONN_SHUTDOWN
-            from the stack */
+            from the stack. On FIN or error the read reports the reason. */
             OS_Error_t err = OS_ERROR_NETWORK_CONN_SHUTDOWN;
 
-            // Wait until we receive a read event for the socket.
-            err = nb_helper_wait_for_read_ev_on_socket(handle[i]);
-
-            if (!(flag & (1 << i)) && (err == OS_SUCCESS))
+            if (!(ready[r].revents & OS_SOCK_EV_CLOSE))
             {
                 err = OS_Socket_read(handle[i], buffer, len, &len);
             }
@@ -856,7 +1179,7 @@ test_tcp_client()
                 Debug_LOG_INFO(
                     "OS_Socket_read() reported connection closed for handle %d",
                     i);
-                flag |= 1 << i; /* terminate loop and close handle*/
+                done[i] = true; /* terminate loop and close handle*/
                 break;
 
             /* Success . continue further reading */
@@ -864,64 +1187,1685 @@ test_tcp_client()
                 Debug_LOG_INFO("chunk read, length %d, handle %d", len, i);
                 break;
 
+            /* Nothing to read yet, wait for the next event */
+            case OS_ERROR_TRY_AGAIN:
+                break;
+
             /* Error case, break and close the handle */
             default:
                 Debug_LOG_INFO(
                     "OS_Socket_read() failed for handle %d, error %d",
                     i,
                     err);
-                flag |= 1 << i; /* terminate loop and close handle */
+                done[i] = true; /* terminate loop and close handle */
                 break;
             } // end of switch
+
+            if (done[i])
+            {
+                TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC,
+                                   &responseDoneNs[i]);
+                numDone++;
+
+                err = nb_helper_poll_set_remove(&nbHelper, &set, handle[i]);
+                ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+            }
         }
     }
-    while (flag != pow(2, socket_max) - 1);
     Debug_LOG_INFO("Test ended");
 
+    const bool timedOut = (err == OS_ERROR_TIMEOUT);
+
+    // Sockets must not be closed while they are in the set.
+    while (set.numFds > 0)
+    {
+        err = nb_helper_poll_set_remove(&nbHelper, &set, set.fds[0].handle);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    if (prioritize)
+    {
+        nb_helper_set_dispatch_limit(&nbHelper, 0);
+    }
+
     for (i = 0; i < socket_max; i++)
     {
         /* Close the socket communication */
-        err = OS_Socket_close(handle[i]);
+        err = nb_helper_socket_close(&nbHelper, handle[i]);
         if (err != OS_SUCCESS)
         {
             Debug_LOG_ERROR(
-                "OS_Socket_close() failed for handle %d, code %d", i,
+                "nb_helper_socket_close() failed for handle %d, code %d", i,
                 err);
-            return;
+            return false;
+        }
+    }
+
+    int numResponses = 0;
+    for (i = 0; i < socket_max; i++)
+    {
+        numResponses += responseSeen[i];
+    }
+    if (numResponses > 0)
+    {
+        Debug_LOG_INFO(
+            "request round trip (spin max %u): avg %u us, max %u us over "
+            "%d sockets",
+            CFG_NB_HELPER_SPIN_MAX,
+            (uint32_t) (rttSumNs / numResponses / 1000),
+            (uint32_t) (rttMaxNs / 1000),
+            numResponses);
+    }
+
+    // Latency of the control socket while the bulk sockets compete with it.
+    uint64_t bulkSumNs = 0;
+    uint64_t bulkMaxNs = 0;
+    int numBulk = 0;
+    for (i = 1; i < socket_max; i++)
+    {
+        if (responseDoneNs[i])
+        {
+            const uint64_t doneNs = responseDoneNs[i] - requestSentNs[i];
+            bulkSumNs += doneNs;
+            bulkMaxNs = (doneNs > bulkMaxNs) ? doneNs : bulkMaxNs;
+            numBulk++;
         }
-        nb_helper_reset_ev_struct_for_socket(handle[i]);
+    }
+    const bool comparedPriorities =
+        (socket_max > 0) && responseDoneNs[0] && (numBulk > 0);
+    if (comparedPriorities)
+    {
+        nb_helper_stats_t statsAfter;
+        nb_helper_get_stats(&nbHelper, &statsAfter);
+
+        Debug_LOG_INFO(
+            "dispatch priorities %s: control socket done after %u us, "
+            "%d bulk sockets avg %u us, max %u us, %u sockets deferred, "
+            "at most %u calls",
+            prioritize ? "on" : "off",
+            (uint32_t) ((responseDoneNs[0] - requestSentNs[0]) / 1000),
+            numBulk,
+            (uint32_t) (bulkSumNs / numBulk / 1000),
+            (uint32_t) (bulkMaxNs / 1000),
+            statsAfter.deferredSockets - statsBefore.deferredSockets,
+            statsAfter.maxDeferRounds);
+    }
+
+    // Report how often the control thread was woken up compared to the number
+    // of delivered events.
+    nb_helper_stats_t stats;
+    nb_helper_get_stats(&nbHelper, &stats);
+    log_wakeup_stats(prioritize ? "fetch pages prioritized" : "fetch pages",
+                     &statsBefore,
+                     &stats,
+                     1);
+
+    // Event delivery RPCs per 1000 events. A callback subscription costs one
+    // OS_Socket_getPendingEvents() and one OS_Socket_regCallback() per batch,
+    // a persistent one only the former, plus a registration for every wait
+    // with a deadline that has to block.
+    const uint32_t rpcs = stats.pendingEventsRpcs + stats.callbackRegistrations;
+    Debug_LOG_INFO(
+        "nb_helper %s subscription: %u RPCs (%u getPendingEvents, "
+        "%u regCallback) for %u events, %u RPCs per 1000 events",
+        NB_HELPER_PERSISTENT_SUBSCRIPTION ? "persistent" : "callback",
+        rpcs,
+        stats.pendingEventsRpcs,
+        stats.callbackRegistrations,
+        stats.eventsDelivered,
+        stats.eventsDelivered ? (rpcs * 1000) / stats.eventsDelivered : 0);
+
+    Debug_LOG_INFO(
+        "nb_helper spin: %u of %u waits without blocking (%u%%), %u polls, "
+        "budget %u",
+        stats.spinHits,
+        stats.spinWaits,
+        stats.spinWaits ? (stats.spinHits * 100) / stats.spinWaits : 0,
+        stats.spinPolls,
+        stats.spinBudget);
+
+    Debug_LOG_INFO(
+        "nb_helper deadline timer: %u oneshots armed",
+        stats.deadlineTimerArms);
+
+    ASSERT_FALSE(timedOut);
+
+    // The comparison needs the control socket and at least one bulk socket to
+    // be done.
+    if (prioritize)
+    {
+        ASSERT_TRUE(comparedPriorities);
+    }
+
+    return true;
+}
+
+void
+test_tcp_client()
+{
+    TEST_START();
+
+    if (!fetch_pages(false))
+    {
+        return;
     }
 
     TEST_FINISH();
 }
 
-//------------------------------------------------------------------------------
-int
-run()
+#if OS_NETWORK_MAXIMUM_SOCKET_NO > 1
+
+// Sockets served by the second waiting thread, those of wait slot 1.
+static OS_Socket_Handle_t waiterHandle[OS_NETWORK_MAXIMUM_SOCKET_NO];
+static int waiterNumHandles;
+static uint64_t waiterDeadlineMs;
+// Pages fetched by the second waiting thread, -1 while it is running.
+static _Atomic int waiterNumFetched;
+
+// Requests a page and reads the response until the server closes the
+// connection, waiting on this socket alone. Returns false on failure.
+static bool
+fetch_page_on_socket(
+    const OS_Socket_Handle_t handle,
+    const int page,
+    const uint64_t deadlineMs,
+    char* const buffer,
+    const size_t bufferSize)
 {
-    Debug_LOG_INFO("Starting TestAppTCPClient %s...", get_instance_name());
+    char request[] = "GET /network/a.txt HTTP/1.0\r\n"
+                     "Host: " CFG_TEST_HTTP_SERVER "\r\n"
+                     "Connection: close\r\n\r\n";
+    request[13] = 'a' + (page % NUM_TEST_PAGES);
+
+    OS_Error_t err = socket_io_write_all(
+                         &nbHelper,
+                         handle,
+                         request,
+                         sizeof(request) - 1,
+                         deadlineMs,
+                         NULL);
+    if (err != OS_SUCCESS)
+    {
+        Debug_LOG_ERROR("socket_io_write_all() failed for handle %d, code %d",
+                        handle.handleID, err);
+        return false;
+    }
 
-#ifdef TCP_CLIENT
-    test_socket_create_neg();
-    test_socket_create_pos();
-    test_socket_close_pos();
-    test_socket_close_neg();
-    test_socket_connect_pos();
-    test_socket_connect_neg();
-    test_socket_non_blocking_neg();
-    test_tcp_write_pos();
-    test_tcp_write_neg();
-    test_tcp_read_pos();
-    test_tcp_read_neg();
-#endif
+    for (;;)
+    {
+        size_t len = 0;
 
-#ifdef TCP_CLIENT_MULTIPLE_CLIENTS
-    // synchronise the two clients
-    multiple_client_sync_send_ready_emit();
-    multiple_client_sync_recv_ready_wait();
-#endif
+        err = OS_Socket_read(handle, buffer, bufferSize, &len);
+        if (err == OS_ERROR_NETWORK_CONN_SHUTDOWN)
+        {
+            return true;
+        }
+        if ((err == OS_SUCCESS) && (len > 0))
+        {
+            continue;
+        }
+        if ((err != OS_SUCCESS) && (err != OS_ERROR_TRY_AGAIN))
+        {
+            Debug_LOG_ERROR("OS_Socket_read() failed for handle %d, code %d",
+                            handle.handleID, err);
+            return false;
+        }
 
-    test_tcp_client();
+        // A FIN or error is reported by the next read.
+        err = nb_helper_wait_for_read_ev_on_socket_until(
+                  &nbHelper,
+                  handle,
+                  deadlineMs);
+        if ((err == OS_ERROR_TIMEOUT) || (err == OS_ERROR_INVALID_STATE))
+        {
+            Debug_LOG_ERROR(
+                "nb_helper_wait_for_read_ev_on_socket_until() failed for "
+                "handle %d, code %d",
+                handle.handleID, err);
+            return false;
+        }
+    }
+}
+
+// Runs on the interface thread of waiter_start_recv_ready.
+static void
+slot_waiter_handler(
+    void* ctx)
+{
+    static char buffer[2048];
+    int numFetched = 0;
+
+    for (int i = 0; i < waiterNumHandles; i++)
+    {
+        if (fetch_page_on_socket(waiterHandle[i], i, waiterDeadlineMs,
+                                 buffer, sizeof(buffer)))
+        {
+            numFetched++;
+        }
+    }
+
+    atomic_store(&waiterNumFetched, numFetched);
+
+    int ret = waiter_start_recv_ready_reg_callback(&slot_waiter_handler, NULL);
+    if (0 != ret)
+    {
+        Debug_LOG_ERROR("Failed to re-register the second waiter, code %d",
+                        ret);
+    }
+}
+
+// Fetches a page over every socket with two threads, each waiting on the
+// sockets of its own wait slot one after the other. An event only wakes up the
+// thread waiting on the socket that received it, the wakeups are compared
+// with a single global wakeup of both threads.
+void
+test_tcp_client_wait_slots()
+{
+    TEST_START();
+
+    static OS_Socket_Handle_t handle[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    static OS_Socket_Handle_t ownHandle[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    static char buffer[2048];
+    int numOwn = 0;
+
+    OS_Error_t err = nb_helper_deadline_in(
+                         &nbHelper,
+                         CFG_TCP_CLIENT_DEADLINE_MS,
+                         &waiterDeadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    const int socket_max = connect_sockets(
+                               handle,
+                               OS_NETWORK_MAXIMUM_SOCKET_NO,
+                               true,
+                               waiterDeadlineMs);
+    ASSERT_GT_INT(socket_max, 0);
+
+    waiterNumHandles = 0;
+    for (int i = 0; i < socket_max; i++)
+    {
+        if ((handle[i].handleID % NUM_WAIT_SLOTS) == 1)
+        {
+            waiterHandle[waiterNumHandles++] = handle[i];
+        }
+        else
+        {
+            ownHandle[numOwn++] = handle[i];
+        }
+    }
+
+    nb_helper_stats_t statsBefore;
+    nb_helper_get_stats(&nbHelper, &statsBefore);
+
+    atomic_store(&waiterNumFetched, -1);
+    int ret = waiter_start_recv_ready_reg_callback(&slot_waiter_handler, NULL);
+    ASSERT_EQ_INT(0, ret);
+    waiter_start_send_ready_emit();
+
+    int numFetched = 0;
+    for (int i = 0; i < numOwn; i++)
+    {
+        if (fetch_page_on_socket(ownHandle[i], i, waiterDeadlineMs,
+                                 buffer, sizeof(buffer)))
+        {
+            numFetched++;
+        }
+    }
+
+    // The waits of the second thread are bounded by the same deadline.
+    while (atomic_load(&waiterNumFetched) < 0)
+    {
+        err = TimeServer_sleep(&timer, TimeServer_PRECISION_MSEC, 1);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+    numFetched += atomic_load(&waiterNumFetched);
+
+    nb_helper_stats_t statsAfter;
+    nb_helper_get_stats(&nbHelper, &statsAfter);
+    log_wakeup_stats("wait slots", &statsBefore, &statsAfter, NUM_WAIT_SLOTS);
+
+    Debug_LOG_INFO("%d of %d pages fetched, %d by the second thread",
+                   numFetched, socket_max, waiterNumHandles);
+
+    for (int i = 0; i < socket_max; i++)
+    {
+        err = nb_helper_socket_close(&nbHelper, handle[i]);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    ASSERT_EQ_INT(socket_max, numFetched);
+
+    TEST_FINISH();
+}
+
+#endif /* OS_NETWORK_MAXIMUM_SOCKET_NO > 1 */
+
+// Measures the wall time of setting up all sockets, connected one after the
+// other and all at once, like a client reconnecting in bulk after a failover.
+void
+test_tcp_connect_phase()
+{
+    TEST_START();
+
+    static OS_Socket_Handle_t handle[OS_NETWORK_MAXIMUM_SOCKET_NO];
+
+    for (int parallel = 0; parallel <= 1; parallel++)
+    {
+        uint64_t deadlineMs;
+        OS_Error_t err = nb_helper_deadline_in(
+                             &nbHelper,
+                             CFG_TCP_CLIENT_DEADLINE_MS,
+                             &deadlineMs);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        uint64_t startNs = 0;
+        uint64_t endNs = 0;
+
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+        const int numConnected = connect_sockets(
+                                     handle,
+                                     OS_NETWORK_MAXIMUM_SOCKET_NO,
+                                     parallel,
+                                     deadlineMs);
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+
+        for (int i = 0; i < numConnected; i++)
+        {
+            err = nb_helper_socket_close(&nbHelper, handle[i]);
+            ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+        }
+
+        Debug_LOG_INFO(
+            "BENCH name=tcp_connect mode=%s sockets=%d ns=%" PRIu64,
+            parallel ? "parallel" : "sequential",
+            numConnected,
+            endNs - startNs);
+
+        ASSERT_EQ_INT(OS_NETWORK_MAXIMUM_SOCKET_NO, numConnected);
+    }
+
+    TEST_FINISH();
+}
+
+// Compares the latency of a control connection competing with bulk transfers
+// to test_tcp_client(), where all sockets are handed out as they become ready.
+// Needs at least one bulk socket besides the control socket.
+void
+test_tcp_client_priorities()
+{
+    TEST_START();
+
+    if (!fetch_pages(true))
+    {
+        return;
+    }
+
+    TEST_FINISH();
+}
+
+//------------------------------------------------------------------------------
+#if CFG_TCP_CLIENT_CHURN_ITERATIONS > 0
+
+// Checks that churning did not use up sockets or leave state behind, all
+// sockets can be created at once again and the event table is clean.
+static void
+check_churn_leaks(
+    const char* const mode,
+    const uint32_t chunksBefore)
+{
+    static OS_Socket_Handle_t handle[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    int numAvailable;
+
+    for (numAvailable = 0; numAvailable < OS_NETWORK_MAXIMUM_SOCKET_NO;
+         numAvailable++)
+    {
+        OS_Error_t err = OS_Socket_create(
+                             &network_stack,
+                             &handle[numAvailable],
+                             OS_AF_INET,
+                             OS_SOCK_STREAM);
+        if (err != OS_SUCCESS)
+        {
+            break;
+        }
+    }
+    for (int i = 0; i < numAvailable; i++)
+    {
+        OS_Error_t err = nb_helper_socket_close(&nbHelper, handle[i]);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    nb_helper_stats_t stats;
+    nb_helper_get_stats(&nbHelper, &stats);
+    const size_t numBusy = nb_helper_count_busy_entries(&nbHelper);
+
+    Debug_LOG_INFO(
+        "socket churn %s: %d of %d sockets available, %u event table chunks "
+        "(%u before), %zu busy entries",
+        mode,
+        numAvailable,
+        OS_NETWORK_MAXIMUM_SOCKET_NO,
+        stats.eventTableChunks,
+        chunksBefore,
+        numBusy);
+
+    ASSERT_EQ_INT(OS_NETWORK_MAXIMUM_SOCKET_NO, numAvailable);
+    ASSERT_EQ_INT(chunksBefore, stats.eventTableChunks);
+    ASSERT_EQ_SZ(0, numBusy);
+}
+
+static void
+log_churn_rate(
+    const char* const mode,
+    const uint64_t elapsedNs)
+{
+    const uint64_t ns = (elapsedNs > 0) ? elapsedNs : 1;
+
+    Debug_LOG_INFO(
+        "BENCH name=socket_churn mode=%s iterations=%d ns=%" PRIu64
+        " sockets_per_sec=%" PRIu64,
+        mode,
+        CFG_TCP_CLIENT_CHURN_ITERATIONS,
+        ns,
+        (uint64_t) CFG_TCP_CLIENT_CHURN_ITERATIONS * 1000000000 / ns);
+}
+
+// Grows the create/close loop of test_socket_create_pos() into a sustained
+// churn, once only creating and closing a socket and once also connecting it
+// to the HTTP server on the test host. Reports the sockets per second of both
+// and checks for leaks after each.
+void
+test_socket_churn()
+{
+    TEST_START();
+
+    const OS_Socket_Addr_t dstAddr =
+    {
+        .addr = GATEWAY_ADDR,
+        .port = CFG_REACHABLE_PORT
+    };
+
+    OS_Socket_Handle_t handle;
+    uint64_t startNs = 0;
+    uint64_t endNs = 0;
+
+    nb_helper_stats_t stats;
+    nb_helper_get_stats(&nbHelper, &stats);
+    const uint32_t chunksBefore = stats.eventTableChunks;
+
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+    for (int i = 0; i < CFG_TCP_CLIENT_CHURN_ITERATIONS; i++)
+    {
+        OS_Error_t err = OS_Socket_create(
+                             &network_stack,
+                             &handle,
+                             OS_AF_INET,
+                             OS_SOCK_STREAM);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        err = nb_helper_socket_close(&nbHelper, handle);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+
+    log_churn_rate("create_close", endNs - startNs);
+    check_churn_leaks("create_close", chunksBefore);
+
+    uint64_t deadlineMs;
+    OS_Error_t err = nb_helper_deadline_in(
+                         &nbHelper,
+                         CFG_TCP_CLIENT_DEADLINE_MS,
+                         &deadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+    for (int i = 0; i < CFG_TCP_CLIENT_CHURN_ITERATIONS; i++)
+    {
+        err = OS_Socket_create(
+                  &network_stack,
+                  &handle,
+                  OS_AF_INET,
+                  OS_SOCK_STREAM);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        err = OS_Socket_connect(handle, &dstAddr);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        err = nb_helper_wait_for_conn_est_ev_on_socket_until(
+                  &nbHelper,
+                  handle,
+                  deadlineMs);
+        if (err != OS_SUCCESS)
+        {
+            Debug_LOG_ERROR("Connect %d of %d failed, code %d", i,
+                            CFG_TCP_CLIENT_CHURN_ITERATIONS, err);
+        }
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        err = nb_helper_socket_close(&nbHelper, handle);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+
+    log_churn_rate("create_connect_close", endNs - startNs);
+    check_churn_leaks("create_connect_close", chunksBefore);
+
+    TEST_FINISH();
+}
+
+#endif /* CFG_TCP_CLIENT_CHURN_ITERATIONS > 0 */
+
+//------------------------------------------------------------------------------
+#if CFG_TCP_CLIENT_BENCH_SOCKETS > 0
+
+_Static_assert(CFG_TCP_CLIENT_BENCH_SOCKETS <= OS_NETWORK_MAXIMUM_SOCKET_NO,
+               "CFG_TCP_CLIENT_BENCH_SOCKETS exceeds the available sockets");
+
+// Prints a throughput result as a single "BENCH" line of key=value pairs, so
+// the test runner can collect the numbers without parsing free text.
+static void
+log_bench_result(
+    const char* const name,
+    const int socket,
+    const uint64_t bytes,
+    const uint64_t elapsedNs)
+{
+    const uint64_t ns = (elapsedNs > 0) ? elapsedNs : 1;
+
+    Debug_LOG_INFO(
+        "BENCH name=%s socket=%d bytes=%" PRIu64 " ns=%" PRIu64
+        " bytes_per_sec=%" PRIu64,
+        name,
+        socket,
+        bytes,
+        ns,
+        bytes * 1000000000 / ns);
+}
+
+// Streams CFG_TCP_CLIENT_BENCH_PATH over CFG_TCP_CLIENT_BENCH_SOCKETS sockets
+// at once and reports the receive throughput of every socket and of all of
+// them together, socket -1 in the "BENCH" line. The byte counts include the
+// response headers. Nothing is logged per chunk, that would cost more than the
+// transfer itself.
+void
+test_tcp_bulk_throughput()
+{
+    TEST_START();
+
+    const OS_Socket_Addr_t dstAddr =
+    {
+        .addr = GATEWAY_ADDR,
+        .port = CFG_REACHABLE_PORT
+    };
+
+    static const char request[] =
+        "GET " CFG_TCP_CLIENT_BENCH_PATH " HTTP/1.0\r\n"
+        "Host: " CFG_TEST_HTTP_SERVER "\r\n"
+        "Connection: close\r\n\r\n";
+
+    // Kept off the stack, there may be hundreds of sockets.
+    static OS_Socket_Handle_t handle[CFG_TCP_CLIENT_BENCH_SOCKETS];
+    static uint64_t startNs[CFG_TCP_CLIENT_BENCH_SOCKETS];
+    static uint64_t doneNs[CFG_TCP_CLIENT_BENCH_SOCKETS];
+    static uint64_t rxBytes[CFG_TCP_CLIENT_BENCH_SOCKETS];
+    static char buffer[4096];
+
+    uint64_t deadlineMs;
+    OS_Error_t err = nb_helper_deadline_in(
+                         &nbHelper,
+                         CFG_TCP_CLIENT_DEADLINE_MS,
+                         &deadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    for (int i = 0; i < CFG_TCP_CLIENT_BENCH_SOCKETS; i++)
+    {
+        err = OS_Socket_create(
+                  &network_stack,
+                  &handle[i],
+                  OS_AF_INET,
+                  OS_SOCK_STREAM);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        err = OS_Socket_connect(handle[i], &dstAddr);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        err = nb_helper_wait_for_conn_est_ev_on_socket_until(
+                  &nbHelper,
+                  handle[i],
+                  deadlineMs);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    // All connections are up, so the transfers overlap from the start.
+    for (int i = 0; i < CFG_TCP_CLIENT_BENCH_SOCKETS; i++)
+    {
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs[i]);
+        err = socket_io_write_all(
+                  &nbHelper,
+                  handle[i],
+                  request,
+                  sizeof(request) - 1,
+                  deadlineMs,
+                  NULL);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    static nb_helper_poll_t pollSet[CFG_TCP_CLIENT_BENCH_SOCKETS];
+    static nb_helper_poll_t ready[CFG_TCP_CLIENT_BENCH_SOCKETS];
+    nb_helper_poll_set_t set;
+    int numDone = 0;
+
+    err = nb_helper_poll_set_init(&nbHelper, &set, pollSet,
+                                  CFG_TCP_CLIENT_BENCH_SOCKETS);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    for (int i = 0; i < CFG_TCP_CLIENT_BENCH_SOCKETS; i++)
+    {
+        err = nb_helper_poll_set_add(&nbHelper, &set, handle[i],
+                                     OS_SOCK_EV_READ, &handle[i]);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    while (numDone < CFG_TCP_CLIENT_BENCH_SOCKETS)
+    {
+        size_t numReady = 0;
+        err = nb_helper_wait_any_until(
+                  &nbHelper,
+                  &set,
+                  deadlineMs,
+                  ready,
+                  CFG_TCP_CLIENT_BENCH_SOCKETS,
+                  &numReady);
+        if (err == OS_ERROR_TIMEOUT)
+        {
+            Debug_LOG_ERROR(
+                "Deadline of %d ms passed with %zu transfers still running",
+                CFG_TCP_CLIENT_DEADLINE_MS,
+                set.numFds);
+        }
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        for (size_t r = 0; r < numReady; r++)
+        {
+            const int i = (OS_Socket_Handle_t*) ready[r].data - handle;
+
+            // Drain the socket, the next event only comes with new data.
+            for (;;)
+            {
+                size_t len = 0;
+
+                err = OS_ERROR_NETWORK_CONN_SHUTDOWN;
+                if (!(ready[r].revents & OS_SOCK_EV_CLOSE))
+                {
+                    err = OS_Socket_read(handle[i], buffer, sizeof(buffer),
+                                         &len);
+                }
+                if ((err == OS_SUCCESS) && (0 == len))
+                {
+                    err = OS_ERROR_TRY_AGAIN;
+                }
+                if (err != OS_SUCCESS)
+                {
+                    break;
+                }
+                rxBytes[i] += len;
+            }
+
+            if (err == OS_ERROR_TRY_AGAIN)
+            {
+                continue;
+            }
+            if (err != OS_ERROR_NETWORK_CONN_SHUTDOWN)
+            {
+                Debug_LOG_ERROR("OS_Socket_read() failed for socket %d, "
+                                "code %d", i, err);
+            }
+            ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_CONN_SHUTDOWN, err);
+
+            TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &doneNs[i]);
+            numDone++;
+
+            err = nb_helper_poll_set_remove(&nbHelper, &set, handle[i]);
+            ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+        }
+    }
+
+    uint64_t totalBytes = 0;
+    uint64_t firstStartNs = startNs[0];
+    uint64_t lastDoneNs = 0;
+
+    for (int i = 0; i < CFG_TCP_CLIENT_BENCH_SOCKETS; i++)
+    {
+        err = nb_helper_socket_close(&nbHelper, handle[i]);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        log_bench_result("tcp_rx", i, rxBytes[i], doneNs[i] - startNs[i]);
+
+        totalBytes += rxBytes[i];
+        firstStartNs = (startNs[i] < firstStartNs) ? startNs[i] : firstStartNs;
+        lastDoneNs = (doneNs[i] > lastDoneNs) ? doneNs[i] : lastDoneNs;
+    }
+
+    log_bench_result("tcp_rx", -1, totalBytes, lastDoneNs - firstStartNs);
+
+    TEST_FINISH();
+}
+
+// Streams CFG_TCP_CLIENT_BENCH_PATH over a single socket with the streaming
+// helpers, in blocks several times the size of the dataport, and reports the
+// throughput with the RPCs and waits it took. The byte count includes the
+// response header.
+void
+test_tcp_stream_throughput()
+{
+    TEST_START();
+
+    const OS_Socket_Addr_t dstAddr =
+    {
+        .addr = GATEWAY_ADDR,
+        .port = CFG_REACHABLE_PORT
+    };
+
+    static const char request[] =
+        "GET " CFG_TCP_CLIENT_BENCH_PATH " HTTP/1.0\r\n"
+        "Host: " CFG_TEST_HTTP_SERVER "\r\n"
+        "Connection: close\r\n\r\n";
+    static uint8_t block[16 * OS_DATAPORT_DEFAULT_SIZE];
+
+    OS_Socket_Handle_t handle;
+    socket_io_stats_t txStats;
+    socket_io_stats_t rxStats;
+    uint64_t rxBytes = 0;
+    uint32_t rxRpcs = 0;
+    uint32_t rxWaits = 0;
+    uint64_t startNs = 0;
+    uint64_t endNs = 0;
+    uint64_t deadlineMs;
+
+    OS_Error_t err = nb_helper_deadline_in(
+                         &nbHelper,
+                         CFG_TCP_CLIENT_DEADLINE_MS,
+                         &deadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = OS_Socket_create(
+              &network_stack,
+              &handle,
+              OS_AF_INET,
+              OS_SOCK_STREAM);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = OS_Socket_connect(handle, &dstAddr);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = nb_helper_wait_for_conn_est_ev_on_socket_until(
+              &nbHelper,
+              handle,
+              deadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+
+    err = socket_io_write_all(
+              &nbHelper,
+              handle,
+              request,
+              sizeof(request) - 1,
+              deadlineMs,
+              &txStats);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    // The last block is cut short by the server closing the connection.
+    do
+    {
+        err = socket_io_read_exact(
+                  &nbHelper,
+                  handle,
+                  block,
+                  sizeof(block),
+                  deadlineMs,
+                  &rxStats);
+        rxBytes += rxStats.bytes;
+        rxRpcs += rxStats.rpcs;
+        rxWaits += rxStats.waits;
+    }
+    while (err == OS_SUCCESS);
+    ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_CONN_SHUTDOWN, err);
+
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+
+    err = nb_helper_socket_close(&nbHelper, handle);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    const uint64_t ns = (endNs > startNs) ? endNs - startNs : 1;
+
+    Debug_LOG_INFO(
+        "BENCH name=tcp_stream bytes=%" PRIu64 " ns=%" PRIu64
+        " bytes_per_sec=%" PRIu64 " rx_rpcs=%u rx_waits=%u tx_rpcs=%u"
+        " tx_waits=%u",
+        rxBytes,
+        ns,
+        rxBytes * 1000000000 / ns,
+        rxRpcs,
+        rxWaits,
+        txStats.rpcs,
+        txStats.waits);
+
+    TEST_FINISH();
+}
+
+// Ways to receive data that is only inspected.
+typedef enum
+{
+    RX_COPY, // OS_Socket_read() into a buffer of the application
+    RX_LOAN, // socket_io_read_loan(), the data stays in the dataport
+    RX_NUM_MODES
+} rx_mode_t;
+
+static const char* const rxModeName[RX_NUM_MODES] =
+{
+    [RX_COPY] = "copy",
+    [RX_LOAN] = "loan"
+};
+
+// Stands for a consumer that only looks at the data.
+static uint32_t
+checksum_update(
+    uint32_t sum,
+    const uint8_t* const data,
+    const size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        sum = ((sum << 1) | (sum >> 31)) + data[i];
+    }
+
+    return sum;
+}
+
+// Streams CFG_TCP_CLIENT_BENCH_PATH over one socket and checksums it, receiving
+// the given way. busyNs is the time spent in the reads and the checksum, the
+// waits for data are left out.
+static void
+checksum_stream(
+    const OS_Socket_Addr_t* const dstAddr,
+    const rx_mode_t mode,
+    uint64_t* const bytes,
+    uint64_t* const busyNs,
+    uint32_t* const sum)
+{
+    static const char request[] =
+        "GET " CFG_TCP_CLIENT_BENCH_PATH " HTTP/1.0\r\n"
+        "Host: " CFG_TEST_HTTP_SERVER "\r\n"
+        "Connection: close\r\n\r\n";
+    static uint8_t buffer[OS_DATAPORT_DEFAULT_SIZE];
+
+    OS_Socket_Handle_t handle;
+    uint64_t deadlineMs;
+
+    *bytes = 0;
+    *busyNs = 0;
+    *sum = 0;
+
+    OS_Error_t err = nb_helper_deadline_in(
+                         &nbHelper,
+                         CFG_TCP_CLIENT_DEADLINE_MS,
+                         &deadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = OS_Socket_create(
+              &network_stack,
+              &handle,
+              OS_AF_INET,
+              OS_SOCK_STREAM);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = OS_Socket_connect(handle, dstAddr);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = nb_helper_wait_for_conn_est_ev_on_socket_until(
+              &nbHelper,
+              handle,
+              deadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = socket_io_write_all(
+              &nbHelper,
+              handle,
+              request,
+              sizeof(request) - 1,
+              deadlineMs,
+              NULL);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    for (;;)
+    {
+        uint64_t startNs = 0;
+        uint64_t endNs = 0;
+        size_t len = 0;
+
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+
+        if (mode == RX_LOAN)
+        {
+            socket_io_loan_t loan;
+
+            err = socket_io_read_loan(handle, SIZE_MAX, &loan);
+            if (err == OS_SUCCESS)
+            {
+                len = loan.len;
+                *sum = checksum_update(*sum, loan.buf, loan.len);
+                socket_io_loan_release(&loan);
+            }
+        }
+        else
+        {
+            err = OS_Socket_read(handle, buffer, sizeof(buffer), &len);
+            if (err == OS_SUCCESS)
+            {
+                *sum = checksum_update(*sum, buffer, len);
+            }
+        }
+
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+        *busyNs += endNs - startNs;
+        *bytes += len;
+
+        if ((err == OS_ERROR_TRY_AGAIN) || ((err == OS_SUCCESS) && (0 == len)))
+        {
+            err = nb_helper_wait_for_read_ev_on_socket_until(
+                      &nbHelper,
+                      handle,
+                      deadlineMs);
+        }
+        if (err != OS_SUCCESS)
+        {
+            break;
+        }
+    }
+    ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_CONN_SHUTDOWN, err);
+
+    err = nb_helper_socket_close(&nbHelper, handle);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+}
+
+// Receives CFG_TCP_CLIENT_BENCH_PATH once copied out of the dataport and once
+// lent in place, checksumming it both times, and reports the receive time per
+// MiB of both. The difference is the cost of the copy.
+void
+test_tcp_rx_zero_copy()
+{
+    TEST_START();
+
+    const OS_Socket_Addr_t dstAddr =
+    {
+        .addr = GATEWAY_ADDR,
+        .port = CFG_REACHABLE_PORT
+    };
+
+    uint64_t nsPerMiB[RX_NUM_MODES];
+
+    for (rx_mode_t mode = 0; mode < RX_NUM_MODES; mode++)
+    {
+        uint64_t bytes;
+        uint64_t busyNs;
+        uint32_t sum;
+
+        checksum_stream(&dstAddr, mode, &bytes, &busyNs, &sum);
+        ASSERT_GT_SZ(bytes, 0);
+
+        nsPerMiB[mode] = busyNs * (1024 * 1024) / bytes;
+
+        Debug_LOG_INFO(
+            "BENCH name=tcp_rx_checksum mode=%s bytes=%" PRIu64
+            " rx_ns=%" PRIu64 " rx_ns_per_mib=%" PRIu64 " checksum=0x%08x",
+            rxModeName[mode],
+            bytes,
+            busyNs,
+            nsPerMiB[mode],
+            sum);
+    }
+
+    Debug_LOG_INFO("Lending the dataport saves %" PRId64 " ns per MiB",
+                   (int64_t) nsPerMiB[RX_COPY] - (int64_t) nsPerMiB[RX_LOAN]);
+
+    TEST_FINISH();
+}
+
+#endif /* CFG_TCP_CLIENT_BENCH_SOCKETS > 0 */
+
+//------------------------------------------------------------------------------
+#if CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS > 0
+
+// Incremental parser of HTTP responses delimited by their Content-Length, fed
+// with whatever a read returned, so a response may end anywhere in a chunk and
+// a chunk may hold several responses.
+typedef struct
+{
+    bool   inBody;
+    bool   haveLength;    // Content-Length seen in the current header
+    size_t contentLength;
+    size_t bodyLeft;
+    char   line[32];      // start of the current header line
+    size_t lineLen;       // length of the whole line, even if truncated
+} http_resp_parser_t;
+
+// Returns the number of responses completed by the data, or -1 for a response
+// without Content-Length, which can't be delimited on a persistent connection.
+static int
+http_resp_parse(
+    http_resp_parser_t* const parser,
+    const char* data,
+    size_t len)
+{
+    int numComplete = 0;
+
+    while (len > 0)
+    {
+        if (parser->inBody)
+        {
+            const size_t n = (len < parser->bodyLeft) ? len : parser->bodyLeft;
+
+            parser->bodyLeft -= n;
+            data += n;
+            len -= n;
+            if (0 == parser->bodyLeft)
+            {
+                parser->inBody = false;
+                numComplete++;
+            }
+            continue;
+        }
+
+        const char c = *data++;
+        len--;
+
+        if (c != '\n')
+        {
+            if (parser->lineLen < sizeof(parser->line) - 1)
+            {
+                parser->line[parser->lineLen] = c;
+            }
+            parser->lineLen++;
+            continue;
+        }
+
+        // End of a header line, only its start is kept.
+        size_t n = (parser->lineLen < sizeof(parser->line) - 1) ?
+                   parser->lineLen : sizeof(parser->line) - 1;
+        if ((n > 0) && (parser->line[n - 1] == '\r'))
+        {
+            n--;
+        }
+        parser->line[n] = '\0';
+        parser->lineLen = 0;
+
+        if (n > 0)
+        {
+            static const char lengthField[] = "Content-Length:";
+
+            if (0 == strncasecmp(parser->line, lengthField,
+                                 sizeof(lengthField) - 1))
+            {
+                parser->contentLength =
+                    strtoul(&parser->line[sizeof(lengthField) - 1], NULL, 10);
+                parser->haveLength = true;
+            }
+            continue;
+        }
+
+        // An empty line ends the header.
+        if (!parser->haveLength)
+        {
+            return -1;
+        }
+        parser->haveLength = false;
+        parser->bodyLeft = parser->contentLength;
+        if (0 == parser->bodyLeft)
+        {
+            numComplete++;
+        }
+        else
+        {
+            parser->inBody = true;
+        }
+    }
+
+    return numComplete;
+}
+
+// Ways to hand a request made of several fragments to the network stack.
+typedef enum
+{
+    SEND_COPY,         // gathered in a buffer first, one OS_Socket_write()
+    SEND_PER_FRAGMENT, // one OS_Socket_write() per fragment
+    SEND_WRITEV,       // gathered into the dataport by socket_io_writev()
+    SEND_NUM_MODES
+} send_mode_t;
+
+static const char* const sendModeName[SEND_NUM_MODES] =
+{
+    [SEND_COPY]         = "copy",
+    [SEND_PER_FRAGMENT] = "per_fragment",
+    [SEND_WRITEV]       = "writev"
+};
+
+// Cost of sending the requests of a run.
+typedef struct
+{
+    uint32_t rpcs;
+    uint64_t writeNs;
+} send_stats_t;
+
+static void
+write_all(
+    const OS_Socket_Handle_t handle,
+    const void* const buf,
+    const size_t len,
+    send_stats_t* const stats)
+{
+    socket_io_stats_t ioStats;
+
+    OS_Error_t err = socket_io_write_all(
+                         &nbHelper,
+                         handle,
+                         buf,
+                         len,
+                         NB_HELPER_NO_DEADLINE,
+                         &ioStats);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    stats->rpcs += ioStats.rpcs;
+}
+
+// Writes a whole request, the socket buffer is expected to have room for it
+// soon.
+static void
+write_request(
+    const OS_Socket_Handle_t handle,
+    const send_mode_t mode,
+    socket_io_vec_t* vec,
+    size_t numVec,
+    send_stats_t* const stats)
+{
+    static char staging[1024];
+    uint64_t startNs = 0;
+    uint64_t endNs = 0;
+
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+
+    switch (mode)
+    {
+    case SEND_COPY:
+    {
+        size_t len = 0;
+        for (size_t i = 0; i < numVec; i++)
+        {
+            ASSERT_LE_SZ(vec[i].len, sizeof(staging) - len);
+            memcpy(&staging[len], vec[i].buf, vec[i].len);
+            len += vec[i].len;
+        }
+        write_all(handle, staging, len, stats);
+        break;
+    }
+    case SEND_PER_FRAGMENT:
+        for (size_t i = 0; i < numVec; i++)
+        {
+            write_all(handle, vec[i].buf, vec[i].len, stats);
+        }
+        break;
+    default:
+        while (socket_io_vec_len(vec, numVec) > 0)
+        {
+            size_t lenWritten = 0;
+
+            OS_Error_t err = socket_io_writev(handle, vec, numVec, &lenWritten);
+            stats->rpcs++;
+            if (err == OS_ERROR_TRY_AGAIN)
+            {
+                err = nb_helper_wait_for_write_ev_on_socket(&nbHelper, handle);
+                ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+                continue;
+            }
+            ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+            socket_io_vec_consume(&vec, &numVec, lenWritten);
+        }
+        break;
+    }
+
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+    stats->writeNs += endNs - startNs;
+}
+
+static void
+log_request_rate(
+    const char* const name,
+    const int depth,
+    const uint64_t elapsedNs)
+{
+    const uint64_t ns = (elapsedNs > 0) ? elapsedNs : 1;
+
+    Debug_LOG_INFO(
+        "BENCH name=%s requests=%d depth=%d ns=%" PRIu64
+        " requests_per_sec=%" PRIu64,
+        name,
+        CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS,
+        depth,
+        ns,
+        (uint64_t) CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS * 1000000000 / ns);
+}
+
+static void
+log_send_cost(
+    const send_mode_t mode,
+    const send_stats_t* const stats,
+    const uint64_t elapsedNs)
+{
+    const uint64_t ns = (elapsedNs > 0) ? elapsedNs : 1;
+
+    Debug_LOG_INFO(
+        "BENCH name=http_send mode=%s requests=%d rpcs=%u write_ns=%" PRIu64
+        " requests_per_sec=%" PRIu64,
+        sendModeName[mode],
+        CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS,
+        stats->rpcs,
+        stats->writeNs,
+        (uint64_t) CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS * 1000000000 / ns);
+}
+
+// Fetches the page CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS times over a single
+// persistent HTTP/1.1 connection with up to CFG_TCP_CLIENT_PIPELINE_DEPTH
+// requests in flight, sending the requests the given way. Returns the time it
+// took.
+static uint64_t
+fetch_keep_alive(
+    const OS_Socket_Addr_t* const dstAddr,
+    const send_mode_t mode,
+    send_stats_t* const stats)
+{
+    static const char requestLine[] = "GET /network/a.txt HTTP/1.1\r\n";
+    static const char requestHeaders[] = "Host: " CFG_TEST_HTTP_SERVER "\r\n"
+                                         "\r\n";
+    static const char requestBody[] = "";
+    static char buffer[2048];
+
+    OS_Socket_Handle_t handle;
+    uint64_t deadlineMs;
+    uint64_t startNs = 0;
+    uint64_t endNs = 0;
+    size_t len = 0;
+
+    memset(stats, 0, sizeof(*stats));
+
+    OS_Error_t err = nb_helper_deadline_in(
+                         &nbHelper,
+                         CFG_TCP_CLIENT_DEADLINE_MS,
+                         &deadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+
+    err = OS_Socket_create(
+              &network_stack,
+              &handle,
+              OS_AF_INET,
+              OS_SOCK_STREAM);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = OS_Socket_connect(handle, dstAddr);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = nb_helper_wait_for_conn_est_ev_on_socket_until(
+              &nbHelper,
+              handle,
+              deadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    http_resp_parser_t parser = {0};
+    int numSent = 0;
+    int numDone = 0;
+
+    while (numDone < CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS)
+    {
+        while ((numSent < CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS)
+               && (numSent - numDone < CFG_TCP_CLIENT_PIPELINE_DEPTH))
+        {
+            socket_io_vec_t fragments[] =
+            {
+                { requestLine, sizeof(requestLine) - 1 },
+                { requestHeaders, sizeof(requestHeaders) - 1 },
+                { requestBody, sizeof(requestBody) - 1 }
+            };
+
+            write_request(handle, mode, fragments,
+                          sizeof(fragments) / sizeof(fragments[0]), stats);
+            numSent++;
+        }
+
+        err = nb_helper_wait_for_read_ev_on_socket_until(
+                  &nbHelper,
+                  handle,
+                  deadlineMs);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        for (;;)
+        {
+            err = OS_Socket_read(handle, buffer, sizeof(buffer), &len);
+            if ((err != OS_SUCCESS) || (0 == len))
+            {
+                break;
+            }
+
+            const int numComplete = http_resp_parse(&parser, buffer, len);
+            if (numComplete < 0)
+            {
+                Debug_LOG_ERROR("Response without Content-Length");
+            }
+            ASSERT_LE_INT(0, numComplete);
+            numDone += numComplete;
+        }
+
+        // The server must not close the connection before all responses are
+        // in.
+        const bool connLost = (err != OS_SUCCESS) && (err != OS_ERROR_TRY_AGAIN)
+                              && (numDone < CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS);
+        if (connLost)
+        {
+            Debug_LOG_ERROR("Connection lost after %d of %d responses, "
+                            "code %d", numDone,
+                            CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS, err);
+        }
+        ASSERT_FALSE(connLost);
+    }
+
+    err = nb_helper_socket_close(&nbHelper, handle);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+
+    return endNs - startNs;
+}
+
+// Fetches the same page CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS times, once with a
+// connection per request as test_tcp_client() does and once over a single
+// persistent HTTP/1.1 connection with up to CFG_TCP_CLIENT_PIPELINE_DEPTH
+// requests in flight, and reports the request rate of both. The persistent
+// connection is repeated for every way of sending a request made of a request
+// line, headers and body, to compare their RPCs and write times.
+void
+test_tcp_keep_alive()
+{
+    TEST_START();
+
+    const OS_Socket_Addr_t dstAddr =
+    {
+        .addr = GATEWAY_ADDR,
+        .port = CFG_REACHABLE_PORT
+    };
+
+    static const char closeRequest[] =
+        "GET /network/a.txt HTTP/1.0\r\n"
+        "Host: " CFG_TEST_HTTP_SERVER "\r\n"
+        "Connection: close\r\n\r\n";
+    static char buffer[2048];
+
+    OS_Socket_Handle_t handle;
+    send_stats_t stats = {0};
+    uint64_t deadlineMs;
+    uint64_t startNs = 0;
+    uint64_t endNs = 0;
+    size_t len = 0;
+
+    OS_Error_t err = nb_helper_deadline_in(
+                         &nbHelper,
+                         CFG_TCP_CLIENT_DEADLINE_MS,
+                         &deadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    // Connection per request, every request pays for a handshake and a
+    // teardown.
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+    for (int r = 0; r < CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS; r++)
+    {
+        err = OS_Socket_create(
+                  &network_stack,
+                  &handle,
+                  OS_AF_INET,
+                  OS_SOCK_STREAM);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        err = OS_Socket_connect(handle, &dstAddr);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        err = nb_helper_wait_for_conn_est_ev_on_socket_until(
+                  &nbHelper,
+                  handle,
+                  deadlineMs);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        write_all(handle, closeRequest, sizeof(closeRequest) - 1, &stats);
+
+        do
+        {
+            err = nb_helper_wait_for_read_ev_on_socket_until(
+                      &nbHelper,
+                      handle,
+                      deadlineMs);
+            ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+            do
+            {
+                err = OS_Socket_read(handle, buffer, sizeof(buffer), &len);
+            }
+            while ((err == OS_SUCCESS) && (len > 0));
+        }
+        while ((err == OS_SUCCESS) || (err == OS_ERROR_TRY_AGAIN));
+        ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_CONN_SHUTDOWN, err);
+
+        err = nb_helper_socket_close(&nbHelper, handle);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+
+    log_request_rate("http_close", 1, endNs - startNs);
+
+    // One persistent connection, the next requests are sent before the
+    // responses to the previous ones have arrived.
+    for (send_mode_t mode = 0; mode < SEND_NUM_MODES; mode++)
+    {
+        const uint64_t elapsedNs = fetch_keep_alive(&dstAddr, mode, &stats);
+
+        if (mode == SEND_WRITEV)
+        {
+            log_request_rate("http_keep_alive", CFG_TCP_CLIENT_PIPELINE_DEPTH,
+                             elapsedNs);
+        }
+        log_send_cost(mode, &stats, elapsedNs);
+    }
+
+    TEST_FINISH();
+}
+
+#endif /* CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS > 0 */
+
+//------------------------------------------------------------------------------
+// Lookups per configuration when measuring the event table, enough to make the
+// two TimeServer RPCs around them negligible.
+#define EV_TABLE_LOOKUPS 65536
+
+// Returns the time a pair of TimeServer_getTime() calls takes, which is left
+// out of the measured intervals.
+static uint64_t
+get_time_overhead_ns(void)
+{
+    uint64_t startNs = 0;
+    uint64_t endNs = 0;
+    uint64_t minNs = UINT64_MAX;
+
+    for (int i = 0; i < 8; i++)
+    {
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+        if (endNs - startNs < minNs)
+        {
+            minNs = endNs - startNs;
+        }
+    }
+
+    return minNs;
+}
+
+// Looks up the entry of every socket in use the way a wait does, a wait with
+// NB_HELPER_DEADLINE_NOW on a socket without events. The helper is not
+// subscribed, so nothing calls into the network stack.
+static void
+ev_table_lookup_pass(
+    nb_helper_t* const nbh,
+    const size_t socketsInUse)
+{
+    OS_Socket_Handle_t handle = { .ctx = network_stack };
+
+    for (size_t i = 0; i < socketsInUse; i++)
+    {
+        handle.handleID = i;
+        OS_Error_t err = nb_helper_wait_for_read_ev_on_socket_until(
+                             nbh,
+                             handle,
+                             NB_HELPER_DEADLINE_NOW);
+        ASSERT_EQ_OS_ERR(OS_ERROR_TIMEOUT, err);
+    }
+}
+
+// Measures the cost of an event table lookup as the number of sockets grows.
+// The first pass also allocates the chunks holding the entries, later passes
+// hit populated chunks. Uses its own helper instance, so no network traffic is
+// needed.
+void
+test_ev_table_lookup_scaling()
+{
+    TEST_START();
+
+    static const struct
+    {
+        size_t maxSockets;
+        size_t socketsInUse;
+    } runs[] =
+    {
+        { 16,   16   },
+        { 256,  256  },
+        { 4096, 16   },
+#if CFG_TCP_CLIENT_EV_TABLE_LARGE_RUN
+        { 4096, 4096 },
+#endif
+    };
+
+    const uint64_t overheadNs = get_time_overhead_ns();
+
+    for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++)
+    {
+        nb_helper_t nbh;
+        OS_Error_t err = nb_helper_init(
+                             &nbh,
+                             &network_stack,
+                             runs[r].maxSockets,
+                             event_received_send_ready_emit,
+                             event_received_recv_ready_wait,
+                             SharedResourceMutex_lock,
+                             SharedResourceMutex_unlock);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        const size_t socketsInUse = runs[r].socketsInUse;
+        const size_t rounds = EV_TABLE_LOOKUPS / socketsInUse;
+        uint64_t startNs = 0;
+        uint64_t firstUseNs = 0;
+        uint64_t endNs = 0;
+
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+        ev_table_lookup_pass(&nbh, socketsInUse);
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &firstUseNs);
+        for (size_t round = 0; round < rounds; round++)
+        {
+            ev_table_lookup_pass(&nbh, socketsInUse);
+        }
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+
+        const uint64_t firstUseTotalNs = firstUseNs - startNs;
+        const uint64_t lookupTotalNs = endNs - firstUseNs;
+
+        nb_helper_stats_t stats;
+        nb_helper_get_stats(&nbh, &stats);
+
+        Debug_LOG_INFO(
+            "event table, %zu of %zu sockets in use: first use %u ns/socket, "
+            "lookup %u ns/socket, %u chunks, %u bytes",
+            socketsInUse,
+            runs[r].maxSockets,
+            (uint32_t) ((firstUseTotalNs > overheadNs ?
+                         firstUseTotalNs - overheadNs : 0) / socketsInUse),
+            (uint32_t) ((lookupTotalNs > overheadNs ?
+                         lookupTotalNs - overheadNs : 0)
+                        / (socketsInUse * rounds)),
+            stats.eventTableChunks,
+            stats.eventTableBytes);
+
+        nb_helper_deinit(&nbh);
+    }
+
+    TEST_FINISH();
+}
+
+//------------------------------------------------------------------------------
+int
+run()
+{
+    Debug_LOG_INFO("Starting TestAppTCPClient %s...", get_instance_name());
+
+#ifdef TCP_CLIENT
+    test_socket_create_neg();
+    test_socket_create_pos();
+#if CFG_TCP_CLIENT_CHURN_ITERATIONS > 0
+    test_socket_churn();
+#endif
+    test_socket_close_pos();
+    test_socket_close_neg();
+    test_socket_connect_pos();
+    test_socket_connect_neg();
+    test_socket_non_blocking_neg();
+    test_tcp_write_pos();
+    test_tcp_write_neg();
+    test_tcp_read_pos();
+    test_tcp_read_neg();
+    test_ev_table_lookup_scaling();
+#endif
+
+#ifdef TCP_CLIENT_MULTIPLE_CLIENTS
+    // synchronise the two clients
+    multiple_client_sync_send_ready_emit();
+    multiple_client_sync_recv_ready_wait();
+#endif
+
+    test_tcp_client();
+
+#if OS_NETWORK_MAXIMUM_SOCKET_NO > 1
+    test_tcp_client_wait_slots();
+    test_tcp_client_priorities();
+#endif
+
+#ifndef TCP_CLIENT_MULTIPLE_CLIENTS
+    // With two clients on the stack the time would include the connects of
+    // the other one.
+    test_tcp_connect_phase();
+#endif
+
+#if CFG_TCP_CLIENT_BENCH_SOCKETS > 0
+    test_tcp_bulk_throughput();
+    test_tcp_stream_throughput();
+    test_tcp_rx_zero_copy();
+#endif
+
+#if CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS > 0
+    test_tcp_keep_alive();
+#endif
 
     return 0;
 }
@@ -13,26 +13,104 @@
 #include "lib_debug/Debug.h"
 #include "lib_macros/Test.h"
 #include "stdint.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "OS_Socket.h"
+#include "TimeServer.h"
 #include "interfaces/if_OS_Socket.h"
 #include "util/loop_defines.h"
 #include "util/non_blocking_helper.h"
+#include "util/pt_sched.h"
+#include "util/socket_io.h"
+#include "util/worker_pool.h"
 #include <camkes.h>
 
 static const if_OS_Socket_t network_stack =
     IF_OS_SOCKET_ASSIGN(networkStack);
 
+// Helper instance serving the events of network_stack.
+static nb_helper_t nbHelper;
+
+static const if_OS_Timer_t timer =
+    IF_OS_TIMER_ASSIGN(
+        timeServer_rpc,
+        timeServer_notify);
+
 /*
- * This example demonstrates a server with an incoming connection. Reads
- *  incoming data after a connection is established. Writes or echoes the
- * received data back to the client. When the connection with the client is
- * closed a new round begins, in an infinitive loop. Currently only a single
- * socket is supported per stack instance. i.e. no multitasking is supported as
- * of now.
+ * This example demonstrates a server with incoming connections. Reads incoming
+ * data after a connection is established. Writes or echoes the received data
+ * back to the client. Every connection and the listening socket are served by
+ * their own task of a cooperative scheduler, so several clients are served at
+ * the same time by the single run() thread, or by a pool of worker threads if
+ * CFG_TCP_SERVER_WORKERS is set. This runs in an infinite loop.
  */
 
+// One socket is reserved for the listening socket.
+#define MAX_CLIENTS (OS_NETWORK_MAXIMUM_SOCKET_NO - 1)
+
+// State of a client connection, kept across the waits of its task.
+typedef struct
+{
+    _Atomic bool       inUse;
+    OS_Socket_Handle_t handle;
+    size_t             len;     // bytes received into the buffer
+    size_t             written; // bytes of the buffer echoed back so far
+    uint64_t           startNs; // time the connection was accepted
+    uint64_t           bytesNotCopied;
+    char               buffer[4096];
+} client_conn_t;
+
+// With workers, the tasks share these across threads.
+static client_conn_t clientConns[MAX_CLIENTS];
+static _Atomic size_t numClients;
+
+static OS_Socket_Handle_t srvHandle;
+static pt_sched_t sched;
+static pt_task_t* acceptTask;
+
+#if CFG_TCP_SERVER_WORKERS > 0
+
+_Static_assert(CFG_TCP_SERVER_WORKERS <= WORKER_POOL_MAX_WORKERS,
+               "CFG_TCP_SERVER_WORKERS exceeds the worker notifications");
+
+static const worker_pool_thread_t workerThreads[WORKER_POOL_MAX_WORKERS] =
+{
+    { worker0_wake_send_ready_emit, worker0_wake_recv_ready_reg_callback },
+    { worker1_wake_send_ready_emit, worker1_wake_recv_ready_reg_callback },
+    { worker2_wake_send_ready_emit, worker2_wake_recv_ready_reg_callback },
+    { worker3_wake_send_ready_emit, worker3_wake_recv_ready_reg_callback },
+};
+
+static worker_pool_t workerPool;
+
+// Synthetic load of the pool benchmark, the cost of a step differs between
+// the tasks so the workers run out of work at different times.
+#define POOL_BENCH_TASKS      64
+#define POOL_BENCH_STEPS      32
+#define POOL_BENCH_STEP_ITERS 2000
+
+typedef struct
+{
+    uint32_t step;
+    uint32_t iters;
+    uint32_t value;
+} pool_bench_load_t;
+
+// Event mask updates per worker in the false sharing benchmark.
+#define MASK_BENCH_OPS        100000
+
+typedef struct
+{
+    worker_pool_item_t item;
+    _Atomic uint8_t*   mask;
+} mask_bench_item_t;
+
+#endif /* CFG_TCP_SERVER_WORKERS > 0 */
+
 //------------------------------------------------------------------------------
 void
 pre_init(void)
@@ -43,25 +121,53 @@ pre_init(void)
     Debug_ASSERT(err == OS_SUCCESS);
 #endif
     // Initialize the helper lib with the required synchronization mechanisms.
-    nb_helper_init(
-        event_received_send_ready_emit,
-        event_received_recv_ready_wait,
-        SharedResourceMutex_lock,
-        SharedResourceMutex_unlock);
-
-    // Set up callback for new received socket events.
-    err = OS_Socket_regCallback(
+    err = nb_helper_init(
+              &nbHelper,
               &network_stack,
-              &nb_helper_collect_pending_ev_handler,
-              (void*) &network_stack);
+              OS_NETWORK_MAXIMUM_SOCKET_NO,
+              event_received_send_ready_emit,
+              event_received_recv_ready_wait,
+              SharedResourceMutex_lock,
+              SharedResourceMutex_unlock);
+    if (err != OS_SUCCESS)
+    {
+        Debug_LOG_ERROR("nb_helper_init() failed, code %d", err);
+    }
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    // Sleep on the TimeServer instead of spinning while waiting.
+    nb_helper_set_timer(&nbHelper, &timer);
+
+    // Optionally spin on the notification before blocking on it.
+    nb_helper_set_spin(
+        &nbHelper,
+        event_received_recv_ready_poll,
+        CFG_NB_HELPER_SPIN_MAX);
+
+    // Subscribe to the socket events of the network stack.
+    err = nb_helper_subscribe(
+              &nbHelper,
+              NB_HELPER_PERSISTENT_SUBSCRIPTION);
     if (err != OS_SUCCESS)
     {
-        Debug_LOG_ERROR(
-            "OS_Socket_regCallback() failed, code %d", err);
+        Debug_LOG_ERROR("nb_helper_subscribe() failed, code %d", err);
     }
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-    err = nb_helper_wait_for_network_stack_init(&network_stack);
+#if CFG_TCP_SERVER_WORKERS > 0
+    err = worker_pool_init(
+              &workerPool,
+              workerThreads,
+              CFG_TCP_SERVER_WORKERS,
+              workers_done_send_ready_emit,
+              workers_done_recv_ready_wait);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = worker_pool_start(&workerPool);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+#endif
+
+    err = nb_helper_wait_for_network_stack_init(&nbHelper);
     if (err != OS_SUCCESS)
     {
         Debug_LOG_ERROR("nb_helper_wait_for_network_stack_init() failed, code %d", err);
@@ -69,13 +175,459 @@ pre_init(void)
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 }
 
+//------------------------------------------------------------------------------
+// How often the echo loop got its events while spinning instead of blocking.
+static void
+log_spin_stats(void)
+{
+    nb_helper_stats_t stats;
+    nb_helper_get_stats(&nbHelper, &stats);
+
+    Debug_LOG_INFO(
+        "nb_helper spin: %u of %u waits without blocking (%u%%), %u polls, "
+        "budget %u",
+        stats.spinHits,
+        stats.spinWaits,
+        stats.spinWaits ? (stats.spinHits * 100) / stats.spinWaits : 0,
+        stats.spinPolls,
+        stats.spinBudget);
+}
+
+//------------------------------------------------------------------------------
+// How much copying the echo of a connection saved by working in the dataport.
+static void
+log_copy_stats(
+    const client_conn_t* const conn)
+{
+    uint64_t nowNs = 0;
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &nowNs);
+
+    const uint64_t ns = (nowNs > conn->startNs) ? nowNs - conn->startNs : 1;
+
+    Debug_LOG_INFO(
+        "BENCH name=tcp_echo_zero_copy bytes_not_copied=%" PRIu64
+        " ns=%" PRIu64 " bytes_per_sec=%" PRIu64 " total_bytes_not_copied=%"
+        PRIu64,
+        conn->bytesNotCopied,
+        ns,
+        conn->bytesNotCopied * 1000000000 / ns,
+        socket_io_get_bytes_not_copied());
+}
+
+//------------------------------------------------------------------------------
+// Reads into the dataport and writes the data back right from there, instead
+// of copying it out and in again. Whatever a partial write leaves over is saved
+// in the buffer of the connection, to be written once there is room again.
+static OS_Error_t
+echo_in_place(
+    client_conn_t* const conn)
+{
+    socket_io_loan_t loan;
+    socket_io_tx_t tx;
+    size_t written = 0;
+
+    conn->len = 0;
+    conn->written = 0;
+
+    OS_Error_t err = socket_io_read_loan(
+                         conn->handle,
+                         sizeof(conn->buffer),
+                         &loan);
+    if ((err != OS_SUCCESS) || (0 == loan.len))
+    {
+        return err;
+    }
+
+    socket_io_tx_acquire_loan(&loan, &tx);
+
+    err = socket_io_tx_commit(conn->handle, &tx, tx.size, &written);
+    if (err == OS_ERROR_TRY_AGAIN)
+    {
+        err = OS_SUCCESS;
+    }
+    if (err == OS_SUCCESS)
+    {
+        // Only what went out in place was not copied, the rest is copied
+        // out now and in again by the write below.
+        conn->bytesNotCopied += written;
+        conn->len = tx.size - written;
+        memcpy(conn->buffer, (const char*)tx.buf + written, conn->len);
+    }
+
+    socket_io_tx_release(&tx);
+
+    if (err != OS_SUCCESS)
+    {
+        Debug_LOG_ERROR("socket_io_tx_commit() failed, error %d", err);
+    }
+
+    return err;
+}
+
+//------------------------------------------------------------------------------
+static pt_task_state_t
+client_task(
+    pt_task_t* task)
+{
+    client_conn_t* conn = task->arg;
+    OS_Error_t err = OS_SUCCESS;
+
+    PT_BEGIN(task);
+
+    for (;;)
+    {
+        PT_WAIT_EVENTS(task, conn->handle, OS_SOCK_EV_READ);
+
+        /*
+            As of now the nw stack behavior is as below:
+            Keep reading data until you receive one of the return values:
+             a. err = OS_ERROR_NETWORK_CONN_SHUTDOWN indicating end of data
+                read and connection close
+             b. err = OS_ERROR_GENERIC due to error in read
+             c. err = OS_ERROR_TRY_AGAIN indicating no data to read but
+                there is still a connection
+             d. err = OS_SUCCESS and length > 0, valid data
+
+            Take appropriate actions based on the return value rxd.
+        */
+        Debug_LOG_TRACE("read...");
+
+        err = OS_ERROR_NETWORK_CONN_SHUTDOWN;
+        if (!(task->revents & OS_SOCK_EV_CLOSE))
+        {
+            // Try to read as much as fits into the buffer and echo it.
+            err = echo_in_place(conn);
+        }
+
+        if (err == OS_ERROR_TRY_AGAIN)
+        {
+            continue;
+        }
+        if (err != OS_SUCCESS)
+        {
+            break;
+        }
+
+        // Only the rest of a partial write is left for here.
+        while (conn->written < conn->len)
+        {
+            size_t bytesWritten = 0;
+
+            err = OS_Socket_write(
+                      conn->handle,
+                      &conn->buffer[conn->written],
+                      conn->len - conn->written,
+                      &bytesWritten);
+            if (err == OS_ERROR_TRY_AGAIN)
+            {
+                // Serve the other connections until there is room again.
+                PT_WAIT_EVENTS(task, conn->handle, OS_SOCK_EV_WRITE);
+                continue;
+            }
+            if (err != OS_SUCCESS)
+            {
+                Debug_LOG_ERROR("OS_Socket_write() failed, error %d", err);
+                break;
+            }
+            conn->written += bytesWritten;
+        }
+        if (err != OS_SUCCESS)
+        {
+            break;
+        }
+    }
+
+    switch (err)
+    {
+    /* This means end of read as socket was closed. Exit now and close
+     * handle*/
+    case OS_ERROR_NETWORK_CONN_SHUTDOWN:
+        // the test runner checks for this string
+        Debug_LOG_INFO("connection closed by server");
+        log_spin_stats();
+        log_copy_stats(conn);
+        break;
+    /* Any other value is a failure in read, hence exit and close handle  */
+    default:
+        Debug_LOG_ERROR("server socket failure, error %d", err);
+        break;
+    } // end of switch
+
+    nb_helper_socket_close(&nbHelper, conn->handle);
+
+    atomic_store(&conn->inUse, false);
+    atomic_fetch_sub(&numClients, 1);
+
+    // There is room for another client now.
+    pt_sched_wake(acceptTask);
+
+    PT_END(task);
+}
+
+//------------------------------------------------------------------------------
+static pt_task_state_t
+accept_task(
+    pt_task_t* task)
+{
+    OS_Error_t err;
+
+    PT_BEGIN(task);
+
+    for (;;)
+    {
+        // Only accept new clients while there is room for them.
+        while (atomic_load(&numClients) == MAX_CLIENTS)
+        {
+            PT_SUSPEND(task);
+        }
+
+        PT_WAIT_EVENTS(task, srvHandle, OS_SOCK_EV_CONN_ACPT);
+
+        client_conn_t* conn = NULL;
+        for (size_t i = 0; i < MAX_CLIENTS; i++)
+        {
+            if (!atomic_load(&clientConns[i].inUse))
+            {
+                conn = &clientConns[i];
+                break;
+            }
+        }
+        Debug_ASSERT(NULL != conn);
+
+        OS_Socket_Addr_t srcAddr = {0};
+
+        err = OS_Socket_accept(
+                  srvHandle,
+                  &conn->handle,
+                  &srcAddr);
+        if (err == OS_ERROR_TRY_AGAIN)
+        {
+            continue;
+        }
+        if (err != OS_SUCCESS)
+        {
+            Debug_LOG_ERROR("OS_Socket_accept() failed, error %d", err);
+            break;
+        }
+
+        Debug_LOG_INFO("starting server read loop for handle %d",
+                       conn->handle.handleID);
+        conn->bytesNotCopied = 0;
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &conn->startNs);
+        atomic_store(&conn->inUse, true);
+        atomic_fetch_add(&numClients, 1);
+
+        // There is a task for every possible client, so this can't fail.
+        err = pt_sched_spawn(&sched, client_task, conn, NULL);
+        Debug_ASSERT(err == OS_SUCCESS);
+    }
+
+    PT_END(task);
+}
+
+#if CFG_TCP_SERVER_WORKERS > 0
+
+//------------------------------------------------------------------------------
+static pt_task_state_t
+pool_bench_task(
+    pt_task_t* task)
+{
+    pool_bench_load_t* load = task->arg;
+
+    PT_BEGIN(task);
+
+    for (load->step = 0; load->step < POOL_BENCH_STEPS; load->step++)
+    {
+        // xorshift, just to keep the CPU busy.
+        for (uint32_t i = 0; i < load->iters; i++)
+        {
+            load->value ^= load->value << 13;
+            load->value ^= load->value >> 17;
+            load->value ^= load->value << 5;
+        }
+        PT_YIELD(task);
+    }
+
+    PT_END(task);
+}
+
+//------------------------------------------------------------------------------
+// Runs the same synthetic load with 1, 2, 4, ... workers and logs the scaling.
+static void
+pool_bench(void)
+{
+    static pool_bench_load_t loads[POOL_BENCH_TASKS];
+    uint64_t baseNs = 0;
+
+    for (size_t workers = 1; workers <= CFG_TCP_SERVER_WORKERS; workers *= 2)
+    {
+        pt_sched_t benchSched;
+
+        OS_Error_t err = pt_sched_init(&benchSched, &nbHelper,
+                                       POOL_BENCH_TASKS);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        err = worker_pool_set_active(&workerPool, workers);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+        err = pt_sched_set_pool(&benchSched, &workerPool);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        for (size_t i = 0; i < POOL_BENCH_TASKS; i++)
+        {
+            loads[i].iters = POOL_BENCH_STEP_ITERS * (1 + (i % 8));
+            loads[i].value = i + 1;
+            err = pt_sched_spawn(&benchSched, pool_bench_task, &loads[i],
+                                 NULL);
+            ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+        }
+
+        worker_pool_worker_stats_t before[WORKER_POOL_MAX_WORKERS];
+        for (size_t w = 0; w < CFG_TCP_SERVER_WORKERS; w++)
+        {
+            worker_pool_get_stats(&workerPool, w, &before[w]);
+        }
+
+        uint64_t startNs = 0;
+        uint64_t endNs = 0;
+
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+        err = pt_sched_run(&benchSched);
+        TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        uint32_t stolen = 0;
+        for (size_t w = 0; w < CFG_TCP_SERVER_WORKERS; w++)
+        {
+            worker_pool_worker_stats_t after;
+            worker_pool_get_stats(&workerPool, w, &after);
+            stolen += after.itemsStolen - before[w].itemsStolen;
+        }
+
+        const uint64_t elapsedNs = (endNs > startNs) ? (endNs - startNs) : 1;
+        if (1 == workers)
+        {
+            baseNs = elapsedNs;
+        }
+
+        Debug_LOG_INFO(
+            "worker pool, %zu workers: %u steps in %" PRIu64 " us, "
+            "%" PRIu64 " steps/s, speedup %" PRIu64 ".%02" PRIu64 ", "
+            "%u steals",
+            workers,
+            benchSched.stats.steps,
+            elapsedNs / 1000,
+            (uint64_t) benchSched.stats.steps * 1000000000 / elapsedNs,
+            baseNs / elapsedNs,
+            (baseNs * 100 / elapsedNs) % 100,
+            stolen);
+
+        pt_sched_deinit(&benchSched);
+    }
+
+    worker_pool_set_active(&workerPool, CFG_TCP_SERVER_WORKERS);
+}
+
+//------------------------------------------------------------------------------
+// Does what the event callback and a consumer do to the event mask of a socket.
+static void
+mask_bench_item_run(
+    worker_pool_item_t* item)
+{
+    mask_bench_item_t* benchItem =
+        (mask_bench_item_t*)((char*)item - offsetof(mask_bench_item_t, item));
+
+    for (uint32_t i = 0; i < MASK_BENCH_OPS; i++)
+    {
+        atomic_fetch_or(benchItem->mask, OS_SOCK_EV_READ);
+        atomic_fetch_and(benchItem->mask, (uint8_t) ~OS_SOCK_EV_READ);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Runs the updates of mask_bench_item_run() on the given number of workers,
+// each worker working on a mask of its own, and returns the time taken.
+static uint64_t
+mask_bench_run(
+    const size_t workers,
+    _Atomic uint8_t* const masks[WORKER_POOL_MAX_WORKERS])
+{
+    static mask_bench_item_t items[WORKER_POOL_MAX_WORKERS];
+
+    for (size_t w = 0; w < workers; w++)
+    {
+        items[w].item.next = NULL;
+        items[w].item.run  = mask_bench_item_run;
+        items[w].mask      = masks[w];
+    }
+
+    uint64_t startNs = 0;
+    uint64_t endNs = 0;
+
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
+    for (size_t w = 0; w < workers; w++)
+    {
+        worker_pool_submit(&workerPool, &items[w].item);
+    }
+    worker_pool_wait_idle(&workerPool);
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &endNs);
+
+    return (endNs > startNs) ? (endNs - startNs) : 1;
+}
+
+//------------------------------------------------------------------------------
+// Compares the cost of the event mask updates on 1, 2, 4, ... workers with the
+// masks packed into one cache line, as they were before the event table
+// entries got a line of their own, and with the masks in event table entries.
+static void
+mask_bench(void)
+{
+    static _Atomic uint8_t packedMasks[WORKER_POOL_MAX_WORKERS];
+    static nb_helper_ev_slot_t slots[WORKER_POOL_MAX_WORKERS];
+
+    _Atomic uint8_t* packed[WORKER_POOL_MAX_WORKERS];
+    _Atomic uint8_t* padded[WORKER_POOL_MAX_WORKERS];
+
+    for (size_t w = 0; w < WORKER_POOL_MAX_WORKERS; w++)
+    {
+        packed[w] = &packedMasks[w];
+        padded[w] = &slots[w].eventMask;
+    }
+
+    for (size_t workers = 1; workers <= CFG_TCP_SERVER_WORKERS; workers *= 2)
+    {
+        OS_Error_t err = worker_pool_set_active(&workerPool, workers);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        const uint64_t packedNs = mask_bench_run(workers, packed);
+        const uint64_t paddedNs = mask_bench_run(workers, padded);
+        const uint64_t numOps = (uint64_t) workers * MASK_BENCH_OPS * 2;
+
+        Debug_LOG_INFO(
+            "event mask updates, %zu workers: shared cache line "
+            "%" PRIu64 ".%02" PRIu64 " ns/op, own cache line "
+            "%" PRIu64 ".%02" PRIu64 " ns/op",
+            workers,
+            packedNs / numOps,
+            (packedNs * 100 / numOps) % 100,
+            paddedNs / numOps,
+            (paddedNs * 100 / numOps) % 100);
+    }
+
+    worker_pool_set_active(&workerPool, CFG_TCP_SERVER_WORKERS);
+}
+
+#endif /* CFG_TCP_SERVER_WORKERS > 0 */
+
 //------------------------------------------------------------------------------
 int
 run()
 {
     Debug_LOG_INFO("Starting TestAppTCPServer ...");
 
-    OS_Socket_Handle_t srvHandle;
+#if CFG_TCP_SERVER_WORKERS > 0
+    pool_bench();
+    mask_bench();
+#endif
 
     OS_Error_t err = OS_Socket_create(
                          &network_stack,
@@ -100,8 +652,7 @@ run()
     if (err != OS_SUCCESS)
     {
         Debug_LOG_ERROR("OS_Socket_bind() failed, code %d", err);
-        OS_Socket_close(srvHandle);
-        nb_helper_reset_ev_struct_for_socket(srvHandle);
+        nb_helper_socket_close(&nbHelper, srvHandle);
         return -1;
     }
 
@@ -113,125 +664,37 @@ run()
     if (err != OS_SUCCESS)
     {
         Debug_LOG_ERROR("OS_Socket_listen() failed, code %d", err);
-        OS_Socket_close(srvHandle);
-        nb_helper_reset_ev_struct_for_socket(srvHandle);
+        nb_helper_socket_close(&nbHelper, srvHandle);
         return -1;
     }
 
     Debug_LOG_INFO("launching echo server");
 
-    /* Gets filled when accept is called */
-    OS_Socket_Handle_t clientHandle;
-    OS_Socket_Addr_t srcAddr = {0};
-
-    static char buffer[4096];
-
-    for (;;)
+    // One task for the listening socket and one for each client.
+    err = pt_sched_init(&sched, &nbHelper, MAX_CLIENTS + 1);
+    if (err != OS_SUCCESS)
     {
-        do
-        {
-            // Wait until we get an conn acpt event for the listening socket.
-            nb_helper_wait_for_conn_acpt_ev_on_socket(srvHandle);
-
-            err = OS_Socket_accept(
-                      srvHandle,
-                      &clientHandle,
-                      &srcAddr);
-        }
-        while (err == OS_ERROR_TRY_AGAIN);
-        if (err != OS_SUCCESS)
-        {
-            Debug_LOG_ERROR("OS_Socket_accept() failed, error %d", err);
-            OS_Socket_close(srvHandle);
-            nb_helper_reset_ev_struct_for_socket(srvHandle);
-            return -1;
-        }
-
-        /*
-            As of now the nw stack behavior is as below:
-            Keep reading data until you receive one of the return values:
-             a. err = OS_ERROR_CONNECTION_CLOSED and length = 0 indicating end
-           of data read and connection close b. err = OS_ERROR_GENERIC  due to
-           error in read c. err = OS_SUCCESS and length = 0 indicating no data
-           to read but there is still connection d. err = OS_SUCCESS and length
-           >0 , valid data
-
-            Take appropriate actions based on the return value rxd.
-
-
-            Only a single socket is supported and no multithreading !!!
-            Once we accept an incoming connection, start reading data from the
-           client and echo back the data rxd.
-        */
-        memset(buffer, 0, sizeof(buffer));
+        Debug_LOG_ERROR("pt_sched_init() failed, error %d", err);
+        nb_helper_socket_close(&nbHelper, srvHandle);
+        return -1;
+    }
 
-        Debug_LOG_INFO("starting server read loop");
-        /* Keep calling read until we receive CONNECTION_CLOSED from the stack
-         */
-        for (;;)
-        {
-            Debug_LOG_TRACE("read...");
-            size_t n = 0;
-            // Try to read as much as fits into the buffer
-            do
-            {
-                // Wait until we receive a read event for the socket.
-                nb_helper_wait_for_read_ev_on_socket(clientHandle);
-
-                err = OS_Socket_read(
-                          clientHandle,
-                          buffer,
-                          sizeof(buffer),
-                          &n);
-            }
-            while (err == OS_ERROR_TRY_AGAIN);
+#if CFG_TCP_SERVER_WORKERS > 0
+    pt_sched_set_pool(&sched, &workerPool);
+#endif
 
-            if (OS_SUCCESS != err)
-            {
-                Debug_LOG_ERROR("OS_Socket_read() failed, error %d", err);
-                break;
-            }
+    err = pt_sched_spawn(&sched, accept_task, NULL, &acceptTask);
+    Debug_ASSERT(err == OS_SUCCESS);
 
-            size_t bytesWritten      = 0;
-            size_t totalBytesWritten = 0;
+    // Only returns once accepting failed and all clients are gone.
+    err = pt_sched_run(&sched);
+    if (err != OS_SUCCESS)
+    {
+        Debug_LOG_ERROR("pt_sched_run() failed, error %d", err);
+    }
 
-            while (totalBytesWritten < n)
-            {
-                do
-                {
-                    err = OS_Socket_write(
-                              clientHandle,
-                              &buffer[totalBytesWritten],
-                              n - totalBytesWritten,
-                              &bytesWritten);
-                }
-                while (err == OS_ERROR_TRY_AGAIN);
-                if (err != OS_SUCCESS)
-                {
-                    Debug_LOG_ERROR("OS_Socket_write() failed, error %d", err);
-                    break;
-                }
-                totalBytesWritten = totalBytesWritten + bytesWritten;
-            }
-        }
+    pt_sched_deinit(&sched);
 
-        switch (err)
-        {
-        /* This means end of read as socket was closed. Exit now and close
-         * handle*/
-        case OS_ERROR_NETWORK_CONN_SHUTDOWN:
-            // the test runner checks for this string
-            Debug_LOG_INFO("connection closed by server");
-            OS_Socket_close(clientHandle);
-            nb_helper_reset_ev_struct_for_socket(clientHandle);
-            continue;
-        /* Any other value is a failure in read, hence exit and close handle  */
-        default:
-            Debug_LOG_ERROR("server socket failure, error %d", err);
-            OS_Socket_close(clientHandle);
-            nb_helper_reset_ev_struct_for_socket(clientHandle);
-            continue;
-        } // end of switch
-    }
+    nb_helper_socket_close(&nbHelper, srvHandle);
     return -1;
 }
@@ -13,21 +13,32 @@
 #include "lib_debug/Debug.h"
 #include "lib_macros/Test.h"
 #include "stdint.h"
+#include <inttypes.h>
 #include "system_config.h"
 #include <string.h>
 
 #include "OS_Socket.h"
+#include "TimeServer.h"
 #include "math.h"
 
 #include "SysLoggerClient.h"
 #include "interfaces/if_OS_Socket.h"
 #include "util/loop_defines.h"
 #include "util/non_blocking_helper.h"
+#include "util/socket_io.h"
 #include <camkes.h>
 
 static const if_OS_Socket_t network_stack =
     IF_OS_SOCKET_ASSIGN(networkStack);
 
+// Helper instance serving the events of network_stack.
+static nb_helper_t nbHelper;
+
+static const if_OS_Timer_t timer =
+    IF_OS_TIMER_ASSIGN(
+        timeServer_rpc,
+        timeServer_notify);
+
 void
 pre_init(void)
 {
@@ -37,25 +48,40 @@ pre_init(void)
     Debug_ASSERT(err == OS_SUCCESS);
 #endif
     // Initialize the helper lib with the required synchronization mechanisms.
-    nb_helper_init(
-        event_received_send_ready_emit,
-        event_received_recv_ready_wait,
-        SharedResourceMutex_lock,
-        SharedResourceMutex_unlock);
-
-    // Set up callback for new received socket events.
-    err = OS_Socket_regCallback(
+    err = nb_helper_init(
+              &nbHelper,
               &network_stack,
-              &nb_helper_collect_pending_ev_handler,
-              (void*) &network_stack);
+              OS_NETWORK_MAXIMUM_SOCKET_NO,
+              event_received_send_ready_emit,
+              event_received_recv_ready_wait,
+              SharedResourceMutex_lock,
+              SharedResourceMutex_unlock);
     if (err != OS_SUCCESS)
     {
-        Debug_LOG_ERROR(
-            "OS_Socket_regCallback() failed, code %d", err);
+        Debug_LOG_ERROR("nb_helper_init() failed, code %d", err);
+    }
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    // Sleep on the TimeServer instead of spinning while waiting.
+    nb_helper_set_timer(&nbHelper, &timer);
+
+    // Optionally spin on the notification before blocking on it.
+    nb_helper_set_spin(
+        &nbHelper,
+        event_received_recv_ready_poll,
+        CFG_NB_HELPER_SPIN_MAX);
+
+    // Subscribe to the socket events of the network stack.
+    err = nb_helper_subscribe(
+              &nbHelper,
+              NB_HELPER_PERSISTENT_SUBSCRIPTION);
+    if (err != OS_SUCCESS)
+    {
+        Debug_LOG_ERROR("nb_helper_subscribe() failed, code %d", err);
     }
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-    err = nb_helper_wait_for_network_stack_init(&network_stack);
+    err = nb_helper_wait_for_network_stack_init(&nbHelper);
     if (err != OS_SUCCESS)
     {
         Debug_LOG_ERROR("nb_helper_wait_for_network_stack_init() failed, code %d", err);
@@ -92,15 +118,10 @@ test_udp_recvfrom_pos()
     {
         Debug_LOG_ERROR("OS_Socket_bind() failed, code %d", err);
 
-        err = OS_Socket_close(handle);
+        err = nb_helper_socket_close(&nbHelper, handle);
         if (err != OS_SUCCESS)
         {
-            Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-        }
-        err = nb_helper_reset_ev_struct_for_socket(handle);
-        if (err != OS_SUCCESS)
-        {
-            Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
+            Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
         }
 
         return;
@@ -116,7 +137,7 @@ test_udp_recvfrom_pos()
     OS_Socket_Addr_t srcAddr = {0};
 
     // Wait until we get a read event for the bound socket.
-    nb_helper_wait_for_read_ev_on_socket(handle);
+    nb_helper_wait_for_read_ev_on_socket(&nbHelper, handle);
 
     // Try to read some data.
     err = OS_Socket_recvfrom(
@@ -129,15 +150,10 @@ test_udp_recvfrom_pos()
     {
         Debug_LOG_ERROR("OS_Socket_recvfrom() failed, code %d", err);
 
-        err = OS_Socket_close(handle);
+        err = nb_helper_socket_close(&nbHelper, handle);
         if (err != OS_SUCCESS)
         {
-            Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-        }
-        err = nb_helper_reset_ev_struct_for_socket(handle);
-        if (err != OS_SUCCESS)
-        {
-            Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
+            Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
         }
 
         return;
@@ -152,7 +168,7 @@ test_udp_recvfrom_pos()
         srcAddr.port);
 
     // Wait until we get a read event for the bound socket.
-    nb_helper_wait_for_read_ev_on_socket(handle);
+    nb_helper_wait_for_read_ev_on_socket(&nbHelper, handle);
 
     // Read an amount that should not fit into the underlying dataport. The API
     // should adjust this size to the max size of the underlying dataport.
@@ -166,15 +182,10 @@ test_udp_recvfrom_pos()
     {
         Debug_LOG_ERROR("OS_Socket_recvfrom() failed, code %d", err);
 
-        err = OS_Socket_close(handle);
-        if (err != OS_SUCCESS)
-        {
-            Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-        }
-        err = nb_helper_reset_ev_struct_for_socket(handle);
+        err = nb_helper_socket_close(&nbHelper, handle);
         if (err != OS_SUCCESS)
         {
-            Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
+            Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
         }
 
         return;
@@ -183,17 +194,10 @@ test_udp_recvfrom_pos()
     // dataport and not the requested size.
     ASSERT_LE_SZ(len_actual, networkStack_rpc_get_size());
 
-    err = OS_Socket_close(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     if (err != OS_SUCCESS)
     {
-        Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-        return;
-    }
-
-    err = nb_helper_reset_ev_struct_for_socket(handle);
-    if (err != OS_SUCCESS)
-    {
-        Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
+        Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
         return;
     }
 
@@ -229,15 +233,10 @@ test_udp_sendto_pos()
     {
         Debug_LOG_ERROR("OS_Socket_bind() failed, code %d", err);
 
-        err = OS_Socket_close(handle);
+        err = nb_helper_socket_close(&nbHelper, handle);
         if (err != OS_SUCCESS)
         {
-            Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-        }
-        err = nb_helper_reset_ev_struct_for_socket(handle);
-        if (err != OS_SUCCESS)
-        {
-            Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
+            Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
         }
 
         return;
@@ -253,7 +252,7 @@ test_udp_sendto_pos()
     Debug_LOG_INFO("UDP Send test");
 
     // Wait until we get a read event for the bound socket.
-    nb_helper_wait_for_read_ev_on_socket(handle);
+    nb_helper_wait_for_read_ev_on_socket(&nbHelper, handle);
 
     // Try to read some data.
     err = OS_Socket_recvfrom(
@@ -266,15 +265,10 @@ test_udp_sendto_pos()
     {
         Debug_LOG_ERROR("OS_Socket_recvfrom() failed, code %d", err);
 
-        err = OS_Socket_close(handle);
-        if (err != OS_SUCCESS)
-        {
-            Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-        }
-        err = nb_helper_reset_ev_struct_for_socket(handle);
+        err = nb_helper_socket_close(&nbHelper, handle);
         if (err != OS_SUCCESS)
         {
-            Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
+            Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
         }
 
         return;
@@ -300,30 +294,19 @@ test_udp_sendto_pos()
     {
         Debug_LOG_ERROR("OS_Socket_sendto() failed, code %d", err);
 
-        err = OS_Socket_close(handle);
-        if (err != OS_SUCCESS)
-        {
-            Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-        }
-        err = nb_helper_reset_ev_struct_for_socket(handle);
+        err = nb_helper_socket_close(&nbHelper, handle);
         if (err != OS_SUCCESS)
         {
-            Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
+            Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
         }
 
         return;
     }
 
-    err = OS_Socket_close(handle);
-    if (err != OS_SUCCESS)
-    {
-        Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-        return;
-    }
-    err = nb_helper_reset_ev_struct_for_socket(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     if (err != OS_SUCCESS)
     {
-        Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
+        Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
         return;
     }
 
@@ -368,10 +351,10 @@ test_udp_recvfrom_neg()
     }
     ASSERT_EQ_OS_ERR(OS_ERROR_INVALID_HANDLE, err);
 
-    err = OS_Socket_close(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     if (err != OS_SUCCESS)
     {
-        Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
+        Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
     }
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
@@ -420,16 +403,39 @@ test_udp_sendto_neg()
     }
     ASSERT_EQ_OS_ERR(OS_ERROR_INVALID_HANDLE, err);
 
-    err = OS_Socket_close(handle);
+    err = nb_helper_socket_close(&nbHelper, handle);
     if (err != OS_SUCCESS)
     {
-        Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
+        Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
     }
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     TEST_FINISH();
 }
 
+// Datagrams between two reports of the copies the echo saved.
+#define UDP_ECHO_STATS_INTERVAL 1024
+
+static void
+log_copy_stats(
+    const uint32_t numEchoed,
+    const uint64_t startNs)
+{
+    uint64_t nowNs = 0;
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &nowNs);
+
+    const uint64_t ns = (nowNs > startNs) ? nowNs - startNs : 1;
+    const uint64_t bytes = socket_io_get_bytes_not_copied();
+
+    Debug_LOG_INFO(
+        "BENCH name=udp_echo_zero_copy datagrams=%u bytes_not_copied=%" PRIu64
+        " ns=%" PRIu64 " bytes_per_sec=%" PRIu64,
+        numEchoed,
+        bytes,
+        ns,
+        bytes * 1000000000 / ns);
+}
+
 void
 test_udp_echo()
 {
@@ -460,93 +466,112 @@ test_udp_echo()
     {
         Debug_LOG_ERROR("OS_Socket_bind() failed, code %d", err);
 
-        err = OS_Socket_close(handle);
-        if (err != OS_SUCCESS)
-        {
-            Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-        }
-        err = nb_helper_reset_ev_struct_for_socket(handle);
+        err = nb_helper_socket_close(&nbHelper, handle);
         if (err != OS_SUCCESS)
         {
-            Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
+            Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
         }
     }
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     OS_Socket_Addr_t srcAddr = {0};
 
-    // Buffer big enough to hold 2 frames, rounded to the nearest power of 2
-    static char buffer[4096] = {0};
+    nb_helper_poll_t pollSet[1];
+    nb_helper_poll_t ready[1];
+    nb_helper_poll_set_t set;
+
+    err = nb_helper_poll_set_init(&nbHelper, &set, pollSet, 1);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    err = nb_helper_poll_set_add(&nbHelper, &set, handle, OS_SOCK_EV_READ,
+                                 NULL);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    uint64_t startNs = 0;
+    uint32_t numEchoed = 0;
+
+    TimeServer_getTime(&timer, TimeServer_PRECISION_NSEC, &startNs);
 
     while (1)
     {
-        size_t len = sizeof(buffer);
+        socket_io_loan_t loan;
+        socket_io_tx_t tx;
+        size_t len = 0;
 
         do
         {
             // Wait until we get an event for the bound socket.
-            nb_helper_wait_for_read_ev_on_socket(handle);
+            size_t numReady = 0;
+            err = nb_helper_wait_any(&nbHelper, &set, ready, 1, &numReady);
+            if (err != OS_SUCCESS)
+            {
+                Debug_LOG_ERROR("nb_helper_wait_any() failed, code %d", err);
+                break;
+            }
 
-            // Try to read some data.
-            err = OS_Socket_recvfrom(
+            // Try to read some data, it is left in the dataport.
+            err = socket_io_recvfrom_loan(
                       handle,
-                      buffer,
-                      len,
-                      &len,
+                      SIZE_MAX,
+                      &loan,
                       &srcAddr);
+            if ((err == OS_SUCCESS) && (0 == loan.len))
+            {
+                err = OS_ERROR_TRY_AGAIN;
+            }
         }
         while (err == OS_ERROR_TRY_AGAIN);
         if (err != OS_SUCCESS)
         {
-            Debug_LOG_ERROR("OS_Socket_recvfrom() failed, code %d", err);
+            Debug_LOG_ERROR("Receiving the datagram failed, code %d", err);
 
-            err = OS_Socket_close(handle);
-            if (err != OS_SUCCESS)
-            {
-                Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-            }
-            err = nb_helper_reset_ev_struct_for_socket(handle);
+            // Sockets must not be closed while they are in the set.
+            nb_helper_poll_set_remove(&nbHelper, &set, handle);
+
+            err = nb_helper_socket_close(&nbHelper, handle);
             if (err != OS_SUCCESS)
             {
-                Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
+                Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
             }
             return;
         }
 
-        err = OS_Socket_sendto(
+        // Send the datagram back right from where it was received.
+        socket_io_tx_acquire_loan(&loan, &tx);
+        err = socket_io_tx_commit_to(
                   handle,
-                  buffer,
-                  len,
+                  &tx,
+                  tx.size,
                   &len,
                   &srcAddr);
+        socket_io_tx_release(&tx);
         if (err != OS_SUCCESS)
         {
-            Debug_LOG_ERROR("OS_Socket_sendto() failed, code %d", err);
+            Debug_LOG_ERROR("socket_io_tx_commit_to() failed, code %d", err);
 
-            err = OS_Socket_close(handle);
-            if (err != OS_SUCCESS)
-            {
-                Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-            }
-            err = nb_helper_reset_ev_struct_for_socket(handle);
+            // Sockets must not be closed while they are in the set.
+            nb_helper_poll_set_remove(&nbHelper, &set, handle);
+
+            err = nb_helper_socket_close(&nbHelper, handle);
             if (err != OS_SUCCESS)
             {
-                Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
+                Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
             }
             return;
         }
+
+        if (++numEchoed % UDP_ECHO_STATS_INTERVAL == 0)
+        {
+            log_copy_stats(numEchoed, startNs);
+        }
     }
-    err = OS_Socket_close(handle);
+    nb_helper_poll_set_remove(&nbHelper, &set, handle);
+
+    err = nb_helper_socket_close(&nbHelper, handle);
     if (err != OS_SUCCESS)
     {
-        Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
+        Debug_LOG_ERROR("nb_helper_socket_close() failed, code %d", err);
         return;
     }
-    err = nb_helper_reset_ev_struct_for_socket(handle);
-    if (err != OS_SUCCESS)
-    {
-        Debug_LOG_ERROR("nb_helper_reset_ev_struct_for_socket() failed, code %d", err);
-    }
     ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
     TEST_FINISH();
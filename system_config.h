@@ -82,6 +82,66 @@
 #define OS_NETWORK_MAXIMUM_SOCKET_NO 16
 #endif
 
+// Keep the socket event subscription of the non-blocking helper armed instead
+// of re-registering the event callback on every delivery. The TCP client
+// configurations take it from the CMake option of the same name.
+#ifndef NB_HELPER_PERSISTENT_SUBSCRIPTION
+#define NB_HELPER_PERSISTENT_SUBSCRIPTION 1
+#endif
+
+// Upper bound of the notification polls of the non-blocking helper before a
+// waiting thread blocks, 0 to always block right away.
+#ifndef CFG_NB_HELPER_SPIN_MAX
+#define CFG_NB_HELPER_SPIN_MAX 0
+#endif
+
+// Upper bound for connecting all sockets of the TCP client test and reading
+// all responses, so a silent peer fails the test instead of hanging it.
+#ifndef CFG_TCP_CLIENT_DEADLINE_MS
+#define CFG_TCP_CLIENT_DEADLINE_MS 60000
+#endif
+
+// Sockets streaming CFG_TCP_CLIENT_BENCH_PATH from the HTTP server on the test
+// host in the bulk throughput benchmark of the TCP client, 0 to skip it.
+#ifndef CFG_TCP_CLIENT_BENCH_SOCKETS
+#define CFG_TCP_CLIENT_BENCH_SOCKETS 0
+#endif
+
+// Large resource of the HTTP server on the test host for the benchmark.
+#ifndef CFG_TCP_CLIENT_BENCH_PATH
+#define CFG_TCP_CLIENT_BENCH_PATH "/network/bench.bin"
+#endif
+
+// Requests of the keep-alive benchmark of the TCP client, sent once over a
+// connection of their own each and once pipelined over a single persistent
+// connection, 0 to skip it.
+#ifndef CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS
+#define CFG_TCP_CLIENT_KEEP_ALIVE_REQUESTS 0
+#endif
+
+// Requests in flight at once on the persistent connection.
+#ifndef CFG_TCP_CLIENT_PIPELINE_DEPTH
+#define CFG_TCP_CLIENT_PIPELINE_DEPTH 4
+#endif
+
+// Iterations of the socket churn benchmark of the TCP client, per mode, 0 to
+// skip it. A few thousand give stable numbers.
+#ifndef CFG_TCP_CLIENT_CHURN_ITERATIONS
+#define CFG_TCP_CLIENT_CHURN_ITERATIONS 0
+#endif
+
+// Also measure the event table lookup of the TCP client with 4096 sockets in
+// use, which allocates about 256 KiB of entries.
+#ifndef CFG_TCP_CLIENT_EV_TABLE_LARGE_RUN
+#define CFG_TCP_CLIENT_EV_TABLE_LARGE_RUN 0
+#endif
+
+// Worker threads serving the connections of the TCP server, at most 4. With 0
+// all connections are served by the run() thread.
+#ifndef CFG_TCP_SERVER_WORKERS
+#define CFG_TCP_SERVER_WORKERS 0
+#endif
+
 #define NIC_DRIVER_RINGBUFFER_NUMBER_ELEMENTS 16
 #define NIC_DRIVER_RINGBUFFER_SIZE \
     (NIC_DRIVER_RINGBUFFER_NUMBER_ELEMENTS * 4096)
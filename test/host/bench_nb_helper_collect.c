@@ -0,0 +1,158 @@
+/*
+ * Micro-benchmark of the event delivery of the non-blocking helper on a Linux
+ * host, on top of the mock stack.
+ *
+ * For batches of events on different sockets it times
+ * nb_helper_collect_pending_ev_handler(), which fetches the events from the
+ * dataport and merges them into the event table in place, and the
+ * nb_helper_wait_any() call handing them out again. For comparison it also
+ * times the two copies of the records the helper made before it merged them
+ * in place, one of the whole batch out of the dataport and one of every
+ * record. Everything runs on one thread, the events are queued without
+ * signalling, so the numbers are the cost of the code paths alone.
+ *
+ * Usage: bench_nb_helper_collect [rounds]
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib_macros/Test.h"
+
+#include "mock_stack.h"
+#include "non_blocking_helper.h"
+
+#define NUM_SOCKETS MOCK_STACK_MAX_SOCKETS
+
+static mock_stack_t stack;
+static nb_helper_t nbh;
+
+static nb_helper_poll_t fds[NUM_SOCKETS];
+static nb_helper_poll_t ready[NUM_SOCKETS];
+static OS_Socket_Evt_t copyBuffer[NUM_SOCKETS];
+
+// Keeps the compiler from dropping the copies.
+static volatile uint32_t copySink;
+
+//------------------------------------------------------------------------------
+// The copies the helper made before, out of the dataport and of each record.
+static void
+copy_records(
+    const size_t numEvents)
+{
+    memcpy(copyBuffer, stack.dataport, numEvents * sizeof(OS_Socket_Evt_t));
+
+    uint32_t sum = 0;
+    for (size_t i = 0; i < numEvents; i++)
+    {
+        OS_Socket_Evt_t event;
+        memcpy(&event, &copyBuffer[i], sizeof(event));
+        sum += event.eventMask;
+    }
+    copySink += sum;
+}
+
+static void
+bench_batch(
+    nb_helper_poll_set_t* const set,
+    const size_t batch,
+    const unsigned int rounds)
+{
+    uint64_t collectNs = 0;
+    uint64_t dispatchNs = 0;
+    uint64_t copyNs = 0;
+    uint64_t numEvents = 0;
+
+    for (unsigned int r = 0; r < rounds; r++)
+    {
+        for (size_t h = 0; h < batch; h++)
+        {
+            mock_stack_queue(&stack, (int) h, OS_SOCK_EV_READ);
+        }
+
+        uint64_t startNs = mock_time_ns();
+        nb_helper_collect_pending_ev_handler(&nbh);
+        collectNs += mock_time_ns() - startNs;
+
+        // The records of the batch are still in the dataport.
+        startNs = mock_time_ns();
+        copy_records(batch);
+        copyNs += mock_time_ns() - startNs;
+
+        size_t numReady = 0;
+        startNs = mock_time_ns();
+        OS_Error_t err = nb_helper_wait_any_until(&nbh, set,
+                                                  NB_HELPER_DEADLINE_NOW,
+                                                  ready, NUM_SOCKETS,
+                                                  &numReady);
+        dispatchNs += mock_time_ns() - startNs;
+
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+        ASSERT_EQ_SZ(batch, numReady);
+        numEvents += numReady;
+    }
+
+    printf("BENCH name=nb_collect batch=%zu events=%" PRIu64
+           " collect_ns_per_event=%" PRIu64
+           " dispatch_ns_per_event=%" PRIu64
+           " copy_ns_per_event=%" PRIu64 "\n",
+           batch, numEvents,
+           collectNs / numEvents,
+           dispatchNs / numEvents,
+           copyNs / numEvents);
+}
+
+//------------------------------------------------------------------------------
+int
+main(
+    int argc,
+    char* argv[])
+{
+    const unsigned int rounds =
+        (argc > 1) ? (unsigned int) strtoul(argv[1], NULL, 0) : 20000;
+    static const size_t batches[] = { 1, 16, 64, NUM_SOCKETS };
+
+    OS_Error_t err = mock_stack_init(&stack, NUM_SOCKETS);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = nb_helper_init(&nbh, &stack.ctx, NUM_SOCKETS,
+                         stack.waitSlots[0].notify, stack.waitSlots[0].wait,
+                         stack.lock, stack.unlock);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    // Neither subscribed nor signalled, the events are collected by calling
+    // the callback directly.
+    nb_helper_poll_set_t set;
+    err = nb_helper_poll_set_init(&nbh, &set, fds, NUM_SOCKETS);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    for (int h = 0; h < NUM_SOCKETS; h++)
+    {
+        err = nb_helper_poll_set_add(&nbh, &set, mock_stack_handle(&stack, h),
+                                     OS_SOCK_EV_READ, NULL);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    for (size_t i = 0; i < sizeof(batches) / sizeof(batches[0]); i++)
+    {
+        bench_batch(&set, batches[i], rounds);
+    }
+
+    while (set.numFds > 0)
+    {
+        err = nb_helper_poll_set_remove(&nbh, &set, set.fds[0].handle);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    nb_helper_deinit(&nbh);
+    mock_stack_deinit(&stack);
+
+    return 0;
+}
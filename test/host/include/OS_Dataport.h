@@ -0,0 +1,33 @@
+/*
+ * Host mock of the SDK header, only what the helper uses.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct
+{
+    void*  io;
+    size_t size;
+} OS_Dataport_t;
+
+static inline void*
+OS_Dataport_getBuf(
+    const OS_Dataport_t dp)
+{
+    return dp.io;
+}
+
+static inline size_t
+OS_Dataport_getSize(
+    const OS_Dataport_t dp)
+{
+    return dp.size;
+}
@@ -0,0 +1,25 @@
+/*
+ * Host mock of the SDK header, only what the helper uses.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+typedef enum
+{
+    OS_ERROR_NETWORK_CONN_SHUTDOWN  = -1108,
+    OS_ERROR_TRY_AGAIN              = -19,
+    OS_ERROR_TIMEOUT                = -17,
+    OS_ERROR_INSUFFICIENT_SPACE     = -15,
+    OS_ERROR_ABORTED                = -9,
+    OS_ERROR_INVALID_STATE          = -7,
+    OS_ERROR_INVALID_HANDLE         = -6,
+    OS_ERROR_INVALID_PARAMETER      = -5,
+    OS_ERROR_GENERIC                = -1,
+    OS_SUCCESS                      = 0
+} OS_Error_t;
@@ -0,0 +1,61 @@
+/*
+ * Host mock of the SDK header, only what the helper uses. The functions are
+ * implemented by mock_stack.c.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include "OS_Error.h"
+#include "OS_Types.h"
+#include "interfaces/if_OS_Socket.h"
+
+#define OS_SOCK_EV_NONE      0
+#define OS_SOCK_EV_CONN_EST  (1 << 0)
+#define OS_SOCK_EV_CONN_ACPT (1 << 1)
+#define OS_SOCK_EV_READ      (1 << 2)
+#define OS_SOCK_EV_WRITE     (1 << 3)
+#define OS_SOCK_EV_FIN       (1 << 4)
+#define OS_SOCK_EV_CLOSE     (1 << 5)
+#define OS_SOCK_EV_ERROR     (1 << 6)
+
+typedef struct
+{
+    if_OS_Socket_t ctx;
+    int            handleID;
+} OS_Socket_Handle_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t    eventMask;
+    int        socketHandle;
+    int        parentSocketHandle;
+    OS_Error_t currentError;
+} OS_Socket_Evt_t;
+
+OS_Error_t
+OS_Socket_close(
+    const OS_Socket_Handle_t handle);
+
+OS_NetworkStack_State_t
+OS_Socket_getStatus(
+    const if_OS_Socket_t* const ctx);
+
+OS_Error_t
+OS_Socket_wait(
+    const if_OS_Socket_t* const ctx);
+
+OS_Error_t
+OS_Socket_poll(
+    const if_OS_Socket_t* const ctx);
+
+OS_Error_t
+OS_Socket_regCallback(
+    const if_OS_Socket_t* const ctx,
+    void (*callback)(void*),
+    void* arg);
@@ -0,0 +1,42 @@
+/*
+ * Host mock of the SDK header, only what the helper uses. The functions are
+ * implemented by mock_stack.c on CLOCK_MONOTONIC.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "OS_Error.h"
+
+typedef struct
+{
+    OS_Error_t (*oneshot_absolute)(int tid, uint64_t ns);
+    OS_Error_t (*stop)(int tid);
+} if_OS_Timer_t;
+
+typedef enum
+{
+    TimeServer_PRECISION_SEC,
+    TimeServer_PRECISION_MSEC,
+    TimeServer_PRECISION_USEC,
+    TimeServer_PRECISION_NSEC
+} TimeServer_Precision_t;
+
+OS_Error_t
+TimeServer_getTime(
+    const if_OS_Timer_t* timer,
+    const TimeServer_Precision_t prec,
+    uint64_t* const time);
+
+OS_Error_t
+TimeServer_sleep(
+    const if_OS_Timer_t* timer,
+    const TimeServer_Precision_t prec,
+    const uint64_t val);
@@ -0,0 +1,15 @@
+/*
+ * Host mock of the CAmkES header, only what the helper uses. seL4_Yield() is
+ * implemented by mock_stack.c.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+void
+seL4_Yield(void);
@@ -0,0 +1,45 @@
+/*
+ * Host mock of the SDK header, only what the helper uses.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include "OS_Dataport.h"
+#include "OS_Error.h"
+#include "OS_Types.h"
+
+typedef void (*event_notify_func_t)(void);
+typedef void (*event_wait_func_t)(void);
+typedef int (*event_poll_func_t)(void);
+typedef int (*event_reg_callback_func_t)(void (*)(void*), void*);
+typedef int (*mutex_lock_func_t)(void);
+typedef int (*mutex_unlock_func_t)(void);
+
+typedef enum
+{
+    UNINITIALIZED,
+    INITIALIZED,
+    RUNNING,
+    FATAL_ERROR
+} OS_NetworkStack_State_t;
+
+typedef struct
+{
+    OS_Error_t (*socket_close)(const int handle);
+    OS_NetworkStack_State_t (*socket_getStatus)(void);
+    OS_Error_t (*socket_getPendingEvents)(
+        const size_t bufSize,
+        int* const pNumberOfEvents);
+    event_wait_func_t         socket_wait;
+    event_poll_func_t         socket_poll;
+    event_reg_callback_func_t socket_regCallback;
+    OS_Dataport_t             dataport;
+    mutex_lock_func_t         shared_resource_mutex_lock;
+    mutex_unlock_func_t       shared_resource_mutex_unlock;
+} if_OS_Socket_t;
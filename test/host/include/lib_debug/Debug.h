@@ -0,0 +1,25 @@
+/*
+ * Host mock of the SDK header, errors and warnings go to stderr.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stdio.h>
+
+// Blocks like in the SDK, callers rely on not needing a semicolon.
+#define Debug_LOG_ERROR(...) \
+    { fprintf(stderr, "ERROR: " __VA_ARGS__); fputc('\n', stderr); }
+#define Debug_LOG_WARNING(...) \
+    { fprintf(stderr, "WARNING: " __VA_ARGS__); fputc('\n', stderr); }
+#define Debug_LOG_INFO(...)  { }
+#define Debug_LOG_DEBUG(...) { }
+#define Debug_LOG_TRACE(...) { }
+
+#define Debug_ASSERT(_x_) assert(_x_)
@@ -0,0 +1,45 @@
+/*
+ * Host mock of the SDK header, only what the helper uses.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include "OS_Error.h"
+#include "lib_debug/Debug.h"
+
+#define CHECK_PTR_NOT_NULL(_p_) \
+    do \
+    { \
+        if (NULL == (_p_)) \
+        { \
+            Debug_LOG_ERROR("%s: %s is NULL", __func__, #_p_); \
+            return OS_ERROR_INVALID_PARAMETER; \
+        } \
+    } while (0)
+
+#define CHECK_VALUE_NOT_ZERO(_v_) \
+    do \
+    { \
+        if (0 == (_v_)) \
+        { \
+            Debug_LOG_ERROR("%s: %s is zero", __func__, #_v_); \
+            return OS_ERROR_INVALID_PARAMETER; \
+        } \
+    } while (0)
+
+// The upper bound is exclusive.
+#define CHECK_VALUE_IN_RANGE(_v_, _lo_, _hi_) \
+    do \
+    { \
+        if (((_v_) < (_lo_)) || ((_v_) >= (_hi_))) \
+        { \
+            Debug_LOG_ERROR("%s: %s out of range", __func__, #_v_); \
+            return OS_ERROR_INVALID_PARAMETER; \
+        } \
+    } while (0)
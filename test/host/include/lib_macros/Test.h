@@ -0,0 +1,36 @@
+/*
+ * Host mock of the SDK header, a failed assertion aborts the test.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ASSERT_HOST(_cond_, _a_, _b_) \
+    do \
+    { \
+        if (!(_cond_)) \
+        { \
+            fprintf(stderr, "%s:%d: assertion %s failed (%lld, %lld)\n", \
+                    __FILE__, __LINE__, #_cond_, \
+                    (long long) (_a_), (long long) (_b_)); \
+            abort(); \
+        } \
+    } while (0)
+
+#define ASSERT_EQ_OS_ERR(_a_, _b_) ASSERT_HOST((_a_) == (_b_), _a_, _b_)
+#define ASSERT_EQ_INT(_a_, _b_)    ASSERT_HOST((_a_) == (_b_), _a_, _b_)
+#define ASSERT_LE_INT(_a_, _b_)    ASSERT_HOST((_a_) <= (_b_), _a_, _b_)
+#define ASSERT_GT_INT(_a_, _b_)    ASSERT_HOST((_a_) > (_b_), _a_, _b_)
+#define ASSERT_EQ_SZ(_a_, _b_)     ASSERT_HOST((_a_) == (_b_), _a_, _b_)
+#define ASSERT_LE_SZ(_a_, _b_)     ASSERT_HOST((_a_) <= (_b_), _a_, _b_)
+#define ASSERT_GT_SZ(_a_, _b_)     ASSERT_HOST((_a_) > (_b_), _a_, _b_)
+#define ASSERT_TRUE(_a_)           ASSERT_HOST(_a_, _a_, 1)
+#define ASSERT_FALSE(_a_)          ASSERT_HOST(!(_a_), _a_, 0)
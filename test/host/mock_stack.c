@@ -0,0 +1,528 @@
+/*
+ * Network stack and CAmkES glue of a client component, mocked with pthreads so
+ * the non-blocking helper runs on a Linux host.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#include "camkes.h"
+
+#include "mock_stack.h"
+
+static mock_stack_t* instances[MOCK_STACK_MAX_INSTANCES];
+static pthread_mutex_t instancesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+//------------------------------------------------------------------------------
+static void
+notification_init(
+    mock_notification_t* const n)
+{
+    pthread_mutex_init(&n->mutex, NULL);
+    pthread_cond_init(&n->cond, NULL);
+    n->signalled = false;
+    n->nextTicket = 0;
+    n->nextRelease = 0;
+}
+
+static void
+notification_destroy(
+    mock_notification_t* const n)
+{
+    pthread_cond_destroy(&n->cond);
+    pthread_mutex_destroy(&n->mutex);
+}
+
+static void
+notification_emit(
+    mock_notification_t* const n)
+{
+    pthread_mutex_lock(&n->mutex);
+    if (n->nextRelease < n->nextTicket)
+    {
+        n->nextRelease++;
+        pthread_cond_broadcast(&n->cond);
+    }
+    else
+    {
+        n->signalled = true;
+    }
+    pthread_mutex_unlock(&n->mutex);
+}
+
+static void
+notification_wait(
+    mock_notification_t* const n)
+{
+    pthread_mutex_lock(&n->mutex);
+    if (n->signalled)
+    {
+        n->signalled = false;
+    }
+    else
+    {
+        const uint64_t ticket = n->nextTicket++;
+        while (ticket >= n->nextRelease)
+        {
+            pthread_cond_wait(&n->cond, &n->mutex);
+        }
+    }
+    pthread_mutex_unlock(&n->mutex);
+}
+
+static int
+notification_poll(
+    mock_notification_t* const n)
+{
+    pthread_mutex_lock(&n->mutex);
+    const bool signalled = n->signalled;
+    n->signalled = false;
+    pthread_mutex_unlock(&n->mutex);
+
+    return signalled;
+}
+
+//------------------------------------------------------------------------------
+// Interface thread of the event notification.
+static void*
+event_thread(
+    void* arg)
+{
+    mock_stack_t* stack = arg;
+
+    for (;;)
+    {
+        notification_wait(&stack->event);
+        if (atomic_load(&stack->stopping))
+        {
+            return NULL;
+        }
+
+        pthread_mutex_lock(&stack->callbackMutex);
+        void (*callback)(void*) = stack->callback;
+        void* callbackArg = stack->callbackArg;
+        stack->callback = NULL;
+        pthread_mutex_unlock(&stack->callbackMutex);
+
+        if (NULL != callback)
+        {
+            callback(callbackArg);
+        }
+        else
+        {
+            notification_emit(&stack->handoff);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Called with the dataport mutex held, like the RPC of the real stack.
+static OS_Error_t
+get_pending_events(
+    mock_stack_t* const stack,
+    const size_t bufSize,
+    int* const pNumberOfEvents)
+{
+    OS_Socket_Evt_t* events = (OS_Socket_Evt_t*) stack->dataport;
+    const size_t maxEvents = bufSize / sizeof(OS_Socket_Evt_t);
+    size_t numEvents = 0;
+
+    atomic_fetch_add(&stack->pendingEventsCalls, 1);
+
+    pthread_mutex_lock(&stack->pendingMutex);
+    // Continue where the last call stopped, so a full buffer does not always
+    // favor the low handles.
+    const size_t first = stack->nextPending;
+    for (size_t i = 0; (i < stack->numSockets) && (numEvents < maxEvents); i++)
+    {
+        const size_t handle = (first + i) % stack->numSockets;
+        if (0 == stack->pending[handle])
+        {
+            continue;
+        }
+        OS_Socket_Evt_t* event = &events[numEvents++];
+        event->socketHandle = (int) handle;
+        event->eventMask = stack->pending[handle];
+        event->parentSocketHandle = -1;
+        event->currentError = OS_SUCCESS;
+        stack->pending[handle] = 0;
+        stack->nextPending = handle + 1;
+    }
+    pthread_mutex_unlock(&stack->pendingMutex);
+
+    *pNumberOfEvents = (int) numEvents;
+
+    return OS_SUCCESS;
+}
+
+static OS_Error_t
+socket_close(
+    mock_stack_t* const stack,
+    const int handle)
+{
+    pthread_mutex_lock(&stack->pendingMutex);
+    stack->pending[handle] = 0;
+    pthread_mutex_unlock(&stack->pendingMutex);
+
+    return OS_SUCCESS;
+}
+
+static int
+register_callback(
+    mock_stack_t* const stack,
+    void (*callback)(void*),
+    void* arg)
+{
+    pthread_mutex_lock(&stack->callbackMutex);
+    stack->callback = callback;
+    stack->callbackArg = arg;
+    pthread_mutex_unlock(&stack->callbackMutex);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Interface functions of instance _n_.
+#define MOCK_STACK_SLOT_FUNCS(_n_, _s_) \
+    static void \
+    slot_notify_##_n_##_##_s_(void) \
+    { \
+        notification_emit(&instances[_n_]->slots[_s_]); \
+    } \
+    static void \
+    slot_wait_##_n_##_##_s_(void) \
+    { \
+        notification_wait(&instances[_n_]->slots[_s_]); \
+    } \
+    static int \
+    slot_poll_##_n_##_##_s_(void) \
+    { \
+        return notification_poll(&instances[_n_]->slots[_s_]); \
+    }
+
+#define MOCK_STACK_FUNCS(_n_) \
+    static OS_Error_t \
+    get_pending_events_##_n_(const size_t bufSize, int* const pNumberOfEvents) \
+    { \
+        return get_pending_events(instances[_n_], bufSize, pNumberOfEvents); \
+    } \
+    static OS_Error_t \
+    socket_close_##_n_(const int handle) \
+    { \
+        return socket_close(instances[_n_], handle); \
+    } \
+    static OS_NetworkStack_State_t \
+    get_status_##_n_(void) \
+    { \
+        return RUNNING; \
+    } \
+    static void \
+    stack_wait_##_n_(void) \
+    { \
+        notification_wait(&instances[_n_]->handoff); \
+    } \
+    static int \
+    stack_poll_##_n_(void) \
+    { \
+        return notification_poll(&instances[_n_]->handoff); \
+    } \
+    static int \
+    register_callback_##_n_(void (*callback)(void*), void* arg) \
+    { \
+        return register_callback(instances[_n_], callback, arg); \
+    } \
+    static int \
+    dataport_lock_##_n_(void) \
+    { \
+        return pthread_mutex_lock(&instances[_n_]->dataportMutex); \
+    } \
+    static int \
+    dataport_unlock_##_n_(void) \
+    { \
+        return pthread_mutex_unlock(&instances[_n_]->dataportMutex); \
+    } \
+    static int \
+    component_lock_##_n_(void) \
+    { \
+        return pthread_mutex_lock(&instances[_n_]->componentMutex); \
+    } \
+    static int \
+    component_unlock_##_n_(void) \
+    { \
+        return pthread_mutex_unlock(&instances[_n_]->componentMutex); \
+    } \
+    MOCK_STACK_SLOT_FUNCS(_n_, 0) \
+    MOCK_STACK_SLOT_FUNCS(_n_, 1) \
+    MOCK_STACK_SLOT_FUNCS(_n_, 2) \
+    MOCK_STACK_SLOT_FUNCS(_n_, 3) \
+    static void \
+    assign_funcs_##_n_(mock_stack_t* const stack) \
+    { \
+        stack->ctx.socket_close = socket_close_##_n_; \
+        stack->ctx.socket_getStatus = get_status_##_n_; \
+        stack->ctx.socket_getPendingEvents = get_pending_events_##_n_; \
+        stack->ctx.socket_wait = stack_wait_##_n_; \
+        stack->ctx.socket_poll = stack_poll_##_n_; \
+        stack->ctx.socket_regCallback = register_callback_##_n_; \
+        stack->ctx.shared_resource_mutex_lock = dataport_lock_##_n_; \
+        stack->ctx.shared_resource_mutex_unlock = dataport_unlock_##_n_; \
+        stack->lock = component_lock_##_n_; \
+        stack->unlock = component_unlock_##_n_; \
+        const nb_helper_wait_slot_t waitSlots[] = \
+        { \
+            { slot_notify_##_n_##_0, slot_wait_##_n_##_0, slot_poll_##_n_##_0 }, \
+            { slot_notify_##_n_##_1, slot_wait_##_n_##_1, slot_poll_##_n_##_1 }, \
+            { slot_notify_##_n_##_2, slot_wait_##_n_##_2, slot_poll_##_n_##_2 }, \
+            { slot_notify_##_n_##_3, slot_wait_##_n_##_3, slot_poll_##_n_##_3 } \
+        }; \
+        memcpy(stack->waitSlots, waitSlots, sizeof(stack->waitSlots)); \
+    }
+
+_Static_assert(NB_HELPER_MAX_WAIT_SLOTS == 4,
+               "MOCK_STACK_FUNCS() provides four wait slots");
+_Static_assert(MOCK_STACK_MAX_INSTANCES == 2,
+               "assign_funcs() provides two instances");
+
+MOCK_STACK_FUNCS(0)
+MOCK_STACK_FUNCS(1)
+
+static void
+assign_funcs(
+    mock_stack_t* const stack)
+{
+    switch (stack->idx)
+    {
+    case 0:
+        assign_funcs_0(stack);
+        break;
+    case 1:
+        assign_funcs_1(stack);
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+mock_stack_init(
+    mock_stack_t* const stack,
+    const size_t numSockets)
+{
+    if ((numSockets == 0) || (numSockets > MOCK_STACK_MAX_SOCKETS))
+    {
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    memset(stack, 0, sizeof(*stack));
+
+    pthread_mutex_lock(&instancesMutex);
+    size_t idx = 0;
+    while ((idx < MOCK_STACK_MAX_INSTANCES) && (NULL != instances[idx]))
+    {
+        idx++;
+    }
+    if (idx == MOCK_STACK_MAX_INSTANCES)
+    {
+        pthread_mutex_unlock(&instancesMutex);
+        return OS_ERROR_INSUFFICIENT_SPACE;
+    }
+    instances[idx] = stack;
+    pthread_mutex_unlock(&instancesMutex);
+
+    stack->idx = idx;
+    stack->numSockets = numSockets;
+    pthread_mutex_init(&stack->pendingMutex, NULL);
+    pthread_mutex_init(&stack->dataportMutex, NULL);
+    pthread_mutex_init(&stack->componentMutex, NULL);
+    pthread_mutex_init(&stack->callbackMutex, NULL);
+    notification_init(&stack->event);
+    notification_init(&stack->handoff);
+    for (size_t i = 0; i < NB_HELPER_MAX_WAIT_SLOTS; i++)
+    {
+        notification_init(&stack->slots[i]);
+    }
+
+    stack->ctx.dataport.io = stack->dataport;
+    stack->ctx.dataport.size = sizeof(stack->dataport);
+    assign_funcs(stack);
+
+    if (pthread_create(&stack->eventThread, NULL, event_thread, stack) != 0)
+    {
+        mock_stack_deinit(stack);
+        return OS_ERROR_GENERIC;
+    }
+    stack->eventThreadStarted = true;
+
+    return OS_SUCCESS;
+}
+
+void
+mock_stack_deinit(
+    mock_stack_t* const stack)
+{
+    if (stack->eventThreadStarted)
+    {
+        atomic_store(&stack->stopping, true);
+        notification_emit(&stack->event);
+        pthread_join(stack->eventThread, NULL);
+        stack->eventThreadStarted = false;
+    }
+
+    for (size_t i = 0; i < NB_HELPER_MAX_WAIT_SLOTS; i++)
+    {
+        notification_destroy(&stack->slots[i]);
+    }
+    notification_destroy(&stack->handoff);
+    notification_destroy(&stack->event);
+    pthread_mutex_destroy(&stack->callbackMutex);
+    pthread_mutex_destroy(&stack->componentMutex);
+    pthread_mutex_destroy(&stack->dataportMutex);
+    pthread_mutex_destroy(&stack->pendingMutex);
+
+    pthread_mutex_lock(&instancesMutex);
+    instances[stack->idx] = NULL;
+    pthread_mutex_unlock(&instancesMutex);
+}
+
+void
+mock_stack_post(
+    mock_stack_t* const stack,
+    const int handle,
+    const uint8_t events)
+{
+    mock_stack_queue(stack, handle, events);
+    notification_emit(&stack->event);
+}
+
+void
+mock_stack_queue(
+    mock_stack_t* const stack,
+    const int handle,
+    const uint8_t events)
+{
+    pthread_mutex_lock(&stack->pendingMutex);
+    stack->pending[handle] |= events;
+    pthread_mutex_unlock(&stack->pendingMutex);
+}
+
+OS_Socket_Handle_t
+mock_stack_handle(
+    const mock_stack_t* const stack,
+    const int handleID)
+{
+    OS_Socket_Handle_t handle =
+    {
+        .ctx = stack->ctx,
+        .handleID = handleID
+    };
+
+    return handle;
+}
+
+uint64_t
+mock_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+// SDK functions the helper calls, on top of the interface like the socket
+// client of the SDK does.
+OS_Error_t
+OS_Socket_close(
+    const OS_Socket_Handle_t handle)
+{
+    return handle.ctx.socket_close(handle.handleID);
+}
+
+OS_NetworkStack_State_t
+OS_Socket_getStatus(
+    const if_OS_Socket_t* const ctx)
+{
+    return ctx->socket_getStatus();
+}
+
+OS_Error_t
+OS_Socket_wait(
+    const if_OS_Socket_t* const ctx)
+{
+    ctx->socket_wait();
+
+    return OS_SUCCESS;
+}
+
+OS_Error_t
+OS_Socket_poll(
+    const if_OS_Socket_t* const ctx)
+{
+    return ctx->socket_poll() ? OS_SUCCESS : OS_ERROR_TRY_AGAIN;
+}
+
+OS_Error_t
+OS_Socket_regCallback(
+    const if_OS_Socket_t* const ctx,
+    void (*callback)(void*),
+    void* arg)
+{
+    return (ctx->socket_regCallback(callback, arg) == 0) ?
+           OS_SUCCESS : OS_ERROR_GENERIC;
+}
+
+OS_Error_t
+TimeServer_getTime(
+    const if_OS_Timer_t* timer,
+    const TimeServer_Precision_t prec,
+    uint64_t* const time)
+{
+    static const uint64_t divisor[] =
+    {
+        [TimeServer_PRECISION_SEC]  = 1000000000ULL,
+        [TimeServer_PRECISION_MSEC] = 1000000ULL,
+        [TimeServer_PRECISION_USEC] = 1000ULL,
+        [TimeServer_PRECISION_NSEC] = 1ULL
+    };
+
+    *time = mock_time_ns() / divisor[prec];
+
+    return OS_SUCCESS;
+}
+
+OS_Error_t
+TimeServer_sleep(
+    const if_OS_Timer_t* timer,
+    const TimeServer_Precision_t prec,
+    const uint64_t val)
+{
+    static const uint64_t factor[] =
+    {
+        [TimeServer_PRECISION_SEC]  = 1000000000ULL,
+        [TimeServer_PRECISION_MSEC] = 1000000ULL,
+        [TimeServer_PRECISION_USEC] = 1000ULL,
+        [TimeServer_PRECISION_NSEC] = 1ULL
+    };
+    const uint64_t ns = val * factor[prec];
+    const struct timespec ts =
+    {
+        .tv_sec = ns / 1000000000ULL,
+        .tv_nsec = ns % 1000000000ULL
+    };
+
+    nanosleep(&ts, NULL);
+
+    return OS_SUCCESS;
+}
+
+void
+seL4_Yield(void)
+{
+    sched_yield();
+}
@@ -0,0 +1,128 @@
+/*
+ * Network stack and CAmkES glue of a client component, mocked with pthreads so
+ * the non-blocking helper runs on a Linux host.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "OS_Socket.h"
+#include "TimeServer.h"
+
+#include "non_blocking_helper.h"
+
+/*
+ * A mock stack stands for one network stack together with the client side of
+ * the component talking to it. Its members are what the component passes to
+ * nb_helper_init() and nb_helper_init_wait_slots(): the socket interface, the
+ * wait slot notifications and the component mutex. Events are posted for a
+ * socket with mock_stack_post() and handed out by
+ * OS_Socket_getPendingEvents() like the real stack does, merged per socket.
+ *
+ * Notifications work like seL4Notification connections in CAmkES. A signal is
+ * handed to the thread blocked on the notification the longest, if there is
+ * one, and otherwise kept until a wait or poll takes it. The event notification of the stack has
+ * an interface thread of its own, which hands a signal to the callback
+ * registered with OS_Socket_regCallback() and otherwise leaves it to
+ * OS_Socket_wait() and OS_Socket_poll(). A callback is called once.
+ *
+ * The interface functions take no context, so there is a fixed set of them for
+ * each of the MOCK_STACK_MAX_INSTANCES stacks that can exist at a time.
+ */
+
+#define MOCK_STACK_MAX_INSTANCES 2
+#define MOCK_STACK_MAX_SOCKETS   256
+#define MOCK_STACK_DATAPORT_SIZE 4096
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    bool            signalled;
+    // Blocked threads are released in the order they arrived, a thread holding
+    // a ticket below nextRelease may return.
+    uint64_t        nextTicket;
+    uint64_t        nextRelease;
+} mock_notification_t;
+
+typedef struct
+{
+    // Handed to the helper.
+    if_OS_Socket_t        ctx;
+    nb_helper_wait_slot_t waitSlots[NB_HELPER_MAX_WAIT_SLOTS];
+    mutex_lock_func_t     lock;
+    mutex_unlock_func_t   unlock;
+    if_OS_Timer_t         timer;
+
+    // Calls of OS_Socket_getPendingEvents().
+    _Atomic uint32_t      pendingEventsCalls;
+
+    // Internal.
+    size_t                idx;
+    size_t                numSockets;
+    pthread_mutex_t       pendingMutex;
+    uint8_t               pending[MOCK_STACK_MAX_SOCKETS];
+    size_t                nextPending;
+    pthread_mutex_t       dataportMutex;
+    pthread_mutex_t       componentMutex;
+    // Event notification of the stack, and the signals its interface thread
+    // left to OS_Socket_wait() and OS_Socket_poll().
+    mock_notification_t   event;
+    mock_notification_t   handoff;
+    mock_notification_t   slots[NB_HELPER_MAX_WAIT_SLOTS];
+    pthread_mutex_t       callbackMutex;
+    void                  (*callback)(void*);
+    void*                 callbackArg;
+    _Atomic bool          stopping;
+    pthread_t             eventThread;
+    bool                  eventThreadStarted;
+    _Alignas(8) uint8_t   dataport[MOCK_STACK_DATAPORT_SIZE];
+} mock_stack_t;
+
+//------------------------------------------------------------------------------
+// Sets up a stack for handles below numSockets and starts the interface thread
+// of its event notification.
+OS_Error_t
+mock_stack_init(
+    mock_stack_t* const stack,
+    const size_t numSockets);
+
+// Stops the interface thread. No thread may use the stack anymore.
+void
+mock_stack_deinit(
+    mock_stack_t* const stack);
+
+// Adds events for the socket and signals the event notification.
+void
+mock_stack_post(
+    mock_stack_t* const stack,
+    const int handle,
+    const uint8_t events);
+
+// Adds events for the socket without signalling, for a caller that collects
+// them itself.
+void
+mock_stack_queue(
+    mock_stack_t* const stack,
+    const int handle,
+    const uint8_t events);
+
+// Returns the socket handle of the stack for handleID.
+OS_Socket_Handle_t
+mock_stack_handle(
+    const mock_stack_t* const stack,
+    const int handleID);
+
+// Time of CLOCK_MONOTONIC in ns.
+uint64_t
+mock_time_ns(void);
@@ -0,0 +1,98 @@
+/*
+ * Test of the waits for a single socket on a Linux host, on top of the mock
+ * stack, when the socket is closed by the peer.
+ *
+ * A close ends the wait for reading and the wait for writing with
+ * OS_ERROR_NETWORK_CONN_SHUTDOWN. It must be consumed like every other event,
+ * the next wait may not report it again and no event of the socket may be
+ * left behind.
+ *
+ * Usage: test_nb_helper_close
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <stdio.h>
+
+#include "lib_macros/Test.h"
+
+#include "mock_stack.h"
+#include "non_blocking_helper.h"
+
+#define NUM_SOCKETS 4
+
+static mock_stack_t stack;
+static nb_helper_t nbh;
+
+typedef OS_Error_t (*wait_func_t)(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const uint64_t deadlineMs);
+
+//------------------------------------------------------------------------------
+// The helper is not subscribed, the events are collected by calling the
+// callback directly.
+static void
+deliver(
+    const int handle,
+    const uint8_t events)
+{
+    mock_stack_queue(&stack, handle, events);
+    nb_helper_collect_pending_ev_handler(&nbh);
+}
+
+static void
+check_close(
+    const wait_func_t wait,
+    const int handle,
+    const uint8_t awaited)
+{
+    const OS_Socket_Handle_t h = mock_stack_handle(&stack, handle);
+
+    // Together with the awaited event, the close is reported once.
+    deliver(handle, awaited | OS_SOCK_EV_CLOSE);
+
+    OS_Error_t err = wait(&nbh, h, NB_HELPER_DEADLINE_NOW);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    err = wait(&nbh, h, NB_HELPER_DEADLINE_NOW);
+    ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_CONN_SHUTDOWN, err);
+    err = wait(&nbh, h, NB_HELPER_DEADLINE_NOW);
+    ASSERT_EQ_OS_ERR(OS_ERROR_TIMEOUT, err);
+
+    // On its own.
+    deliver(handle, OS_SOCK_EV_CLOSE);
+
+    err = wait(&nbh, h, NB_HELPER_DEADLINE_NOW);
+    ASSERT_EQ_OS_ERR(OS_ERROR_NETWORK_CONN_SHUTDOWN, err);
+    err = wait(&nbh, h, NB_HELPER_DEADLINE_NOW);
+    ASSERT_EQ_OS_ERR(OS_ERROR_TIMEOUT, err);
+
+    ASSERT_EQ_SZ(0, nb_helper_count_busy_entries(&nbh));
+}
+
+//------------------------------------------------------------------------------
+int
+main(void)
+{
+    OS_Error_t err = mock_stack_init(&stack, NUM_SOCKETS);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = nb_helper_init(&nbh, &stack.ctx, NUM_SOCKETS,
+                         stack.waitSlots[0].notify, stack.waitSlots[0].wait,
+                         stack.lock, stack.unlock);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    check_close(nb_helper_wait_for_read_ev_on_socket_until, 1,
+                OS_SOCK_EV_READ);
+    check_close(nb_helper_wait_for_write_ev_on_socket_until, 2,
+                OS_SOCK_EV_WRITE);
+
+    mock_stack_deinit(&stack);
+    nb_helper_deinit(&nbh);
+
+    return 0;
+}
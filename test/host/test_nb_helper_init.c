@@ -0,0 +1,105 @@
+/*
+ * Test that nb_helper_init() sets up every field of an instance on a Linux
+ * host, on top of the mock stack.
+ *
+ * The instance lives on the stack of main() and is filled with a pattern
+ * before it is initialized, like a component would find it. Then it is
+ * initialized again after it has been configured and deinitialized. Both times
+ * nb_helper_wait_any() must hand out all sockets with events at once, nothing
+ * may be left over from before.
+ *
+ * Usage: test_nb_helper_init
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lib_macros/Test.h"
+
+#include "mock_stack.h"
+#include "non_blocking_helper.h"
+
+#define NUM_SOCKETS 8
+
+static mock_stack_t stack;
+
+//------------------------------------------------------------------------------
+static void
+init_helper(
+    nb_helper_t* const nbh)
+{
+    OS_Error_t err = nb_helper_init(nbh, &stack.ctx, NUM_SOCKETS,
+                                    stack.waitSlots[0].notify,
+                                    stack.waitSlots[0].wait,
+                                    stack.lock, stack.unlock);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+}
+
+// Events on all sockets of a set are handed out by a single call. The helper is
+// not subscribed, the events are collected by calling the callback directly.
+static void
+check_wait_any(
+    nb_helper_t* const nbh)
+{
+    nb_helper_poll_t fds[NUM_SOCKETS];
+    nb_helper_poll_t ready[NUM_SOCKETS];
+    nb_helper_poll_set_t set;
+
+    OS_Error_t err = nb_helper_poll_set_init(nbh, &set, fds, NUM_SOCKETS);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    for (int h = 0; h < NUM_SOCKETS; h++)
+    {
+        err = nb_helper_poll_set_add(nbh, &set, mock_stack_handle(&stack, h),
+                                     OS_SOCK_EV_READ, NULL);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        mock_stack_queue(&stack, h, OS_SOCK_EV_READ);
+    }
+    nb_helper_collect_pending_ev_handler(nbh);
+
+    size_t numReady = 0;
+    err = nb_helper_wait_any_until(nbh, &set, NB_HELPER_DEADLINE_NOW,
+                                   ready, NUM_SOCKETS, &numReady);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    ASSERT_EQ_SZ(NUM_SOCKETS, numReady);
+
+    while (set.numFds > 0)
+    {
+        err = nb_helper_poll_set_remove(nbh, &set, set.fds[0].handle);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+    ASSERT_EQ_SZ(0, nb_helper_count_busy_entries(nbh));
+}
+
+//------------------------------------------------------------------------------
+int
+main(void)
+{
+    nb_helper_t nbh;
+
+    OS_Error_t err = mock_stack_init(&stack, NUM_SOCKETS);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    // Whatever was in the memory before.
+    memset(&nbh, 0xa5, sizeof(nbh));
+    init_helper(&nbh);
+    check_wait_any(&nbh);
+
+    // Reused after a dispatch limit was set.
+    err = nb_helper_set_dispatch_limit(&nbh, 1);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    nb_helper_deinit(&nbh);
+    init_helper(&nbh);
+    check_wait_any(&nbh);
+
+    mock_stack_deinit(&stack);
+    nb_helper_deinit(&nbh);
+
+    return 0;
+}
@@ -0,0 +1,318 @@
+/*
+ * Test of two instances of the non-blocking helper side by side on a Linux
+ * host, one per mock stack, like a component talking to two network stacks.
+ *
+ * The instances must not share any state. First an event, a close and the
+ * statistics of one instance are checked to leave the other one alone. Then
+ * both stacks get events at the same time, one instance with a persistent
+ * subscription and the other one with the callback. The stacks only post for
+ * sockets of their own parity, so an event showing up at the wrong instance
+ * is caught, and every socket must see its last event.
+ *
+ * Usage: test_nb_helper_instances [postsPerStack]
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lib_macros/Test.h"
+
+#include "mock_stack.h"
+#include "non_blocking_helper.h"
+
+#define NUM_INSTANCES 2
+#define NUM_SOCKETS   32
+
+// Deadline of the waits that expect an event.
+#define EVENT_WAIT_MS 1000
+// Deadline of the waits of the consumers, so they notice the end of the test.
+#define WAIT_MS       2
+// Time the consumers get for the last events.
+#define DRAIN_MS      5000
+
+typedef struct
+{
+    mock_stack_t          stack;
+    nb_helper_t           nbh;
+    nb_helper_poll_t      fds[NUM_SOCKETS];
+    nb_helper_poll_t      ready[NUM_SOCKETS];
+    _Atomic uint64_t      posted[NUM_SOCKETS];
+    _Atomic uint64_t      seen[NUM_SOCKETS];
+    pthread_t             producer;
+    pthread_t             consumer;
+} instance_t;
+
+static instance_t instances[NUM_INSTANCES];
+static unsigned int postsPerStack = 20000;
+static _Atomic bool stop;
+
+//------------------------------------------------------------------------------
+static uint64_t
+deadline_in(
+    instance_t* const inst,
+    const uint32_t timeoutMs)
+{
+    uint64_t deadlineMs;
+    OS_Error_t err = nb_helper_deadline_in(&inst->nbh, timeoutMs, &deadlineMs);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    return deadlineMs;
+}
+
+static OS_Error_t
+wait_read(
+    instance_t* const inst,
+    const int handle,
+    const uint64_t deadlineMs)
+{
+    return nb_helper_wait_for_read_ev_on_socket_until(
+               &inst->nbh,
+               mock_stack_handle(&inst->stack, handle),
+               deadlineMs);
+}
+
+// An event, a close and the statistics of one instance leave the other alone.
+static void
+test_isolation(void)
+{
+    instance_t* a = &instances[0];
+    instance_t* b = &instances[1];
+    nb_helper_stats_t statsA;
+    nb_helper_stats_t statsB;
+    OS_Error_t err;
+
+    mock_stack_post(&a->stack, 3, OS_SOCK_EV_READ);
+    err = wait_read(a, 3, deadline_in(a, EVENT_WAIT_MS));
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = wait_read(b, 3, NB_HELPER_DEADLINE_NOW);
+    ASSERT_EQ_OS_ERR(OS_ERROR_TIMEOUT, err);
+
+    nb_helper_get_stats(&a->nbh, &statsA);
+    nb_helper_get_stats(&b->nbh, &statsB);
+    ASSERT_EQ_INT(1, statsA.eventsDelivered);
+    ASSERT_EQ_INT(0, statsB.eventsDelivered);
+
+    // Closing the socket at a drops nothing at b.
+    mock_stack_post(&b->stack, 5, OS_SOCK_EV_READ);
+    err = wait_read(b, 5, deadline_in(b, EVENT_WAIT_MS));
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    mock_stack_post(&b->stack, 5, OS_SOCK_EV_READ);
+    mock_stack_post(&a->stack, 5, OS_SOCK_EV_READ);
+    err = wait_read(a, 5, deadline_in(a, EVENT_WAIT_MS));
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = nb_helper_socket_close(&a->nbh, mock_stack_handle(&a->stack, 5));
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = wait_read(b, 5, deadline_in(b, EVENT_WAIT_MS));
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    ASSERT_EQ_SZ(0, nb_helper_count_busy_entries(&a->nbh));
+    ASSERT_EQ_SZ(0, nb_helper_count_busy_entries(&b->nbh));
+}
+
+//------------------------------------------------------------------------------
+static void*
+producer(
+    void* arg)
+{
+    instance_t* inst = arg;
+    const int parity = (int) (inst - instances);
+    unsigned int seed = (unsigned int) parity + 1;
+
+    for (unsigned int i = 0; i < postsPerStack; i++)
+    {
+        const int handle = (rand_r(&seed) % (NUM_SOCKETS / 2)) * 2 + parity;
+
+        atomic_fetch_add(&inst->posted[handle], 1);
+        mock_stack_post(&inst->stack, handle, OS_SOCK_EV_READ);
+
+        if (rand_r(&seed) % 64 == 0)
+        {
+            TimeServer_sleep(NULL, TimeServer_PRECISION_USEC,
+                             rand_r(&seed) % 500);
+        }
+    }
+
+    return NULL;
+}
+
+static void*
+consumer(
+    void* arg)
+{
+    instance_t* inst = arg;
+    const int parity = (int) (inst - instances);
+    nb_helper_poll_set_t set;
+
+    OS_Error_t err = nb_helper_poll_set_init(&inst->nbh, &set, inst->fds,
+                                             NUM_SOCKETS);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    for (int h = 0; h < NUM_SOCKETS; h++)
+    {
+        err = nb_helper_poll_set_add(&inst->nbh, &set,
+                                     mock_stack_handle(&inst->stack, h),
+                                     OS_SOCK_EV_READ, NULL);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    while (!atomic_load(&stop))
+    {
+        size_t numReady = 0;
+        err = nb_helper_wait_any_until(&inst->nbh, &set,
+                                       deadline_in(inst, WAIT_MS),
+                                       inst->ready, NUM_SOCKETS, &numReady);
+        if (err == OS_ERROR_TIMEOUT)
+        {
+            continue;
+        }
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        for (size_t i = 0; i < numReady; i++)
+        {
+            const int handle = inst->ready[i].handle.handleID;
+
+            // Only ever posted at the other stack.
+            ASSERT_EQ_INT(parity, handle % 2);
+            atomic_store(&inst->seen[handle],
+                         atomic_load(&inst->posted[handle]));
+        }
+    }
+
+    while (set.numFds > 0)
+    {
+        err = nb_helper_poll_set_remove(&inst->nbh, &set, set.fds[0].handle);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    return NULL;
+}
+
+static bool
+all_seen(void)
+{
+    for (int i = 0; i < NUM_INSTANCES; i++)
+    {
+        for (int h = 0; h < NUM_SOCKETS; h++)
+        {
+            if (atomic_load(&instances[i].seen[h])
+                != atomic_load(&instances[i].posted[h]))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Both instances get events at the same time.
+static bool
+test_concurrent(void)
+{
+    for (int i = 0; i < NUM_INSTANCES; i++)
+    {
+        pthread_create(&instances[i].consumer, NULL, consumer, &instances[i]);
+        pthread_create(&instances[i].producer, NULL, producer, &instances[i]);
+    }
+    for (int i = 0; i < NUM_INSTANCES; i++)
+    {
+        pthread_join(instances[i].producer, NULL);
+    }
+
+    const uint64_t drainStartNs = mock_time_ns();
+    while (!all_seen()
+           && (mock_time_ns() - drainStartNs < DRAIN_MS * 1000000ULL))
+    {
+        TimeServer_sleep(NULL, TimeServer_PRECISION_MSEC, 1);
+    }
+    const bool ok = all_seen();
+
+    atomic_store(&stop, true);
+    for (int i = 0; i < NUM_INSTANCES; i++)
+    {
+        pthread_join(instances[i].consumer, NULL);
+    }
+
+    for (int i = 0; i < NUM_INSTANCES; i++)
+    {
+        nb_helper_stats_t stats;
+        nb_helper_get_stats(&instances[i].nbh, &stats);
+
+        printf("instance %d: %u events delivered in %u batches, "
+               "%u getPendingEvents\n",
+               i, stats.eventsDelivered, stats.eventBatches,
+               atomic_load(&instances[i].stack.pendingEventsCalls));
+
+        for (int h = 0; h < NUM_SOCKETS; h++)
+        {
+            if (atomic_load(&instances[i].seen[h])
+                != atomic_load(&instances[i].posted[h]))
+            {
+                fprintf(stderr, "instance %d socket %d: %" PRIu64 " posts, "
+                        "last seen %" PRIu64 "\n", i, h,
+                        atomic_load(&instances[i].posted[h]),
+                        atomic_load(&instances[i].seen[h]));
+            }
+        }
+    }
+
+    return ok;
+}
+
+//------------------------------------------------------------------------------
+int
+main(
+    int argc,
+    char* argv[])
+{
+    if (argc > 1)
+    {
+        postsPerStack = (unsigned int) strtoul(argv[1], NULL, 0);
+    }
+
+    for (int i = 0; i < NUM_INSTANCES; i++)
+    {
+        instance_t* inst = &instances[i];
+
+        OS_Error_t err = mock_stack_init(&inst->stack, NUM_SOCKETS);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        err = nb_helper_init(&inst->nbh, &inst->stack.ctx, NUM_SOCKETS,
+                             inst->stack.waitSlots[0].notify,
+                             inst->stack.waitSlots[0].wait,
+                             inst->stack.lock, inst->stack.unlock);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+        err = nb_helper_set_timer(&inst->nbh, &inst->stack.timer);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+        // One of each kind of subscription.
+        err = nb_helper_subscribe(&inst->nbh, (0 == i));
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    test_isolation();
+    const bool ok = test_concurrent();
+
+    // The interface thread of a stack may still be collecting the last events.
+    for (int i = 0; i < NUM_INSTANCES; i++)
+    {
+        mock_stack_deinit(&instances[i].stack);
+        nb_helper_deinit(&instances[i].nbh);
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "FAILED: events lost\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * Test of several threads sharing the single wait slot of the non-blocking
+ * helper on a Linux host, on top of the mock stack.
+ *
+ * Every waiter thread waits on a socket of its own without a deadline, one more
+ * thread on a poll set of further sockets. All of them use the same slot, like
+ * the threads of a component that does not register wait slots. The main
+ * thread posts events for a few random sockets at a time and expects each of
+ * them to be consumed within WAKEUP_MS. A notification that does not reach the
+ * thread it was meant for leaves that thread blocked and fails the test.
+ * Waiting on a socket that is waited on already must fail.
+ *
+ * Usage: test_nb_helper_shared_slot persistent|callback [rounds]
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib_macros/Test.h"
+
+#include "mock_stack.h"
+#include "non_blocking_helper.h"
+
+#define NUM_WAITERS     4
+#define NUM_SET_SOCKETS 4
+#define NUM_SOCKETS     (NUM_WAITERS + NUM_SET_SOCKETS)
+
+// Time a posted event may take to be consumed.
+#define WAKEUP_MS       2000
+
+static mock_stack_t stack;
+static nb_helper_t nbh;
+static unsigned int rounds = 20000;
+
+static _Atomic uint64_t posted[NUM_SOCKETS];
+static _Atomic uint64_t seen[NUM_SOCKETS];
+static _Atomic bool stop;
+
+//------------------------------------------------------------------------------
+static void*
+socket_waiter(
+    void* arg)
+{
+    const int handle = (int) (uintptr_t) arg;
+
+    while (!atomic_load(&stop))
+    {
+        OS_Error_t err = nb_helper_wait_for_read_ev_on_socket(
+                             &nbh,
+                             mock_stack_handle(&stack, handle));
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        atomic_store(&seen[handle], atomic_load(&posted[handle]));
+    }
+
+    return NULL;
+}
+
+static void*
+set_waiter(
+    void* arg)
+{
+    nb_helper_poll_t fds[NUM_SET_SOCKETS];
+    nb_helper_poll_t ready[NUM_SET_SOCKETS];
+    nb_helper_poll_set_t set;
+
+    (void) arg;
+
+    OS_Error_t err = nb_helper_poll_set_init(&nbh, &set, fds, NUM_SET_SOCKETS);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    for (int h = NUM_WAITERS; h < NUM_SOCKETS; h++)
+    {
+        err = nb_helper_poll_set_add(&nbh, &set, mock_stack_handle(&stack, h),
+                                     OS_SOCK_EV_READ, NULL);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    while (!atomic_load(&stop))
+    {
+        size_t numReady = 0;
+        err = nb_helper_wait_any(&nbh, &set, ready, NUM_SET_SOCKETS,
+                                 &numReady);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        for (size_t i = 0; i < numReady; i++)
+        {
+            const int handle = ready[i].handle.handleID;
+            atomic_store(&seen[handle], atomic_load(&posted[handle]));
+        }
+    }
+
+    while (set.numFds > 0)
+    {
+        err = nb_helper_poll_set_remove(&nbh, &set, set.fds[0].handle);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+static bool
+all_seen(void)
+{
+    for (int h = 0; h < NUM_SOCKETS; h++)
+    {
+        if (atomic_load(&seen[h]) != atomic_load(&posted[h]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool
+wait_all_seen(void)
+{
+    const uint64_t startNs = mock_time_ns();
+
+    while (!all_seen())
+    {
+        if (mock_time_ns() - startNs > WAKEUP_MS * 1000000ULL)
+        {
+            return false;
+        }
+        sched_yield();
+    }
+
+    return true;
+}
+
+// A second wait on the socket of a waiter is refused, once the waiter got to
+// it.
+static void
+test_second_waiter(void)
+{
+    const uint64_t startNs = mock_time_ns();
+    OS_Error_t err;
+
+    do
+    {
+        err = nb_helper_wait_for_read_ev_on_socket_until(
+                  &nbh,
+                  mock_stack_handle(&stack, 0),
+                  NB_HELPER_DEADLINE_NOW);
+        if (err != OS_ERROR_INVALID_STATE)
+        {
+            ASSERT_EQ_OS_ERR(OS_ERROR_TIMEOUT, err);
+            ASSERT_LE_INT(mock_time_ns() - startNs, WAKEUP_MS * 1000000ULL);
+            sched_yield();
+        }
+    }
+    while (err != OS_ERROR_INVALID_STATE);
+}
+
+//------------------------------------------------------------------------------
+int
+main(
+    int argc,
+    char* argv[])
+{
+    if ((argc < 2)
+        || (strcmp(argv[1], "persistent") && strcmp(argv[1], "callback")))
+    {
+        fprintf(stderr, "usage: %s persistent|callback [rounds]\n", argv[0]);
+        return 2;
+    }
+    const bool persistent = !strcmp(argv[1], "persistent");
+    if (argc > 2)
+    {
+        rounds = (unsigned int) strtoul(argv[2], NULL, 0);
+    }
+
+    OS_Error_t err = mock_stack_init(&stack, NUM_SOCKETS);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = nb_helper_init(&nbh, &stack.ctx, NUM_SOCKETS,
+                         stack.waitSlots[0].notify, stack.waitSlots[0].wait,
+                         stack.lock, stack.unlock);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    err = nb_helper_subscribe(&nbh, persistent);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    pthread_t waiters[NUM_WAITERS + 1];
+
+    for (uintptr_t i = 0; i < NUM_WAITERS; i++)
+    {
+        pthread_create(&waiters[i], NULL, socket_waiter, (void*) i);
+    }
+    pthread_create(&waiters[NUM_WAITERS], NULL, set_waiter, NULL);
+
+    test_second_waiter();
+
+    unsigned int seed = 1;
+    bool ok = true;
+
+    for (unsigned int r = 0; ok && (r < rounds); r++)
+    {
+        // Mostly single events, so only one of the threads has something to
+        // do, sometimes several at once.
+        const int numPosts = (rand_r(&seed) % 4 == 0) ? 3 : 1;
+
+        for (int i = 0; i < numPosts; i++)
+        {
+            const int handle = rand_r(&seed) % NUM_SOCKETS;
+
+            atomic_fetch_add(&posted[handle], 1);
+            mock_stack_post(&stack, handle, OS_SOCK_EV_READ);
+        }
+
+        ok = wait_all_seen();
+    }
+
+    nb_helper_stats_t stats;
+    nb_helper_get_stats(&nbh, &stats);
+
+    printf("%s: %u events, %u wakeups (%u spurious), %u notifications, "
+           "%u passed on\n",
+           argv[1], stats.eventsDelivered, stats.wakeups,
+           stats.spuriousWakeups, stats.notifications,
+           stats.passedNotifications);
+
+    if (!ok)
+    {
+        for (int h = 0; h < NUM_SOCKETS; h++)
+        {
+            if (atomic_load(&seen[h]) != atomic_load(&posted[h]))
+            {
+                fprintf(stderr, "socket %d: %" PRIu64 " posts, last seen %"
+                        PRIu64 "\n", h, atomic_load(&posted[h]),
+                        atomic_load(&seen[h]));
+            }
+        }
+        fprintf(stderr, "FAILED: wakeup lost\n");
+        // The waiters can't be stopped anymore.
+        fflush(stdout);
+        _Exit(1);
+    }
+
+    atomic_store(&stop, true);
+    for (int h = 0; h < NUM_SOCKETS; h++)
+    {
+        mock_stack_post(&stack, h, OS_SOCK_EV_READ);
+    }
+    for (int i = 0; i <= NUM_WAITERS; i++)
+    {
+        pthread_join(waiters[i], NULL);
+    }
+
+    mock_stack_deinit(&stack);
+    nb_helper_deinit(&nbh);
+
+    return 0;
+}
@@ -0,0 +1,386 @@
+/*
+ * Stress test of the event table of the non-blocking helper on a Linux host.
+ *
+ * Producer threads post read events for random sockets of a mock stack while
+ * the events are collected, by the callback or by the thread draining a
+ * persistent subscription, and consumed at the same time by one thread per wait
+ * slot. Two of them wait on a poll set of their sockets, the third one on its
+ * sockets one at a time.
+ *
+ * Events posted before the stack is asked for them again are merged into one,
+ * like the real stack does, so not every post is seen. But every post is
+ * followed by a consumed event for its socket: a consumer records the number
+ * of posts for the socket after it consumed an event. The producers post in
+ * short rounds, and after every round the last post of every socket has to be
+ * recorded. A lost event leaves its socket behind, unless it was followed by
+ * another one for the same socket in the same round.
+ *
+ * Usage: test_nb_helper_stress persistent|callback [postsPerProducer]
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib_macros/Test.h"
+
+#include "mock_stack.h"
+#include "non_blocking_helper.h"
+
+#define NUM_SOCKETS     64
+#define NUM_SLOTS       3
+#define NUM_PRODUCERS   2
+#define SOCKETS_PER_SET ((NUM_SOCKETS + NUM_SLOTS - 1) / NUM_SLOTS)
+
+// Deadline of every wait, so the consumers notice the end of the test.
+#define WAIT_MS         2
+// Posts of a producer per round, a few per socket.
+#define ROUND_POSTS     64
+// Time the consumers get for the last events of a round.
+#define DRAIN_MS        5000
+
+static mock_stack_t stack;
+static nb_helper_t nbh;
+static unsigned int postsPerProducer = 20000;
+
+static _Atomic uint64_t posted[NUM_SOCKETS];
+static _Atomic uint64_t seen[NUM_SOCKETS];
+static _Atomic uint64_t consumed;
+static _Atomic bool stop;
+static pthread_barrier_t roundStart;
+static pthread_barrier_t roundEnd;
+
+//------------------------------------------------------------------------------
+static void*
+producer(
+    void* arg)
+{
+    unsigned int seed = (unsigned int) (uintptr_t) arg;
+
+    for (unsigned int i = 0; i < postsPerProducer; i++)
+    {
+        if (i % ROUND_POSTS == 0)
+        {
+            if (i > 0)
+            {
+                pthread_barrier_wait(&roundEnd);
+            }
+            pthread_barrier_wait(&roundStart);
+        }
+
+        const int handle = rand_r(&seed) % NUM_SOCKETS;
+
+        // Counted before it can be collected, so a consumer that got the event
+        // sees this post.
+        atomic_fetch_add(&posted[handle], 1);
+        mock_stack_post(&stack, handle, OS_SOCK_EV_READ);
+
+        // Bursts of events, with pauses that let the consumers block.
+        if (rand_r(&seed) % 64 == 0)
+        {
+            TimeServer_sleep(NULL, TimeServer_PRECISION_USEC,
+                             rand_r(&seed) % 500);
+        }
+    }
+    pthread_barrier_wait(&roundEnd);
+
+    return NULL;
+}
+
+static void
+record_event(
+    const int handle)
+{
+    atomic_store(&seen[handle], atomic_load(&posted[handle]));
+    atomic_fetch_add(&consumed, 1);
+}
+
+static OS_Error_t
+deadline(
+    uint64_t* const deadlineMs)
+{
+    return nb_helper_deadline_in(&nbh, WAIT_MS, deadlineMs);
+}
+
+// Waits on the sockets of the slot with a poll set.
+static void*
+poll_set_consumer(
+    void* arg)
+{
+    const int slot = (int) (uintptr_t) arg;
+    nb_helper_poll_t fds[SOCKETS_PER_SET];
+    nb_helper_poll_t ready[SOCKETS_PER_SET];
+    nb_helper_poll_set_t set;
+
+    OS_Error_t err = nb_helper_poll_set_init(&nbh, &set, fds, SOCKETS_PER_SET);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    for (int h = slot; h < NUM_SOCKETS; h += NUM_SLOTS)
+    {
+        err = nb_helper_poll_set_add(&nbh, &set, mock_stack_handle(&stack, h),
+                                     OS_SOCK_EV_READ, NULL);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    while (!atomic_load(&stop))
+    {
+        uint64_t deadlineMs;
+        err = deadline(&deadlineMs);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        size_t numReady = 0;
+        err = nb_helper_wait_any_until(&nbh, &set, deadlineMs, ready,
+                                       SOCKETS_PER_SET, &numReady);
+        if (err == OS_ERROR_TIMEOUT)
+        {
+            continue;
+        }
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        for (size_t i = 0; i < numReady; i++)
+        {
+            ASSERT_TRUE(ready[i].revents & OS_SOCK_EV_READ);
+            record_event(ready[i].handle.handleID);
+        }
+    }
+
+    while (set.numFds > 0)
+    {
+        err = nb_helper_poll_set_remove(&nbh, &set, set.fds[0].handle);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    return NULL;
+}
+
+// Waits on the sockets of the slot one after the other.
+static void*
+socket_consumer(
+    void* arg)
+{
+    const int slot = (int) (uintptr_t) arg;
+    int handle = slot;
+
+    while (!atomic_load(&stop))
+    {
+        uint64_t deadlineMs;
+        OS_Error_t err = deadline(&deadlineMs);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        err = nb_helper_wait_for_read_ev_on_socket_until(
+                  &nbh,
+                  mock_stack_handle(&stack, handle),
+                  deadlineMs);
+        if (err == OS_SUCCESS)
+        {
+            record_event(handle);
+        }
+        else
+        {
+            ASSERT_EQ_OS_ERR(OS_ERROR_TIMEOUT, err);
+        }
+
+        handle += NUM_SLOTS;
+        if (handle >= NUM_SOCKETS)
+        {
+            handle = slot;
+        }
+    }
+
+    return NULL;
+}
+
+// Takes the events of the sockets of the slot that are left, without waiting.
+static void
+drain_slot(
+    const int slot)
+{
+    nb_helper_poll_t fds[SOCKETS_PER_SET];
+    nb_helper_poll_t ready[SOCKETS_PER_SET];
+    nb_helper_poll_set_t set;
+    size_t numReady;
+
+    OS_Error_t err = nb_helper_poll_set_init(&nbh, &set, fds, SOCKETS_PER_SET);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    for (int h = slot; h < NUM_SOCKETS; h += NUM_SLOTS)
+    {
+        err = nb_helper_poll_set_add(&nbh, &set, mock_stack_handle(&stack, h),
+                                     OS_SOCK_EV_READ, NULL);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+
+    do
+    {
+        err = nb_helper_wait_any_until(&nbh, &set, NB_HELPER_DEADLINE_NOW,
+                                       ready, SOCKETS_PER_SET, &numReady);
+    }
+    while (err == OS_SUCCESS);
+    ASSERT_EQ_OS_ERR(OS_ERROR_TIMEOUT, err);
+
+    while (set.numFds > 0)
+    {
+        err = nb_helper_poll_set_remove(&nbh, &set, set.fds[0].handle);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    }
+}
+
+static bool
+all_seen(void)
+{
+    for (int h = 0; h < NUM_SOCKETS; h++)
+    {
+        if (atomic_load(&seen[h]) != atomic_load(&posted[h]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+int
+main(
+    int argc,
+    char* argv[])
+{
+    if ((argc < 2)
+        || (strcmp(argv[1], "persistent") && strcmp(argv[1], "callback")))
+    {
+        fprintf(stderr, "usage: %s persistent|callback [postsPerProducer]\n",
+                argv[0]);
+        return 2;
+    }
+    const bool persistent = !strcmp(argv[1], "persistent");
+    if (argc > 2)
+    {
+        postsPerProducer = (unsigned int) strtoul(argv[2], NULL, 0);
+    }
+
+    OS_Error_t err = mock_stack_init(&stack, NUM_SOCKETS);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    err = nb_helper_init(&nbh, &stack.ctx, NUM_SOCKETS,
+                         stack.waitSlots[0].notify, stack.waitSlots[0].wait,
+                         stack.lock, stack.unlock);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    err = nb_helper_init_wait_slots(&nbh, stack.waitSlots, NUM_SLOTS);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    err = nb_helper_set_timer(&nbh, &stack.timer);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    err = nb_helper_set_spin(&nbh, NULL, 64);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    err = nb_helper_subscribe(&nbh, persistent);
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    pthread_t consumers[NUM_SLOTS];
+    pthread_t producers[NUM_PRODUCERS];
+
+    pthread_barrier_init(&roundStart, NULL, NUM_PRODUCERS + 1);
+    pthread_barrier_init(&roundEnd, NULL, NUM_PRODUCERS + 1);
+
+    for (uintptr_t slot = 0; slot < NUM_SLOTS; slot++)
+    {
+        pthread_create(&consumers[slot], NULL,
+                       (slot < NUM_SLOTS - 1) ? poll_set_consumer
+                       : socket_consumer,
+                       (void*) slot);
+    }
+    for (uintptr_t i = 0; i < NUM_PRODUCERS; i++)
+    {
+        pthread_create(&producers[i], NULL, producer, (void*) (i + 1));
+    }
+
+    const unsigned int numRounds =
+        (postsPerProducer + ROUND_POSTS - 1) / ROUND_POSTS;
+    unsigned int round;
+    bool ok = true;
+
+    for (round = 0; ok && (round < numRounds); round++)
+    {
+        pthread_barrier_wait(&roundStart);
+        pthread_barrier_wait(&roundEnd);
+
+        const uint64_t drainStartNs = mock_time_ns();
+        while (!all_seen()
+               && (mock_time_ns() - drainStartNs < DRAIN_MS * 1000000ULL))
+        {
+            TimeServer_sleep(NULL, TimeServer_PRECISION_USEC, 100);
+        }
+        ok = all_seen();
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "events lost in round %u\n", round - 1);
+        // Let the producers finish.
+        for (; round < numRounds; round++)
+        {
+            pthread_barrier_wait(&roundStart);
+            pthread_barrier_wait(&roundEnd);
+        }
+    }
+
+    for (size_t i = 0; i < NUM_PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+
+    atomic_store(&stop, true);
+    for (size_t i = 0; i < NUM_SLOTS; i++)
+    {
+        pthread_join(consumers[i], NULL);
+    }
+
+    // An event can still be in the table when the consumer saw its post with
+    // the event before. Take them out, and the sockets the single socket waits
+    // left on the ready list, before checking the table is clean.
+    TimeServer_sleep(NULL, TimeServer_PRECISION_MSEC, WAIT_MS);
+    for (int slot = 0; slot < NUM_SLOTS; slot++)
+    {
+        drain_slot(slot);
+    }
+
+    uint64_t totalPosts = 0;
+    for (int h = 0; h < NUM_SOCKETS; h++)
+    {
+        totalPosts += atomic_load(&posted[h]);
+        if (atomic_load(&seen[h]) != atomic_load(&posted[h]))
+        {
+            fprintf(stderr, "socket %d: %" PRIu64 " posts, last seen %" PRIu64
+                    "\n", h, atomic_load(&posted[h]), atomic_load(&seen[h]));
+        }
+    }
+
+    nb_helper_stats_t stats;
+    nb_helper_get_stats(&nbh, &stats);
+    const size_t busy = nb_helper_count_busy_entries(&nbh);
+
+    printf("%s: %" PRIu64 " posts, %" PRIu64 " events consumed, %u delivered "
+           "in %u batches, %u getPendingEvents, %u wakeups (%u spurious), "
+           "%zu busy entries\n",
+           argv[1], totalPosts, atomic_load(&consumed), stats.eventsDelivered,
+           stats.eventBatches, atomic_load(&stack.pendingEventsCalls),
+           stats.wakeups, stats.spuriousWakeups, busy);
+
+    nb_helper_deinit(&nbh);
+    mock_stack_deinit(&stack);
+    pthread_barrier_destroy(&roundEnd);
+    pthread_barrier_destroy(&roundStart);
+
+    if (!ok || (busy != 0))
+    {
+        fprintf(stderr, "FAILED: %s\n",
+                ok ? "event table not clean" : "events lost");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+#
+# Generates the payload streamed by the bulk throughput benchmark of the TCP
+# client, CFG_TCP_CLIENT_BENCH_PATH in system_config.h. The content is the same
+# on every run, so the checksums logged by the benchmark can be compared across
+# runs and hosts.
+#
+# Usage: gen_bench_bin.py <document root> [size in MiB]
+#
+# Copyright (C) 2024, HENSOLDT Cyber GmbH
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# For commercial licensing, contact: info.cyber@hensoldt.net
+#
+
+import os
+import random
+import sys
+
+BENCH_PATH = "network/bench.bin"
+DEFAULT_SIZE_MIB = 10
+CHUNK_SIZE = 1024 * 1024
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit("usage: %s <document root> [size in MiB]" % sys.argv[0])
+
+    path = os.path.join(sys.argv[1], BENCH_PATH)
+    size_mib = int(sys.argv[2]) if len(sys.argv) == 3 else DEFAULT_SIZE_MIB
+
+    # Random bytes, so a server or proxy compressing the response does not
+    # skew the numbers.
+    rng = random.Random(0)
+
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, "wb") as f:
+        for _ in range(size_mib):
+            f.write(rng.getrandbits(CHUNK_SIZE * 8).to_bytes(CHUNK_SIZE,
+                                                             "little"))
+
+    print("%s: %d bytes" % (path, size_mib * CHUNK_SIZE))
+
+
+if __name__ == "__main__":
+    main()
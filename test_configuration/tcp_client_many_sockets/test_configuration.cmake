@@ -0,0 +1,51 @@
+#
+# Copyright (C) 2020-2024, HENSOLDT Cyber GmbH
+# 
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# For commercial licensing, contact: info.cyber@hensoldt.net
+#
+
+TimeServer_DeclareCAmkESComponent(
+    TimeServer
+)
+
+NetworkStack_PicoTcp_DeclareCAmkESComponent(
+    NetworkStack_PicoTcp
+    C_FLAGS
+        -DNetworkStack_PicoTcp_USE_HARDCODED_IPADDR
+        -DOS_NETWORK_MAXIMUM_SOCKET_NO=256
+        -DDEV_ADDR="${DEV_ADDR}"
+        -DGATEWAY_ADDR="${GATEWAY_ADDR}"
+        -DSUBNET_MASK="${SUBNET_MASK}"
+)
+
+DeclareCAmkESComponent(
+    TestAppTCPClient
+    SOURCES
+        components/TestAppTCPClient/TestAppTCPClient.c
+        util/non_blocking_helper.c
+        util/socket_io.c
+    C_FLAGS
+        -Wall
+        -Werror
+        -DNB_HELPER_PERSISTENT_SUBSCRIPTION=${NB_HELPER_PERSISTENT_SUBSCRIPTION}
+        -DOS_NETWORK_MAXIMUM_SOCKET_NO=256
+        -DDEV_ADDR="${DEV_ADDR}"
+        -DGATEWAY_ADDR="${GATEWAY_ADDR}"
+        -DSUBNET_MASK="${SUBNET_MASK}"
+    LIBS
+        system_config
+        os_core_api
+        lib_compiler
+        lib_debug
+        lib_macros
+        os_socket_client
+        syslogger_client
+        TimeServer_client
+)
+
+DeclareCAmkESComponent_SysLogger(
+    SysLogger
+    system_config
+)
@@ -16,7 +16,7 @@ NetworkStack_PicoTcp_DeclareCAmkESComponent(
         -DNetworkStack_PicoTcp_USE_HARDCODED_IPADDR
         -DDEV_ADDR="${DEV_ADDR}"
         -DGATEWAY_ADDR="${GATEWAY_ADDR}"
-        -DSUBNET_MASK="${SUBNET_MASK}"{{
+        -DSUBNET_MASK="${SUBNET_MASK}"
 )
 
 DeclareCAmkESComponent(
@@ -24,9 +24,11 @@ DeclareCAmkESComponent(
     SOURCES
         components/TestAppTCPClient/TestAppTCPClient.c
         util/non_blocking_helper.c
+        util/socket_io.c
     C_FLAGS
         -Wall
         -Werror
+        -DNB_HELPER_PERSISTENT_SUBSCRIPTION=${NB_HELPER_PERSISTENT_SUBSCRIPTION}
         -DOS_NETWORK_MAXIMUM_SOCKET_NO=16
         -DTCP_CLIENT_MULTIPLE_CLIENTS
         -DDEV_ADDR="${DEV_ADDR}"
@@ -44,6 +46,7 @@ DeclareCAmkESComponent(
         lib_macros
         os_socket_client
         syslogger_client
+        TimeServer_client
 )
 
 DeclareCAmkESComponent_SysLogger(
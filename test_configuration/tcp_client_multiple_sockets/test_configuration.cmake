@@ -24,14 +24,15 @@ DeclareCAmkESComponent(
     SOURCES
         components/TestAppTCPClient/TestAppTCPClient.c
         util/non_blocking_helper.c
+        util/socket_io.c
     C_FLAGS
         -Wall
         -Werror
+        -DNB_HELPER_PERSISTENT_SUBSCRIPTION=${NB_HELPER_PERSISTENT_SUBSCRIPTION}
         -DOS_NETWORK_MAXIMUM_SOCKET_NO=8
         -DDEV_ADDR="${DEV_ADDR}"
         -DGATEWAY_ADDR="${GATEWAY_ADDR}"
         -DSUBNET_MASK="${SUBNET_MASK}"
-        {
     LIBS
         system_config
         os_core_api
@@ -40,6 +41,7 @@ DeclareCAmkESComponent(
         lib_macros
         os_socket_client
         syslogger_client
+        TimeServer_client
 )
 
 DeclareCAmkESComponent_SysLogger(
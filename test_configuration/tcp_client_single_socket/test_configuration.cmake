@@ -24,9 +24,11 @@ DeclareCAmkESComponent(
     SOURCES
         components/TestAppTCPClient/TestAppTCPClient.c
         util/non_blocking_helper.c
+        util/socket_io.c
     C_FLAGS
         -Wall
         -Werror
+        -DNB_HELPER_PERSISTENT_SUBSCRIPTION=${NB_HELPER_PERSISTENT_SUBSCRIPTION}
         -DOS_NETWORK_MAXIMUM_SOCKET_NO=1
         -DTCP_CLIENT
         -DDEV_ADDR="${DEV_ADDR}"
@@ -44,6 +46,7 @@ DeclareCAmkESComponent(
         lib_macros
         os_socket_client
         syslogger_client
+        TimeServer_client
 )
 
 DeclareCAmkESComponent_SysLogger(
@@ -37,6 +37,9 @@ DeclareCAmkESComponent(
     SOURCES
         components/TestAppTCPServer/TestAppTCPServer.c
         util/non_blocking_helper.c
+        util/pt_sched.c
+        util/socket_io.c
+        util/worker_pool.c
     C_FLAGS
         -Wall
         -Werror
@@ -48,6 +51,7 @@ DeclareCAmkESComponent(
         lib_macros
         os_socket_client
         syslogger_client
+        TimeServer_client
 )
 
 DeclareCAmkESComponent_SysLogger(
@@ -24,6 +24,7 @@ DeclareCAmkESComponent(
     SOURCES
         components/TestAppUDPServer/TestAppUDPServer.c
         util/non_blocking_helper.c
+        util/socket_io.c
     C_FLAGS
         -Wall
         -Werror
@@ -38,6 +39,7 @@ DeclareCAmkESComponent(
         lib_macros
         os_socket_client
         syslogger_client
+        TimeServer_client
 )
 
 DeclareCAmkESComponent_SysLogger(
@@ -8,10 +8,16 @@
  * For commercial licensing, contact: info.cyber@hensoldt.net
  */
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <limits.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <camkes.h>
 
+#include "TimeServer.h"
+
 #include "OS_Error.h"
 #include "OS_Socket.h"
 #include "OS_Types.h"
@@ -24,302 +30,2220 @@
 #include "non_blocking_helper.h"
 #include "system_config.h"
 
-//------------------------------------------------------------------------------
-typedef struct
-{
-    event_notify_func_t notify_about_new_events;
-    event_wait_func_t   wait_on_new_events;
-    mutex_lock_func_t   shared_resource_lock;
-    mutex_unlock_func_t shared_resource_unlock;
-} nh_helper_sync_func;
-
-static OS_Socket_Evt_t eventCollection[OS_NETWORK_MAXIMUM_SOCKET_NO] = {0};
+#define READY_LIST_EMPTY    (-1)
+// Position of a socket that is not part of a poll set.
+#define POLL_INDEX_NONE     SIZE_MAX
 
-static nh_helper_sync_func sync_func;
+_Static_assert(sizeof(nb_helper_ev_slot_t) == NB_HELPER_CACHE_LINE_SIZE,
+               "event table entry does not fill exactly one cache line");
 
 //------------------------------------------------------------------------------
-OS_Error_t
-nb_helper_init(
-    void (*event_notify_func_t)(void),
-    void (*event_wait_func_t)(void),
-    int (*mutex_lock_func_t)(void),
-    int (*mutex_unlock_func_t)(void))
+static inline void
+stats_inc(
+    _Atomic uint32_t* const counter)
 {
-    CHECK_PTR_NOT_NULL(event_notify_func_t);
-    CHECK_PTR_NOT_NULL(event_wait_func_t);
-    CHECK_PTR_NOT_NULL(mutex_lock_func_t);
-    CHECK_PTR_NOT_NULL(mutex_unlock_func_t);
-
-    sync_func.notify_about_new_events = event_notify_func_t;
-    sync_func.wait_on_new_events = event_wait_func_t;
-    sync_func.shared_resource_lock = mutex_lock_func_t;
-    sync_func.shared_resource_unlock = mutex_unlock_func_t;
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
 
-    return OS_SUCCESS;
+static inline void
+stats_add(
+    _Atomic uint32_t* const counter,
+    const uint32_t value)
+{
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
 }
 
+static inline size_t
+get_wait_slot_idx(
+    nb_helper_t* const nbh,
+    nb_helper_ev_slot_t* const evSlot,
+    const int handleID)
+{
+    Debug_ASSERT(nbh->num_wait_slots > 0);
 
-void
-nb_helper_collect_pending_ev_handler(
-    void* ctx)
+    const uint8_t slot = atomic_load(&evSlot->waitSlot);
+    return (slot < nbh->num_wait_slots) ? slot : handleID % nbh->num_wait_slots;
+}
+
+// Allocates a chunk of the event table with all entries reset.
+static nb_helper_ev_slot_t*
+alloc_ev_chunk(void)
 {
-    Debug_ASSERT(NULL != ctx);
+    nb_helper_ev_slot_t* chunk =
+        aligned_alloc(NB_HELPER_CACHE_LINE_SIZE,
+                      NB_HELPER_EV_TABLE_CHUNK_SIZE * sizeof(*chunk));
+    if (NULL == chunk)
+    {
+        return NULL;
+    }
 
-    OS_Socket_Evt_t eventBuffer[OS_NETWORK_MAXIMUM_SOCKET_NO] = {0};
-    int numberOfSocketsWithEvents = 0;
+    for (size_t i = 0; i < NB_HELPER_EV_TABLE_CHUNK_SIZE; i++)
+    {
+        nb_helper_ev_slot_t* evSlot = &chunk[i];
 
-    size_t bufferSize = sizeof(eventBuffer);
+        atomic_init(&evSlot->eventMask, 0);
+        atomic_init(&evSlot->parentSocketHandle, 0);
+        atomic_init(&evSlot->currentError, OS_SUCCESS);
+        atomic_init(&evSlot->waiters, 0);
+        atomic_init(&evSlot->pollIndex, POLL_INDEX_NONE);
+        atomic_init(&evSlot->next, READY_LIST_EMPTY);
+        atomic_init(&evSlot->queued, false);
+        atomic_init(&evSlot->generation, 0);
+        atomic_init(&evSlot->priority, NB_HELPER_PRIO_NORMAL);
+        atomic_init(&evSlot->deferRounds, 0);
+        atomic_init(&evSlot->waitSlot, NB_HELPER_MAX_WAIT_SLOTS);
+    }
 
-    OS_Error_t err = OS_Socket_getPendingEvents(
-                         ctx,
-                         eventBuffer,
-                         bufferSize,
-                         &numberOfSocketsWithEvents);
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+    return chunk;
+}
+
+// Returns the event table entry of a socket, allocating the chunk holding it on
+// first use. Chunks are only freed by nb_helper_deinit(), so the returned entry
+// stays valid. Returns NULL if there is no memory left.
+static nb_helper_ev_slot_t*
+get_ev_slot(
+    nb_helper_t* const nbh,
+    const int handleID)
+{
+    Debug_ASSERT((handleID >= 0) && ((size_t) handleID < nbh->maxSockets));
 
-    // Verify that the received number of sockets with events is within expected
-    // bounds.
-    ASSERT_LE_INT(numberOfSocketsWithEvents, OS_NETWORK_MAXIMUM_SOCKET_NO);
-    ASSERT_GT_INT(numberOfSocketsWithEvents, -1);
+    _Atomic(nb_helper_ev_slot_t*)* dirEntry =
+        &nbh->evTable[handleID / NB_HELPER_EV_TABLE_CHUNK_SIZE];
+    nb_helper_ev_slot_t* chunk = atomic_load(dirEntry);
 
-    for (int i = 0; i < numberOfSocketsWithEvents; i++)
+    if (NULL == chunk)
     {
-        OS_Socket_Evt_t event;
-        memcpy(&event, &eventBuffer[i], sizeof(event));
-
-        if (event.socketHandle >= 0
-            && event.socketHandle < OS_NETWORK_MAXIMUM_SOCKET_NO)
+        nb_helper_ev_slot_t* newChunk = alloc_ev_chunk();
+        if (NULL == newChunk)
         {
-            Debug_ASSERT(NULL != sync_func.shared_resource_lock);
-            sync_func.shared_resource_lock();
-
-            eventCollection[event.socketHandle].socketHandle = event.socketHandle;
-            eventCollection[event.socketHandle].parentSocketHandle =
-                event.parentSocketHandle;
-            eventCollection[event.socketHandle].eventMask |= event.eventMask;
-            eventCollection[event.socketHandle].currentError = event.currentError;
+            Debug_LOG_ERROR("No memory for the event table of socket %d",
+                            handleID);
+            return NULL;
+        }
 
-            Debug_ASSERT(NULL != sync_func.shared_resource_unlock);
-            sync_func.shared_resource_unlock();
+        // Another thread may have installed the chunk in the meantime, then
+        // that one is used. On failure chunk is set to the installed one.
+        if (atomic_compare_exchange_strong(dirEntry, &chunk, newChunk))
+        {
+            chunk = newChunk;
+            atomic_fetch_add(&nbh->evTableChunks, 1);
         }
         else
         {
-            Debug_LOG_ERROR("Found invalid socket handle %d for event %d",
-                            event.socketHandle, i);
+            free(newChunk);
         }
     }
 
-    // Unblock any caller of the functions below waiting for new events to
-    // arrive.
-    if (numberOfSocketsWithEvents)
+    return &chunk[handleID % NB_HELPER_EV_TABLE_CHUNK_SIZE];
+}
+
+// Returns the entry of a socket that is known to be allocated already, i.e. it
+// is on a ready list or has a registered waiter.
+static inline nb_helper_ev_slot_t*
+ev_slot(
+    nb_helper_t* const nbh,
+    const int handleID)
+{
+    nb_helper_ev_slot_t* chunk =
+        atomic_load(&nbh->evTable[handleID / NB_HELPER_EV_TABLE_CHUNK_SIZE]);
+    Debug_ASSERT(NULL != chunk);
+
+    return &chunk[handleID % NB_HELPER_EV_TABLE_CHUNK_SIZE];
+}
+
+//------------------------------------------------------------------------------
+// The wait state of a slot packs the number of the current round, how many
+// threads are blocked on the notification of the slot and how many of them
+// have been blocked since before the round started. A notification of the slot
+// starts a new round, every thread blocked on it has to look at the event table
+// again. The thread it wakes up passes it on as long as one of those is still
+// blocked, so one notification reaches all of them. A thread does not block if
+// a round started after it read the round number, see slot_block().
+#define WAIT_STATE_BLOCKED(_state_)  ((uint32_t) ((_state_) & 0xffff))
+#define WAIT_STATE_LAGGING(_state_)  ((uint32_t) (((_state_) >> 16) & 0xffff))
+#define WAIT_STATE_ROUND(_state_)    ((uint32_t) ((_state_) >> 32))
+#define WAIT_STATE(_round_, _lagging_, _blocked_) \
+    (((uint64_t) (_round_) << 32) | ((uint64_t) (_lagging_) << 16) \
+     | (_blocked_))
+
+// Returns the current round of the slot, to be read before looking at the
+// event table.
+static inline uint32_t
+slot_round(
+    nb_helper_t* const nbh,
+    const size_t slotIdx)
+{
+    return WAIT_STATE_ROUND(atomic_load(&nbh->slotState[slotIdx].waitState));
+}
+
+static inline void
+slot_signal(
+    nb_helper_t* const nbh,
+    const size_t slotIdx)
+{
+    Debug_ASSERT(NULL != nbh->wait_slots[slotIdx].notify);
+    nbh->wait_slots[slotIdx].notify();
+}
+
+// Starts a new round, every thread blocked on the slot has to look at the
+// event table again.
+static void
+slot_new_round(
+    nb_helper_t* const nbh,
+    const size_t slotIdx)
+{
+    _Atomic uint64_t* waitState = &nbh->slotState[slotIdx].waitState;
+    uint64_t state = atomic_load(waitState);
+
+    while (!atomic_compare_exchange_weak(
+               waitState,
+               &state,
+               WAIT_STATE(WAIT_STATE_ROUND(state) + 1,
+                          WAIT_STATE_BLOCKED(state),
+                          WAIT_STATE_BLOCKED(state))))
     {
-        Debug_ASSERT(NULL != sync_func.notify_about_new_events);
-        sync_func.notify_about_new_events();
+        // state has been updated to the current one.
     }
+}
 
-    // Re-register the callback function.
-    err = OS_Socket_regCallback(
-              ctx,
-              &nb_helper_collect_pending_ev_handler,
-              ctx);
-    if (err != OS_SUCCESS)
+// Passes on a notification of the slot taken by the calling thread, as long as
+// a thread blocked since before the current round may not have got one.
+static void
+slot_pass_on(
+    nb_helper_t* const nbh,
+    const size_t slotIdx)
+{
+    if (WAIT_STATE_LAGGING(atomic_load(&nbh->slotState[slotIdx].waitState)) > 0)
     {
-        Debug_LOG_ERROR(
-            "OS_Socket_regCallback() failed, code %d", err);
+        slot_signal(nbh, slotIdx);
+        stats_inc(&nbh->stats.passedNotifications);
     }
-    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 }
 
-//------------------------------------------------------------------------------
-OS_Error_t
-nb_helper_wait_for_network_stack_init(
-    const if_OS_Socket_t* const ctx)
+// Blocks the calling thread on the notification of the slot, unless a new
+// round started after it read round.
+static void
+slot_block(
+    nb_helper_t* const nbh,
+    const size_t slotIdx,
+    const uint32_t round)
 {
-    OS_NetworkStack_State_t networkStackState;
+    _Atomic uint64_t* waitState = &nbh->slotState[slotIdx].waitState;
+    uint64_t state = atomic_load(waitState);
 
     do
     {
-        networkStackState = OS_Socket_getStatus(ctx);
-        if (networkStackState == UNINITIALIZED || networkStackState == INITIALIZED)
+        if (WAIT_STATE_ROUND(state) != round)
         {
-            // just yield to wait until the stack is up and running
-            seL4_Yield();
+            return;
         }
-        if (networkStackState == FATAL_ERROR)
+    }
+    while (!atomic_compare_exchange_weak(
+               waitState,
+               &state,
+               WAIT_STATE(round,
+                          WAIT_STATE_LAGGING(state),
+                          WAIT_STATE_BLOCKED(state) + 1)));
+
+    Debug_ASSERT(NULL != nbh->wait_slots[slotIdx].wait);
+    nbh->wait_slots[slotIdx].wait();
+
+    // We were lagging if a round started while we were blocked.
+    state = atomic_load(waitState);
+    uint32_t lagged;
+    do
+    {
+        lagged = (WAIT_STATE_ROUND(state) != round) ? 1 : 0;
+    }
+    while (!atomic_compare_exchange_weak(
+               waitState,
+               &state,
+               WAIT_STATE(WAIT_STATE_ROUND(state),
+                          WAIT_STATE_LAGGING(state) - lagged,
+                          WAIT_STATE_BLOCKED(state) - 1)));
+
+    slot_pass_on(nbh, slotIdx);
+}
+
+static void
+start_wait_slot_rounds(
+    nb_helper_t* const nbh,
+    const unsigned int slots)
+{
+    for (size_t slot = 0; slot < nbh->num_wait_slots; slot++)
+    {
+        if (slots & (1U << slot))
         {
-            // NetworkStack will not come up.
-            Debug_LOG_ERROR("A FATAL_ERROR occurred in the Network Stack component.")
-            return OS_ERROR_ABORTED;
+            slot_new_round(nbh, slot);
         }
     }
-    while (networkStackState != RUNNING);
+}
 
-    return OS_SUCCESS;
+static void
+signal_wait_slots(
+    nb_helper_t* const nbh,
+    const unsigned int slots)
+{
+    for (size_t slot = 0; slot < nbh->num_wait_slots; slot++)
+    {
+        if (slots & (1U << slot))
+        {
+            slot_signal(nbh, slot);
+            stats_inc(&nbh->stats.notifications);
+        }
+    }
 }
 
-//------------------------------------------------------------------------------
-OS_Error_t
-nb_helper_wait_for_read_ev_on_socket(
-    const OS_Socket_Handle_t handle)
+static void
+notify_wait_slots(
+    nb_helper_t* const nbh,
+    const unsigned int slotsToNotify)
 {
-    CHECK_VALUE_IN_RANGE(handle.handleID, 0, OS_NETWORK_MAXIMUM_SOCKET_NO);
+    start_wait_slot_rounds(nbh, slotsToNotify);
+    signal_wait_slots(nbh, slotsToNotify);
+}
 
-    OS_Error_t err;
-    uint8_t eventMask = 0;
-    bool foundRelevantEvent = false;
+// Like signal_wait_slots(), but the calling thread waits on slotIdx and looks
+// at the event table again itself. Its slot is only signalled for the threads
+// blocked on it since before the round started.
+static void
+signal_other_wait_slots(
+    nb_helper_t* const nbh,
+    const unsigned int slots,
+    const size_t slotIdx)
+{
+    unsigned int slotsToSignal = slots & ~(1U << slotIdx);
 
-    do
+    if ((slots & (1U << slotIdx))
+        && (WAIT_STATE_LAGGING(
+                atomic_load(&nbh->slotState[slotIdx].waitState)) > 0))
     {
-        Debug_ASSERT(NULL != sync_func.shared_resource_lock);
-        sync_func.shared_resource_lock();
+        slotsToSignal |= 1U << slotIdx;
+    }
 
-        eventMask = eventCollection[handle.handleID].eventMask;
-        err = eventCollection[handle.handleID].currentError;
+    signal_wait_slots(nbh, slotsToSignal);
+}
 
-        Debug_ASSERT(NULL != sync_func.shared_resource_unlock);
-        sync_func.shared_resource_unlock();
+static void
+notify_other_wait_slots(
+    nb_helper_t* const nbh,
+    const unsigned int slotsToNotify,
+    const size_t slotIdx)
+{
+    start_wait_slot_rounds(nbh, slotsToNotify);
+    signal_other_wait_slots(nbh, slotsToNotify, slotIdx);
+}
 
-        if ((eventMask & OS_SOCK_EV_READ || eventMask & OS_SOCK_EV_CLOSE
-             || eventMask & OS_SOCK_EV_ERROR || eventMask & OS_SOCK_EV_FIN))
-        {
-            foundRelevantEvent = true;
-        }
-        else
-        {
-            // Wait for the arrival of new events.
-            Debug_ASSERT(NULL != sync_func.wait_on_new_events);
-            sync_func.wait_on_new_events();
-        }
+static void
+ready_list_requeue(
+    nb_helper_t* const nbh,
+    const size_t slotIdx);
+
+// Puts a socket on the ready list of its wait slot unless it is already on a
+// ready list.
+static void
+ready_list_push(
+    nb_helper_t* const nbh,
+    const int handleID)
+{
+    nb_helper_ev_slot_t* evSlot = ev_slot(nbh, handleID);
+
+    if (atomic_exchange(&evSlot->queued, true))
+    {
+        return;
     }
-    while (!foundRelevantEvent);
 
-    if (eventMask & OS_SOCK_EV_READ)
+    const size_t slotIdx = get_wait_slot_idx(nbh, evSlot, handleID);
+    _Atomic int* listHead = &nbh->slotState[slotIdx].readyListHead;
+
+    int head = atomic_load(listHead);
+    do
     {
-        eventCollection[handle.handleID].eventMask &= ~OS_SOCK_EV_READ;
-        return OS_SUCCESS;
+        atomic_store_explicit(&evSlot->next, head, memory_order_relaxed);
     }
-    else if (eventMask & OS_SOCK_EV_CLOSE)
+    while (!atomic_compare_exchange_weak(listHead, &head, handleID));
+
+    // The socket was moved to another slot meanwhile. Either this sees the
+    // new slot or move_to_wait_slot() sees the socket on the list, both are
+    // sequentially consistent.
+    if (get_wait_slot_idx(nbh, evSlot, handleID) != slotIdx)
     {
-        eventCollection[handle.handleID].eventMask = 0;
-        return OS_ERROR_NETWORK_CONN_SHUTDOWN;
+        ready_list_requeue(nbh, slotIdx);
     }
-    else
+}
+
+// Takes all entries off the ready list of a wait slot and returns them oldest
+// first.
+static int
+ready_list_take_all(
+    nb_helper_t* const nbh,
+    const size_t slotIdx)
+{
+    int head = atomic_exchange(&nbh->slotState[slotIdx].readyListHead,
+                               READY_LIST_EMPTY);
+    int reversed = READY_LIST_EMPTY;
+
+    while (head != READY_LIST_EMPTY)
     {
-        eventCollection[handle.handleID].eventMask &= ~OS_SOCK_EV_ERROR;
-        return err;
+        const int next = atomic_load_explicit(
+                             &ev_slot(nbh, head)->next,
+                             memory_order_relaxed);
+        atomic_store_explicit(
+            &ev_slot(nbh, head)->next,
+            reversed,
+            memory_order_relaxed);
+        reversed = head;
+        head = next;
     }
+
+    return reversed;
 }
 
-//------------------------------------------------------------------------------
-OS_Error_t
-nb_helper_wait_for_conn_est_ev_on_socket(
-    const OS_Socket_Handle_t handle)
+// Takes the ready list of a wait slot and puts the sockets on the lists of the
+// slots they use now, after one of them was moved to another slot. Other
+// consumers only ever take whole lists, so this can run alongside the thread
+// waiting on the slot. It may have found the list empty meanwhile, so the
+// slots that got sockets are notified.
+static void
+ready_list_requeue(
+    nb_helper_t* const nbh,
+    const size_t slotIdx)
 {
-    CHECK_VALUE_IN_RANGE(handle.handleID, 0, OS_NETWORK_MAXIMUM_SOCKET_NO);
+    int handleID = ready_list_take_all(nbh, slotIdx);
+    unsigned int slotsToNotify = 0;
 
-    OS_Error_t err;
-    uint8_t eventMask = 0;
-    bool foundRelevantEvent = false;
+    while (handleID != READY_LIST_EMPTY)
+    {
+        nb_helper_ev_slot_t* evSlot = ev_slot(nbh, handleID);
+        const int next = atomic_load_explicit(&evSlot->next,
+                                              memory_order_relaxed);
+
+        atomic_store(&evSlot->queued, false);
+        ready_list_push(nbh, handleID);
+
+        const size_t slot = get_wait_slot_idx(nbh, evSlot, handleID);
+        if (atomic_load(&nbh->slotState[slot].waiters) > 0)
+        {
+            slotsToNotify |= 1U << slot;
+        }
+
+        handleID = next;
+    }
+
+    notify_wait_slots(nbh, slotsToNotify);
+}
+
+// Moves a socket to another wait slot, NB_HELPER_MAX_WAIT_SLOTS moves it back
+// to the slot of its handle. If it is on the ready list of its old slot, it
+// is put on the one of the new slot.
+static void
+move_to_wait_slot(
+    nb_helper_t* const nbh,
+    nb_helper_ev_slot_t* const evSlot,
+    const int handleID,
+    const uint8_t newSlot)
+{
+    const size_t oldIdx = get_wait_slot_idx(nbh, evSlot, handleID);
+
+    atomic_store(&evSlot->waitSlot, newSlot);
+
+    if (get_wait_slot_idx(nbh, evSlot, handleID) != oldIdx)
+    {
+        ready_list_requeue(nbh, oldIdx);
+    }
+}
 
+// Fetches the pending events from the network stack and merges them into the
+// event table. Returns the wait slots that have a thread waiting on one of the
+// sockets that received an event.
+static unsigned int
+collect_pending_events(
+    nb_helper_t* const nbh)
+{
+    const if_OS_Socket_t* ctx = nbh->ctx;
+    int numberOfSocketsWithEvents = 0;
+    int totalEvents = 0;
+
+    // The events are merged straight from the dataport instead of copying
+    // them into a local buffer first. The dataport is shared with all other
+    // socket calls of this component, so hold its mutex until we are done.
+    size_t maxEvents = OS_Dataport_getSize(ctx->dataport)
+                       / sizeof(OS_Socket_Evt_t);
+    if (maxEvents > nbh->maxSockets)
+    {
+        maxEvents = nbh->maxSockets;
+    }
+    Debug_ASSERT(maxEvents > 0);
+    const size_t bufferSize = maxEvents * sizeof(OS_Socket_Evt_t);
+
+    // Wait slots with a thread blocked on a socket that received an event.
+    unsigned int slotsToNotify = 0;
+
+    Debug_ASSERT(NULL != ctx->shared_resource_mutex_lock);
+    ctx->shared_resource_mutex_lock();
+
+    // With more sockets than events fitting into the dataport, a full buffer
+    // means there may be more events pending.
     do
     {
-        Debug_ASSERT(NULL != sync_func.shared_resource_lock);
-        sync_func.shared_resource_lock();
+        OS_Error_t err = ctx->socket_getPendingEvents(
+                             bufferSize,
+                             &numberOfSocketsWithEvents);
+        if (err != OS_SUCCESS)
+        {
+            ctx->shared_resource_mutex_unlock();
+        }
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
 
-        eventMask = eventCollection[handle.handleID].eventMask;
-        err = eventCollection[handle.handleID].currentError;
+        stats_inc(&nbh->stats.pendingEventsRpcs);
 
-        Debug_ASSERT(NULL != sync_func.shared_resource_unlock);
-        sync_func.shared_resource_unlock();
+        // Verify that the received number of sockets with events is within
+        // expected bounds.
+        ASSERT_LE_INT(numberOfSocketsWithEvents, (int) maxEvents);
+        ASSERT_GT_INT(numberOfSocketsWithEvents, -1);
 
-        if ((eventMask & OS_SOCK_EV_CONN_EST || eventMask & OS_SOCK_EV_ERROR
-             || eventMask & OS_SOCK_EV_FIN))
+        const OS_Socket_Evt_t* events = OS_Dataport_getBuf(ctx->dataport);
+
+        for (int i = 0; i < numberOfSocketsWithEvents; i++)
         {
-            foundRelevantEvent = true;
+            const OS_Socket_Evt_t* event = &events[i];
+            const int socketHandle = event->socketHandle;
+            nb_helper_ev_slot_t* evSlot = NULL;
+
+            if (socketHandle >= 0
+                && (size_t) socketHandle < nbh->maxSockets)
+            {
+                evSlot = get_ev_slot(nbh, socketHandle);
+            }
+            else
+            {
+                Debug_LOG_ERROR("Found invalid socket handle %d for event %d",
+                                socketHandle, i);
+            }
+            if (NULL == evSlot)
+            {
+                continue;
+            }
+            if (atomic_load(&evSlot->generation) & 1)
+            {
+                // Left over from the socket being closed.
+                stats_inc(&nbh->stats.staleEvents);
+                continue;
+            }
+
+            atomic_store_explicit(
+                &evSlot->parentSocketHandle,
+                event->parentSocketHandle,
+                memory_order_relaxed);
+            atomic_store_explicit(
+                &evSlot->currentError,
+                event->currentError,
+                memory_order_relaxed);
+            atomic_fetch_or(&evSlot->eventMask, event->eventMask);
+
+            // Only a poll set ever takes sockets off the ready list, a socket
+            // waited on alone would stay queued. Either this sees the socket
+            // in a set or nb_helper_poll_set_add() sees the events.
+            if (atomic_load(&evSlot->pollIndex) != POLL_INDEX_NONE)
+            {
+                ready_list_push(nbh, socketHandle);
+            }
+
+            // A socket stays registered with a poll set between the waits on
+            // it, so only notify if a thread is actually waiting on the slot.
+            const size_t slotIdx =
+                get_wait_slot_idx(nbh, evSlot, socketHandle);
+            if ((atomic_load(&evSlot->waiters) > 0)
+                && (atomic_load(&nbh->slotState[slotIdx].waiters) > 0))
+            {
+                slotsToNotify |= 1U << slotIdx;
+            }
+
+            stats_inc(&nbh->stats.eventsDelivered);
         }
-        else
+
+        totalEvents += numberOfSocketsWithEvents;
+    }
+    while ((size_t) numberOfSocketsWithEvents == maxEvents);
+
+    Debug_ASSERT(NULL != ctx->shared_resource_mutex_unlock);
+    ctx->shared_resource_mutex_unlock();
+
+    if (totalEvents)
+    {
+        stats_inc(&nbh->stats.eventBatches);
+    }
+
+    return slotsToNotify;
+}
+
+// Collects the pending events after the event notification of the network
+// stack was received by the thread holding drainerActive, then gives up the
+// flag and notifies the wait slots with something to do.
+static void
+drain_events(
+    nb_helper_t* const nbh,
+    const size_t slotIdx)
+{
+    const unsigned int slotsWithEvents = collect_pending_events(nbh);
+
+    // Start the rounds before giving up the flag, a thread taking it over must
+    // not block on the network stack before looking at the events of its
+    // slot, see wait_for_new_events().
+    start_wait_slot_rounds(nbh, slotsWithEvents);
+    atomic_flag_clear(&nbh->drainerActive);
+
+    // Hand over collecting the events to a thread of another slot, in case we
+    // are done waiting now.
+    unsigned int slotsToSignal = slotsWithEvents;
+    for (size_t slot = 0; slot < nbh->num_wait_slots; slot++)
+    {
+        if ((slot != slotIdx)
+            && (atomic_load(&nbh->slotState[slot].waiters) > 0))
         {
-            // Wait for the arrival of new events.
-            Debug_ASSERT(NULL != sync_func.wait_on_new_events);
-            sync_func.wait_on_new_events();
+            slotsToSignal |= 1U << slot;
+            break;
         }
     }
-    while (!foundRelevantEvent);
 
-    if (eventMask & OS_SOCK_EV_CONN_EST)
+    signal_other_wait_slots(nbh, slotsToSignal, slotIdx);
+}
+
+// Collects the events pending at the network stack without blocking, unless
+// the subscription is not persistent or another thread is collecting them
+// already. Returns true if there were any.
+static bool
+poll_new_events(
+    nb_helper_t* const nbh,
+    const size_t slotIdx)
+{
+    const if_OS_Socket_t* ctx = nbh->persistent ? nbh->ctx : NULL;
+
+    if ((NULL == ctx) || atomic_flag_test_and_set(&nbh->drainerActive))
     {
-        eventCollection[handle.handleID].eventMask &= ~OS_SOCK_EV_CONN_EST;
-        return OS_SUCCESS;
+        return false;
     }
-    else
+
+    if (OS_Socket_poll(ctx) == OS_SUCCESS)
     {
-        eventCollection[handle.handleID].eventMask &= ~OS_SOCK_EV_ERROR;
-        return err;
+        drain_events(nbh, slotIdx);
+        return true;
     }
+
+    atomic_flag_clear(&nbh->drainerActive);
+    return false;
 }
 
-//------------------------------------------------------------------------------
-OS_Error_t
-nb_helper_wait_for_conn_acpt_ev_on_socket(
-    const OS_Socket_Handle_t handle)
+// Polls for new events up to the spin budget of the wait slot and adapts the
+// budget to the outcome. With drainCtx set, the calling thread holds
+// drainerActive and polls the event notification of the network stack,
+// otherwise the notification of its wait slot. Returns true if the polled
+// notification was received, it is consumed then.
+static bool
+spin_for_new_events(
+    nb_helper_t* const nbh,
+    const size_t slotIdx,
+    const if_OS_Socket_t* const drainCtx)
 {
-    CHECK_VALUE_IN_RANGE(handle.handleID, 0, OS_NETWORK_MAXIMUM_SOCKET_NO);
+    const event_poll_func_t poll = nbh->wait_slots[slotIdx].poll;
 
-    OS_Error_t err;
-    uint8_t eventMask = 0;
-    bool foundRelevantEvent = false;
+    if ((0 == nbh->maxSpins) || ((NULL == drainCtx) && (NULL == poll)))
+    {
+        return false;
+    }
 
-    do
+    // Threads sharing the slot may race on its budget, it is only a hint.
+    const uint32_t budget = atomic_load_explicit(
+                                &nbh->slotState[slotIdx].spinBudget,
+                                memory_order_relaxed);
+    const uint32_t minBudget = (nbh->maxSpins < NB_HELPER_SPIN_BUDGET_MIN) ?
+                               nbh->maxSpins : NB_HELPER_SPIN_BUDGET_MIN;
+    bool hit = false;
+    uint32_t polls = 0;
+
+    stats_inc(&nbh->stats.spinWaits);
+
+    while (!hit && (polls < budget))
+    {
+        polls++;
+        hit = (NULL != drainCtx) ?
+              (OS_Socket_poll(drainCtx) == OS_SUCCESS) :
+              (poll() != 0);
+        if (!hit)
+        {
+            // Let the thread delivering the event run, if it shares the core.
+            seL4_Yield();
+        }
+    }
+
+    stats_add(&nbh->stats.spinPolls, polls);
+
+    uint32_t newBudget;
+    if (hit)
+    {
+        stats_inc(&nbh->stats.spinHits);
+        newBudget = (budget > nbh->maxSpins / 2) ? nbh->maxSpins : budget * 2;
+    }
+    else
     {
-        Debug_ASSERT(NULL != sync_func.shared_resource_lock);
-        sync_func.shared_resource_lock();
+        newBudget = (budget / 2 < minBudget) ? minBudget : budget / 2;
+    }
+    atomic_store_explicit(&nbh->slotState[slotIdx].spinBudget, newBudget,
+                          memory_order_relaxed);
 
-        eventMask = eventCollection[handle.handleID].eventMask;
-        err = eventCollection[handle.handleID].currentError;
+    return hit;
+}
 
-        Debug_ASSERT(NULL != sync_func.shared_resource_unlock);
-        sync_func.shared_resource_unlock();
+// Blocks the calling thread of the given wait slot until new events may have
+// arrived. With a persistent subscription one of the waiting threads blocks on
+// the event notification of the network stack and collects the events for all
+// others. Events arriving while nobody is blocked on the notification are
+// coalesced by the notification and collected by the next wait. round is the
+// one read before looking at the event table, see slot_round().
+static void
+wait_for_new_events(
+    nb_helper_t* const nbh,
+    const size_t   slotIdx,
+    const uint32_t round)
+{
+    const if_OS_Socket_t* ctx = nbh->persistent ? nbh->ctx : NULL;
 
-        if ((eventMask & OS_SOCK_EV_CONN_ACPT || eventMask & OS_SOCK_EV_ERROR
-             || eventMask & OS_SOCK_EV_FIN))
+    if ((NULL == ctx) || atomic_flag_test_and_set(&nbh->drainerActive))
+    {
+        // Wait until the callback or the thread collecting the events
+        // notifies us.
+        if (spin_for_new_events(nbh, slotIdx, NULL))
         {
-            foundRelevantEvent = true;
+            slot_pass_on(nbh, slotIdx);
         }
         else
         {
-            // Wait for the arrival of new events.
-            Debug_ASSERT(NULL != sync_func.wait_on_new_events);
-            sync_func.wait_on_new_events();
+            slot_block(nbh, slotIdx, round);
         }
+        return;
     }
-    while (!foundRelevantEvent);
 
-    if (eventMask & OS_SOCK_EV_CONN_ACPT)
+    if (!spin_for_new_events(nbh, slotIdx, ctx))
     {
-        eventCollection[handle.handleID].eventMask &= ~OS_SOCK_EV_CONN_ACPT;
-        return OS_SUCCESS;
+        // The thread that collected the events before may have started a
+        // round on our slot we have not looked at yet.
+        if (slot_round(nbh, slotIdx) != round)
+        {
+            atomic_flag_clear(&nbh->drainerActive);
+            return;
+        }
+
+        OS_Error_t err = OS_Socket_wait(ctx);
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
     }
-    else
+
+    drain_events(nbh, slotIdx);
+}
+
+// Callback collecting the events for a thread that waits with a deadline
+// instead of blocking on the event notification of the network stack, see
+// wait_for_new_events_or_deadline().
+static void
+drain_events_handler(
+    void* ctx)
+{
+    nb_helper_t* nbh = ctx;
+    Debug_ASSERT(NULL != nbh);
+
+    // Not called for a slot, hands over to any slot with waiters.
+    drain_events(nbh, NB_HELPER_MAX_WAIT_SLOTS);
+}
+
+// Like wait_for_new_events(), but the deadline timer is armed and wakes up the
+// thread through its wait slot. A thread can block on one notification only,
+// so the one collecting the events of a persistent subscription can't block on
+// the event notification of the network stack. It registers a callback for the
+// next notification instead, which keeps drainerActive until it has collected
+// the events.
+static void
+wait_for_new_events_or_deadline(
+    nb_helper_t* const nbh,
+    const size_t   slotIdx,
+    const uint32_t round)
+{
+    const if_OS_Socket_t* ctx = nbh->persistent ? nbh->ctx : NULL;
+
+    if ((NULL != ctx) && !atomic_flag_test_and_set(&nbh->drainerActive))
     {
-        eventCollection[handle.handleID].eventMask &= ~OS_SOCK_EV_ERROR;
-        return err;
+        if (spin_for_new_events(nbh, slotIdx, ctx))
+        {
+            drain_events(nbh, slotIdx);
+            return;
+        }
+
+        OS_Error_t err = OS_Socket_regCallback(ctx, &drain_events_handler, nbh);
+        if (err != OS_SUCCESS)
+        {
+            Debug_LOG_ERROR(
+                "OS_Socket_regCallback() failed, code %d", err);
+        }
+        ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+        stats_inc(&nbh->stats.callbackRegistrations);
+
+        // A notification arriving before the callback was registered is not
+        // delivered to it, so look again. The callback is left registered for
+        // the next one.
+        if (OS_Socket_poll(ctx) == OS_SUCCESS)
+        {
+            notify_other_wait_slots(nbh, collect_pending_events(nbh),
+                                    slotIdx);
+            return;
+        }
+    }
+    else if (spin_for_new_events(nbh, slotIdx, NULL))
+    {
+        slot_pass_on(nbh, slotIdx);
+        return;
     }
+
+    slot_block(nbh, slotIdx, round);
 }
 
-//------------------------------------------------------------------------------
-OS_Error_t
-nb_helper_reset_ev_struct_for_socket(
-    const OS_Socket_Handle_t handle)
+// Makes sure the oneshot of the deadline timer fires no later than deadlineMs.
+static OS_Error_t
+arm_deadline_timer(
+    nb_helper_t* const nbh,
+    const uint64_t deadlineMs)
 {
-    CHECK_VALUE_IN_RANGE(handle.handleID, 0, OS_NETWORK_MAXIMUM_SOCKET_NO);
+    OS_Error_t err = OS_SUCCESS;
+
+    nbh->shared_resource_lock();
+
+    // A later deadline is checked again once the armed one has expired.
+    if (deadlineMs < nbh->armedDeadlineMs)
+    {
+        err = nbh->deadlineTimer->oneshot_absolute(0, deadlineMs * 1000000ULL);
+        if (err != OS_SUCCESS)
+        {
+            Debug_LOG_ERROR("oneshot_absolute() failed, code %d", err);
+        }
+        else
+        {
+            nbh->armedDeadlineMs = deadlineMs;
+            stats_inc(&nbh->stats.deadlineTimerArms);
+        }
+    }
 
-    Debug_ASSERT(NULL != sync_func.shared_resource_lock);
-    sync_func.shared_resource_lock();
+    nbh->shared_resource_unlock();
 
-    memset(&eventCollection[handle.handleID], 0, sizeof(OS_Socket_Evt_t));
+    return err;
+}
 
-    Debug_ASSERT(NULL != sync_func.shared_resource_unlock);
-    sync_func.shared_resource_unlock();
+// Like wait_for_new_events(), but gives up at the deadline. With a deadline
+// timer the thread blocks on its notification until the oneshot armed for the
+// deadline wakes it up. Without one, the notifications can't be waited on with
+// a timeout, so the event table is looked at again after sleeping on the
+// TimeServer for a slice that grows up to NB_HELPER_DEADLINE_SLICE_MAX_MS,
+// while a collecting thread polls the event notification of the network stack
+// instead of blocking on it. A notification of the wait slot left pending by
+// this causes one spurious wakeup of the next blocking wait. With
+// NB_HELPER_DEADLINE_NOW only the pending events are collected. Returns
+// OS_ERROR_TIMEOUT if the deadline has passed, or the error of the timer.
+static OS_Error_t
+wait_for_new_events_until(
+    nb_helper_t* const nbh,
+    const size_t   slotIdx,
+    const uint64_t deadlineMs,
+    uint64_t*      sliceMs,
+    const uint32_t round)
+{
+    if (NB_HELPER_NO_DEADLINE == deadlineMs)
+    {
+        wait_for_new_events(nbh, slotIdx, round);
+        return OS_SUCCESS;
+    }
 
-    return OS_SUCCESS;
+    const if_OS_Timer_t* timer = nbh->timer;
+    uint64_t nowMs = 0;
+    OS_Error_t err;
+
+    if (NB_HELPER_DEADLINE_NOW != deadlineMs)
+    {
+        Debug_ASSERT(NULL != timer);
+
+        err = TimeServer_getTime(timer, TimeServer_PRECISION_MSEC, &nowMs);
+        if (err != OS_SUCCESS)
+        {
+            Debug_LOG_ERROR("TimeServer_getTime() failed, code %d", err);
+            return err;
+        }
+        if (nowMs >= deadlineMs)
+        {
+            return OS_ERROR_TIMEOUT;
+        }
+    }
+
+    if (poll_new_events(nbh, slotIdx))
+    {
+        *sliceMs = NB_HELPER_DEADLINE_SLICE_MIN_MS;
+        return OS_SUCCESS;
+    }
+
+    if (NB_HELPER_DEADLINE_NOW == deadlineMs)
+    {
+        return OS_ERROR_TIMEOUT;
+    }
+
+    if (NULL != nbh->deadlineTimer)
+    {
+        err = arm_deadline_timer(nbh, deadlineMs);
+        if (err != OS_SUCCESS)
+        {
+            return err;
+        }
+
+        wait_for_new_events_or_deadline(nbh, slotIdx, round);
+        return OS_SUCCESS;
+    }
+
+    const if_OS_Socket_t* ctx = nbh->persistent ? nbh->ctx : NULL;
+
+    // Try to get away without sleeping a whole slice.
+    if ((NULL != ctx) && !atomic_flag_test_and_set(&nbh->drainerActive))
+    {
+        if (spin_for_new_events(nbh, slotIdx, ctx))
+        {
+            drain_events(nbh, slotIdx);
+            *sliceMs = NB_HELPER_DEADLINE_SLICE_MIN_MS;
+            return OS_SUCCESS;
+        }
+        atomic_flag_clear(&nbh->drainerActive);
+    }
+    else if (spin_for_new_events(nbh, slotIdx, NULL))
+    {
+        slot_pass_on(nbh, slotIdx);
+        *sliceMs = NB_HELPER_DEADLINE_SLICE_MIN_MS;
+        return OS_SUCCESS;
+    }
+
+    const uint64_t remainingMs = deadlineMs - nowMs;
+    err = TimeServer_sleep(
+              timer,
+              TimeServer_PRECISION_MSEC,
+              (*sliceMs < remainingMs) ? *sliceMs : remainingMs);
+    if (err != OS_SUCCESS)
+    {
+        Debug_LOG_ERROR("TimeServer_sleep() failed, code %d", err);
+        return err;
+    }
+
+    *sliceMs = (*sliceMs * 2 > NB_HELPER_DEADLINE_SLICE_MAX_MS) ?
+               NB_HELPER_DEADLINE_SLICE_MAX_MS : *sliceMs * 2;
+
+    return OS_SUCCESS;
+}
+
+// Clears the given events of a socket and returns the mask before clearing.
+static inline uint8_t
+consume_events(
+    nb_helper_t* const nbh,
+    const int     handleID,
+    const uint8_t eventsToClear)
+{
+    return atomic_fetch_and(
+               &ev_slot(nbh, handleID)->eventMask,
+               (uint8_t) ~eventsToClear);
+}
+
+// Consumes the events that ended a wait without the awaited one and returns
+// what the wait reports. A close leaves nothing of the socket to wait for, so
+// all of its events are cleared, an error only clears itself and reports the
+// error of the socket.
+static OS_Error_t
+consume_failure_events(
+    nb_helper_t* const nbh,
+    const int        handleID,
+    const uint8_t    eventMask,
+    const OS_Error_t err)
+{
+    if (eventMask & OS_SOCK_EV_CLOSE)
+    {
+        atomic_store(&ev_slot(nbh, handleID)->eventMask, 0);
+        return OS_ERROR_NETWORK_CONN_SHUTDOWN;
+    }
+
+    consume_events(nbh, handleID, OS_SOCK_EV_ERROR);
+    return err;
+}
+
+// Blocks until one of the events in relevantMask is set for the socket and
+// returns the event mask and error found in the event table. Only the wait slot
+// of this socket is used, so events for other sockets do not wake us up.
+// Returns 0 if the deadline passed first, the socket was closed in the meantime
+// or the socket has no table entry.
+static uint8_t
+wait_for_relevant_events(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const uint8_t            relevantMask,
+    const uint64_t           deadlineMs,
+    OS_Error_t*              err)
+{
+    nb_helper_ev_slot_t* evSlot = get_ev_slot(nbh, handle.handleID);
+    uint64_t sliceMs = NB_HELPER_DEADLINE_SLICE_MIN_MS;
+    uint8_t eventMask;
+
+    if (NULL == evSlot)
+    {
+        *err = OS_ERROR_INSUFFICIENT_SPACE;
+        return 0;
+    }
+
+    const size_t slotIdx = get_wait_slot_idx(nbh, evSlot, handle.handleID);
+
+    const uint32_t generation = atomic_load(&evSlot->generation);
+    if (generation & 1)
+    {
+        *err = OS_ERROR_INVALID_HANDLE;
+        return 0;
+    }
+    *err = OS_ERROR_TIMEOUT;
+
+    // Register as waiter before checking the table. Together with the callback
+    // setting the mask before reading the waiter count (both sequentially
+    // consistent), either we see the new event or the callback sees us and
+    // sends a notification. Besides the poll set the socket is in, only one
+    // thread may wait on it, the events it consumes are lost for another one.
+    const unsigned int setWaiters =
+        (atomic_load(&evSlot->pollIndex) != POLL_INDEX_NONE) ? 1 : 0;
+    if (atomic_fetch_add(&evSlot->waiters, 1) > setWaiters)
+    {
+        atomic_fetch_sub(&evSlot->waiters, 1);
+        Debug_LOG_ERROR("Socket %d is waited on by another thread",
+                        handle.handleID);
+        *err = OS_ERROR_INVALID_STATE;
+        return 0;
+    }
+    atomic_fetch_add(&nbh->slotState[slotIdx].waiters, 1);
+
+    for (;;)
+    {
+        // Read before looking at the table, a notification meant for us
+        // starts a new round, see slot_block().
+        const uint32_t round = slot_round(nbh, slotIdx);
+
+        if (atomic_load(&evSlot->generation) != generation)
+        {
+            // Closed by another thread, the events are not ours anymore.
+            *err = OS_ERROR_INVALID_HANDLE;
+            eventMask = 0;
+            break;
+        }
+
+        eventMask = atomic_load(&evSlot->eventMask);
+        if (eventMask & relevantMask)
+        {
+            break;
+        }
+
+        // Wait for the arrival of new events for this socket.
+        const OS_Error_t waitErr =
+            wait_for_new_events_until(nbh, slotIdx, deadlineMs, &sliceMs,
+                                      round);
+        if (waitErr != OS_SUCCESS)
+        {
+            *err = waitErr;
+            eventMask = 0;
+            break;
+        }
+
+        stats_inc(&nbh->stats.wakeups);
+        if (!(atomic_load(&evSlot->eventMask) & relevantMask))
+        {
+            stats_inc(&nbh->stats.spuriousWakeups);
+        }
+    }
+
+    atomic_fetch_sub(&evSlot->waiters, 1);
+    atomic_fetch_sub(&nbh->slotState[slotIdx].waiters, 1);
+
+    if (eventMask)
+    {
+        *err = atomic_load_explicit(&evSlot->currentError,
+                                    memory_order_relaxed);
+    }
+
+    return eventMask;
+}
+
+// A deadline can only be used with a timer.
+#define CHECK_DEADLINE(_deadlineMs_) \
+    do \
+    { \
+        if ((NB_HELPER_NO_DEADLINE != (_deadlineMs_)) \
+            && (NB_HELPER_DEADLINE_NOW != (_deadlineMs_)) \
+            && (NULL == nbh->timer)) \
+        { \
+            Debug_LOG_ERROR("Deadline given, but no timer set"); \
+            return OS_ERROR_INVALID_STATE; \
+        } \
+    } while (0)
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_init(
+    nb_helper_t* const nbh,
+    const if_OS_Socket_t* const ctx,
+    const size_t maxSockets,
+    void (*event_notify_func_t)(void),
+    void (*event_wait_func_t)(void),
+    int (*mutex_lock_func_t)(void),
+    int (*mutex_unlock_func_t)(void))
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(ctx);
+    CHECK_PTR_NOT_NULL(event_notify_func_t);
+    CHECK_PTR_NOT_NULL(event_wait_func_t);
+    CHECK_PTR_NOT_NULL(mutex_lock_func_t);
+    CHECK_PTR_NOT_NULL(mutex_unlock_func_t);
+
+    CHECK_VALUE_IN_RANGE(maxSockets, 1, INT_MAX);
+
+    // Only the directory of the event table is allocated here, the chunks
+    // holding the entries follow on first use of a socket.
+    const size_t numChunks = (maxSockets + NB_HELPER_EV_TABLE_CHUNK_SIZE - 1)
+                             / NB_HELPER_EV_TABLE_CHUNK_SIZE;
+    _Atomic(nb_helper_ev_slot_t*)* evTable =
+        malloc(numChunks * sizeof(*evTable));
+    if (NULL == evTable)
+    {
+        Debug_LOG_ERROR("No memory for the event table of %zu sockets",
+                        maxSockets);
+        return OS_ERROR_INSUFFICIENT_SPACE;
+    }
+
+    // No thread can use the instance yet, so it is initialized without
+    // caring about the order of the stores.
+    for (size_t i = 0; i < numChunks; i++)
+    {
+        atomic_init(&evTable[i], NULL);
+    }
+    nbh->evTable = evTable;
+    nbh->evTableSize = numChunks;
+    nbh->maxSockets = maxSockets;
+    atomic_init(&nbh->evTableChunks, 0);
+
+    for (size_t i = 0; i < NB_HELPER_MAX_WAIT_SLOTS; i++)
+    {
+        atomic_init(&nbh->slotState[i].readyListHead, READY_LIST_EMPTY);
+        atomic_init(&nbh->slotState[i].waiters, 0);
+        atomic_init(&nbh->slotState[i].waitState, 0);
+        atomic_init(&nbh->slotState[i].spinBudget, 0);
+    }
+    atomic_flag_clear(&nbh->drainerActive);
+    memset(&nbh->stats, 0, sizeof(nbh->stats));
+    nbh->stackInitWaitMs = 0;
+
+    nbh->ctx = ctx;
+    nbh->persistent = false;
+    nbh->timer = NULL;
+    nbh->deadlineTimer = NULL;
+    nbh->armedDeadlineMs = NB_HELPER_NO_DEADLINE;
+    nbh->maxSpins = 0;
+    nbh->dispatchLimit = 0;
+    nbh->wait_slots[0].notify = event_notify_func_t;
+    nbh->wait_slots[0].wait = event_wait_func_t;
+    nbh->wait_slots[0].poll = NULL;
+    nbh->num_wait_slots = 1;
+    nbh->shared_resource_lock = mutex_lock_func_t;
+    nbh->shared_resource_unlock = mutex_unlock_func_t;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+void
+nb_helper_deinit(
+    nb_helper_t* const nbh)
+{
+    Debug_ASSERT(NULL != nbh);
+
+    for (size_t i = 0; i < nbh->evTableSize; i++)
+    {
+        free(atomic_load(&nbh->evTable[i]));
+    }
+    free(nbh->evTable);
+
+    nbh->evTable = NULL;
+    nbh->evTableSize = 0;
+    nbh->maxSockets = 0;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_init_wait_slots(
+    nb_helper_t* const nbh,
+    const nb_helper_wait_slot_t* const slots,
+    const size_t numSlots)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(slots);
+    CHECK_VALUE_IN_RANGE(numSlots, 1, NB_HELPER_MAX_WAIT_SLOTS + 1);
+
+    for (size_t i = 0; i < numSlots; i++)
+    {
+        CHECK_PTR_NOT_NULL(slots[i].notify);
+        CHECK_PTR_NOT_NULL(slots[i].wait);
+    }
+
+    // Must be called after nb_helper_init() and before the callback is
+    // registered, so there is no need to protect the slot table here.
+    memcpy(nbh->wait_slots, slots, numSlots * sizeof(*slots));
+    nbh->num_wait_slots = numSlots;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_set_timer(
+    nb_helper_t* const nbh,
+    const if_OS_Timer_t* const timer)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(timer);
+
+    nbh->timer = timer;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_set_deadline_timer(
+    nb_helper_t* const nbh,
+    const if_OS_Timer_t* const deadlineTimer)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(deadlineTimer);
+
+    nbh->deadlineTimer = deadlineTimer;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+void
+nb_helper_deadline_expired(
+    nb_helper_t* const nbh)
+{
+    Debug_ASSERT(NULL != nbh);
+
+    nbh->shared_resource_lock();
+    nbh->armedDeadlineMs = NB_HELPER_NO_DEADLINE;
+    nbh->shared_resource_unlock();
+
+    // Every waiter checks its deadline, the one that has expired is not known.
+    unsigned int slotsToNotify = 0;
+    for (size_t slot = 0; slot < nbh->num_wait_slots; slot++)
+    {
+        if (atomic_load(&nbh->slotState[slot].waiters) > 0)
+        {
+            slotsToNotify |= 1U << slot;
+        }
+    }
+
+    notify_wait_slots(nbh, slotsToNotify);
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_set_spin(
+    nb_helper_t* const nbh,
+    const event_poll_func_t poll,
+    const uint32_t maxSpins)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+
+    if (NULL != poll)
+    {
+        nbh->wait_slots[0].poll = poll;
+    }
+
+    // Start optimistic, the budget shrinks quickly if spinning does not pay
+    // off.
+    nbh->maxSpins = maxSpins;
+    for (size_t i = 0; i < NB_HELPER_MAX_WAIT_SLOTS; i++)
+    {
+        atomic_store(&nbh->slotState[i].spinBudget, maxSpins);
+    }
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_set_priority(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const nb_helper_prio_t priority)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_VALUE_IN_RANGE(handle.handleID, 0, nbh->maxSockets);
+    CHECK_VALUE_IN_RANGE(priority, NB_HELPER_PRIO_LOW, NB_HELPER_NUM_PRIOS);
+
+    nb_helper_ev_slot_t* evSlot = get_ev_slot(nbh, handle.handleID);
+    if (NULL == evSlot)
+    {
+        return OS_ERROR_INSUFFICIENT_SPACE;
+    }
+
+    atomic_store(&evSlot->priority, priority);
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_set_dispatch_limit(
+    nb_helper_t* const nbh,
+    const size_t maxReady)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+
+    nbh->dispatchLimit = maxReady;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_deadline_in(
+    nb_helper_t* const nbh,
+    const uint32_t timeoutMs,
+    uint64_t* const deadlineMs)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(deadlineMs);
+    if (NULL == nbh->timer)
+    {
+        Debug_LOG_ERROR("No timer set");
+        return OS_ERROR_INVALID_STATE;
+    }
+
+    uint64_t nowMs = 0;
+    OS_Error_t err = TimeServer_getTime(
+                         nbh->timer,
+                         TimeServer_PRECISION_MSEC,
+                         &nowMs);
+    if (err != OS_SUCCESS)
+    {
+        Debug_LOG_ERROR("TimeServer_getTime() failed, code %d", err);
+        return err;
+    }
+
+    *deadlineMs = nowMs + timeoutMs;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+void
+nb_helper_get_stats(
+    nb_helper_t* const nbh,
+    nb_helper_stats_t* const statsOut)
+{
+    Debug_ASSERT(NULL != nbh);
+    Debug_ASSERT(NULL != statsOut);
+
+    statsOut->eventsDelivered = atomic_load(&nbh->stats.eventsDelivered);
+    statsOut->eventBatches    = atomic_load(&nbh->stats.eventBatches);
+    statsOut->notifications   = atomic_load(&nbh->stats.notifications);
+    statsOut->passedNotifications =
+        atomic_load(&nbh->stats.passedNotifications);
+    statsOut->wakeups         = atomic_load(&nbh->stats.wakeups);
+    statsOut->spuriousWakeups = atomic_load(&nbh->stats.spuriousWakeups);
+    statsOut->readyListVisits = atomic_load(&nbh->stats.readyListVisits);
+    statsOut->pendingEventsRpcs     =
+        atomic_load(&nbh->stats.pendingEventsRpcs);
+    statsOut->callbackRegistrations =
+        atomic_load(&nbh->stats.callbackRegistrations);
+    statsOut->stackInitWaitMs = nbh->stackInitWaitMs;
+    statsOut->spinWaits       = atomic_load(&nbh->stats.spinWaits);
+    statsOut->spinHits        = atomic_load(&nbh->stats.spinHits);
+    statsOut->spinPolls       = atomic_load(&nbh->stats.spinPolls);
+    statsOut->spinBudget      = atomic_load(&nbh->slotState[0].spinBudget);
+    statsOut->staleEvents     = atomic_load(&nbh->stats.staleEvents);
+    statsOut->deferredSockets = atomic_load(&nbh->stats.deferredSockets);
+    statsOut->maxDeferRounds  = atomic_load(&nbh->stats.maxDeferRounds);
+    statsOut->deadlineTimerArms = atomic_load(&nbh->stats.deadlineTimerArms);
+
+    const uint32_t chunks = atomic_load(&nbh->evTableChunks);
+    statsOut->eventTableChunks = chunks;
+    statsOut->eventTableBytes =
+        nbh->evTableSize * sizeof(*nbh->evTable)
+        + chunks * NB_HELPER_EV_TABLE_CHUNK_SIZE * sizeof(nb_helper_ev_slot_t);
+}
+
+//------------------------------------------------------------------------------
+size_t
+nb_helper_count_busy_entries(
+    nb_helper_t* const nbh)
+{
+    Debug_ASSERT(NULL != nbh);
+
+    size_t numBusy = 0;
+
+    for (size_t i = 0; i < nbh->evTableSize; i++)
+    {
+        nb_helper_ev_slot_t* chunk = atomic_load(&nbh->evTable[i]);
+        if (NULL == chunk)
+        {
+            continue;
+        }
+
+        for (size_t j = 0; j < NB_HELPER_EV_TABLE_CHUNK_SIZE; j++)
+        {
+            nb_helper_ev_slot_t* evSlot = &chunk[j];
+
+            if (atomic_load(&evSlot->eventMask)
+                || atomic_load(&evSlot->waiters)
+                || atomic_load(&evSlot->queued)
+                || (atomic_load(&evSlot->generation) & 1)
+                || (atomic_load(&evSlot->priority) != NB_HELPER_PRIO_NORMAL))
+            {
+                numBusy++;
+            }
+        }
+    }
+
+    return numBusy;
+}
+
+
+void
+nb_helper_collect_pending_ev_handler(
+    void* ctx)
+{
+    nb_helper_t* nbh = ctx;
+    Debug_ASSERT(NULL != nbh);
+
+    // Unblock only the callers of the functions below that are waiting for an
+    // event on one of the sockets that received an event.
+    //
+    // collect_pending_events() relies on internals of the socket client of the
+    // SDK instead of OS_Socket_getPendingEvents(), to merge the events without
+    // copying them: it calls ctx->socket_getPendingEvents() of the interface
+    // directly, reads the records in place from ctx->dataport and holds
+    // ctx->shared_resource_mutex_lock() meanwhile, the mutex the client takes
+    // around its own dataport accesses. This has to be checked again whenever
+    // if_OS_Socket_t or the socket client change.
+    notify_wait_slots(nbh, collect_pending_events(nbh));
+
+    // Re-register the callback function.
+    OS_Error_t err = OS_Socket_regCallback(
+                         nbh->ctx,
+                         &nb_helper_collect_pending_ev_handler,
+                         nbh);
+    if (err != OS_SUCCESS)
+    {
+        Debug_LOG_ERROR(
+            "OS_Socket_regCallback() failed, code %d", err);
+    }
+    ASSERT_EQ_OS_ERR(OS_SUCCESS, err);
+
+    stats_inc(&nbh->stats.callbackRegistrations);
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_get_time_ns(
+    nb_helper_t* const nbh,
+    uint64_t* const nowNs)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(nowNs);
+    if (NULL == nbh->timer)
+    {
+        return OS_ERROR_INVALID_STATE;
+    }
+
+    return TimeServer_getTime(nbh->timer, TimeServer_PRECISION_NSEC, nowNs);
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_subscribe(
+    nb_helper_t* const nbh,
+    const bool persistent)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+
+    if (persistent)
+    {
+        // Nothing to register, the notification of the network stack stays
+        // bound to this component and is waited on directly.
+        nbh->persistent = true;
+        return OS_SUCCESS;
+    }
+
+    // Set up callback for new received socket events.
+    OS_Error_t err = OS_Socket_regCallback(
+                         nbh->ctx,
+                         &nb_helper_collect_pending_ev_handler,
+                         nbh);
+    if (err != OS_SUCCESS)
+    {
+        Debug_LOG_ERROR(
+            "OS_Socket_regCallback() failed, code %d", err);
+        return err;
+    }
+
+    stats_inc(&nbh->stats.callbackRegistrations);
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_wait_for_network_stack_init(
+    nb_helper_t* const nbh)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+
+    const if_OS_Socket_t* ctx = nbh->ctx;
+    const if_OS_Timer_t* timer = nbh->timer;
+    OS_NetworkStack_State_t networkStackState;
+    uint64_t startMs = 0;
+    uint64_t backoffMs = NB_HELPER_STACK_INIT_BACKOFF_MIN_MS;
+    unsigned int statusPolls = 0;
+    OS_Error_t err;
+
+    if (NULL != timer)
+    {
+        err = TimeServer_getTime(timer, TimeServer_PRECISION_MSEC, &startMs);
+        if (err != OS_SUCCESS)
+        {
+            Debug_LOG_ERROR("TimeServer_getTime() failed, code %d", err);
+            return err;
+        }
+    }
+
+    for (;;)
+    {
+        networkStackState = OS_Socket_getStatus(ctx);
+        statusPolls++;
+
+        if (networkStackState == RUNNING)
+        {
+            break;
+        }
+        if (networkStackState == FATAL_ERROR)
+        {
+            // NetworkStack will not come up.
+            Debug_LOG_ERROR("A FATAL_ERROR occurred in the Network Stack component.")
+            return OS_ERROR_ABORTED;
+        }
+
+        if (NULL != timer)
+        {
+            // Block instead of spinning, so the CPU is left to the NIC driver
+            // and the network stack while they come up. The backoff is bounded,
+            // so we notice the stack running shortly after it does.
+            err = TimeServer_sleep(timer, TimeServer_PRECISION_MSEC, backoffMs);
+            if (err != OS_SUCCESS)
+            {
+                Debug_LOG_ERROR("TimeServer_sleep() failed, code %d", err);
+                return err;
+            }
+            backoffMs = (backoffMs * 2 > NB_HELPER_STACK_INIT_BACKOFF_MAX_MS) ?
+                        NB_HELPER_STACK_INIT_BACKOFF_MAX_MS : backoffMs * 2;
+        }
+        else
+        {
+            // just yield to wait until the stack is up and running
+            seL4_Yield();
+        }
+    }
+
+    if (NULL != timer)
+    {
+        uint64_t nowMs = 0;
+        err = TimeServer_getTime(timer, TimeServer_PRECISION_MSEC, &nowMs);
+        if (err != OS_SUCCESS)
+        {
+            Debug_LOG_ERROR("TimeServer_getTime() failed, code %d", err);
+            return err;
+        }
+
+        nbh->stackInitWaitMs = (uint32_t)(nowMs - startMs);
+        Debug_LOG_INFO(
+            "Network stack running after waiting %u ms (%u status polls), "
+            "%u ms after boot",
+            nbh->stackInitWaitMs,
+            statusPolls,
+            (uint32_t) nowMs);
+    }
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_wait_for_read_ev_on_socket(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle)
+{
+    return nb_helper_wait_for_read_ev_on_socket_until(
+               nbh,
+               handle,
+               NB_HELPER_NO_DEADLINE);
+}
+
+OS_Error_t
+nb_helper_wait_for_read_ev_on_socket_until(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const uint64_t deadlineMs)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_VALUE_IN_RANGE(handle.handleID, 0, nbh->maxSockets);
+    CHECK_DEADLINE(deadlineMs);
+
+    OS_Error_t err;
+    const uint8_t eventMask = wait_for_relevant_events(
+                                  nbh,
+                                  handle,
+                                  OS_SOCK_EV_READ | OS_SOCK_EV_CLOSE
+                                  | OS_SOCK_EV_ERROR | OS_SOCK_EV_FIN,
+                                  deadlineMs,
+                                  &err);
+
+    if (0 == eventMask)
+    {
+        // The deadline has passed, the socket was closed or there is no
+        // memory for the entry.
+        return err;
+    }
+    if (eventMask & OS_SOCK_EV_READ)
+    {
+        consume_events(nbh, handle.handleID, OS_SOCK_EV_READ);
+        return OS_SUCCESS;
+    }
+
+    return consume_failure_events(nbh, handle.handleID, eventMask, err);
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_wait_for_write_ev_on_socket(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle)
+{
+    return nb_helper_wait_for_write_ev_on_socket_until(
+               nbh,
+               handle,
+               NB_HELPER_NO_DEADLINE);
+}
+
+OS_Error_t
+nb_helper_wait_for_write_ev_on_socket_until(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const uint64_t deadlineMs)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_VALUE_IN_RANGE(handle.handleID, 0, nbh->maxSockets);
+    CHECK_DEADLINE(deadlineMs);
+
+    OS_Error_t err;
+    const uint8_t eventMask = wait_for_relevant_events(
+                                  nbh,
+                                  handle,
+                                  OS_SOCK_EV_WRITE | OS_SOCK_EV_CLOSE
+                                  | OS_SOCK_EV_ERROR,
+                                  deadlineMs,
+                                  &err);
+
+    if (0 == eventMask)
+    {
+        // The deadline has passed, the socket was closed or there is no
+        // memory for the entry.
+        return err;
+    }
+    if (eventMask & OS_SOCK_EV_WRITE)
+    {
+        consume_events(nbh, handle.handleID, OS_SOCK_EV_WRITE);
+        return OS_SUCCESS;
+    }
+
+    return consume_failure_events(nbh, handle.handleID, eventMask, err);
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_wait_for_conn_est_ev_on_socket(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle)
+{
+    return nb_helper_wait_for_conn_est_ev_on_socket_until(
+               nbh,
+               handle,
+               NB_HELPER_NO_DEADLINE);
+}
+
+OS_Error_t
+nb_helper_wait_for_conn_est_ev_on_socket_until(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const uint64_t deadlineMs)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_VALUE_IN_RANGE(handle.handleID, 0, nbh->maxSockets);
+    CHECK_DEADLINE(deadlineMs);
+
+    OS_Error_t err;
+    const uint8_t eventMask = wait_for_relevant_events(
+                                  nbh,
+                                  handle,
+                                  OS_SOCK_EV_CONN_EST | OS_SOCK_EV_ERROR | OS_SOCK_EV_FIN,
+                                  deadlineMs,
+                                  &err);
+
+    if (0 == eventMask)
+    {
+        // The deadline has passed, the socket was closed or there is no
+        // memory for the entry.
+        return err;
+    }
+    if (eventMask & OS_SOCK_EV_CONN_EST)
+    {
+        consume_events(nbh, handle.handleID, OS_SOCK_EV_CONN_EST);
+        return OS_SUCCESS;
+    }
+    else
+    {
+        consume_events(nbh, handle.handleID, OS_SOCK_EV_ERROR);
+        return err;
+    }
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_wait_for_conn_acpt_ev_on_socket(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle)
+{
+    return nb_helper_wait_for_conn_acpt_ev_on_socket_until(
+               nbh,
+               handle,
+               NB_HELPER_NO_DEADLINE);
+}
+
+OS_Error_t
+nb_helper_wait_for_conn_acpt_ev_on_socket_until(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const uint64_t deadlineMs)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_VALUE_IN_RANGE(handle.handleID, 0, nbh->maxSockets);
+    CHECK_DEADLINE(deadlineMs);
+
+    OS_Error_t err;
+    const uint8_t eventMask = wait_for_relevant_events(
+                                  nbh,
+                                  handle,
+                                  OS_SOCK_EV_CONN_ACPT | OS_SOCK_EV_ERROR | OS_SOCK_EV_FIN,
+                                  deadlineMs,
+                                  &err);
+
+    if (0 == eventMask)
+    {
+        // The deadline has passed, the socket was closed or there is no
+        // memory for the entry.
+        return err;
+    }
+    if (eventMask & OS_SOCK_EV_CONN_ACPT)
+    {
+        consume_events(nbh, handle.handleID, OS_SOCK_EV_CONN_ACPT);
+        return OS_SUCCESS;
+    }
+    else
+    {
+        consume_events(nbh, handle.handleID, OS_SOCK_EV_ERROR);
+        return err;
+    }
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_poll_set_init(
+    nb_helper_t* const nbh,
+    nb_helper_poll_set_t* const set,
+    nb_helper_poll_t* const fds,
+    const size_t maxFds)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(set);
+    CHECK_PTR_NOT_NULL(fds);
+    CHECK_VALUE_NOT_ZERO(maxFds);
+
+    set->fds     = fds;
+    set->maxFds  = maxFds;
+    set->numFds  = 0;
+    set->slotIdx = 0;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+// Events reported for a socket of a set with the given interest mask. FIN means
+// the end of the stream has been reached, it only matters to a reader.
+static inline uint8_t
+reported_events(
+    const uint8_t events)
+{
+    return events | OS_SOCK_EV_ERROR | OS_SOCK_EV_CLOSE
+           | ((events & OS_SOCK_EV_READ) ? OS_SOCK_EV_FIN : 0);
+}
+
+// Returns the position of the socket in the set, numFds if it is not part of
+// it.
+static inline size_t
+poll_set_find(
+    nb_helper_t* const nbh,
+    const nb_helper_poll_set_t* const set,
+    const int handleID)
+{
+    const size_t i = atomic_load_explicit(
+                         &ev_slot(nbh, handleID)->pollIndex,
+                         memory_order_relaxed);
+
+    return ((i < set->numFds) && (set->fds[i].handle.handleID == handleID)) ?
+           i : set->numFds;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_poll_set_add(
+    nb_helper_t* const nbh,
+    nb_helper_poll_set_t* const set,
+    const OS_Socket_Handle_t handle,
+    const uint8_t events,
+    void* const data)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(set);
+    CHECK_VALUE_IN_RANGE(handle.handleID, 0, nbh->maxSockets);
+
+    if (set->numFds == set->maxFds)
+    {
+        Debug_LOG_ERROR("No room for socket %d in the set, maximum is %zu",
+                        handle.handleID, set->maxFds);
+        return OS_ERROR_INSUFFICIENT_SPACE;
+    }
+
+    nb_helper_ev_slot_t* evSlot = get_ev_slot(nbh, handle.handleID);
+    if (NULL == evSlot)
+    {
+        return OS_ERROR_INSUFFICIENT_SPACE;
+    }
+    if (poll_set_find(nbh, set, handle.handleID) < set->numFds)
+    {
+        Debug_LOG_ERROR("Socket %d is already in the set", handle.handleID);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    // The set is waited on through the slot of its first socket, the others
+    // are moved there while they are in the set.
+    if (0 == set->numFds)
+    {
+        set->slotIdx = get_wait_slot_idx(nbh, evSlot, handle.handleID);
+    }
+    else if (get_wait_slot_idx(nbh, evSlot, handle.handleID) != set->slotIdx)
+    {
+        move_to_wait_slot(nbh, evSlot, handle.handleID, set->slotIdx);
+    }
+
+    const size_t i = set->numFds;
+
+    set->fds[i].handle  = handle;
+    set->fds[i].events  = events;
+    set->fds[i].revents = 0;
+    set->fds[i].data    = data;
+    set->numFds++;
+
+    // Register as waiter before checking the table, see
+    // wait_for_relevant_events().
+    atomic_store(&evSlot->pollIndex, i);
+    atomic_fetch_add(&evSlot->waiters, 1);
+
+    // Events that arrived while the socket was not part of a set interested
+    // in them, it has been left off the ready list then.
+    if (atomic_load(&evSlot->eventMask) & reported_events(events))
+    {
+        ready_list_push(nbh, handle.handleID);
+    }
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_poll_set_remove(
+    nb_helper_t* const nbh,
+    nb_helper_poll_set_t* const set,
+    const OS_Socket_Handle_t handle)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(set);
+    CHECK_VALUE_IN_RANGE(handle.handleID, 0, nbh->maxSockets);
+
+    // A socket that is in the set has an entry.
+    const bool hasEntry = (NULL != atomic_load(
+                               &nbh->evTable[handle.handleID
+                                             / NB_HELPER_EV_TABLE_CHUNK_SIZE]));
+    const size_t i = hasEntry ?
+                     poll_set_find(nbh, set, handle.handleID) : set->numFds;
+    if (i == set->numFds)
+    {
+        Debug_LOG_ERROR("Socket %d is not in the set", handle.handleID);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    const size_t last = set->numFds - 1;
+    nb_helper_ev_slot_t* evSlot = ev_slot(nbh, handle.handleID);
+
+    atomic_fetch_sub(&evSlot->waiters, 1);
+
+    if (atomic_load(&evSlot->waitSlot) != NB_HELPER_MAX_WAIT_SLOTS)
+    {
+        move_to_wait_slot(nbh, evSlot, handle.handleID,
+                          NB_HELPER_MAX_WAIT_SLOTS);
+    }
+
+    // The last socket takes over the position, the order does not matter.
+    if (i != last)
+    {
+        set->fds[i] = set->fds[last];
+        atomic_store_explicit(
+            &ev_slot(nbh, set->fds[i].handle.handleID)->pollIndex,
+            i,
+            memory_order_relaxed);
+    }
+    set->numFds--;
+    atomic_store(&evSlot->pollIndex, POLL_INDEX_NONE);
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+static inline unsigned int
+effective_priority(
+    nb_helper_ev_slot_t* const evSlot)
+{
+    return atomic_load(&evSlot->priority)
+           + atomic_load(&evSlot->deferRounds) / NB_HELPER_PRIO_AGING_ROUNDS;
+}
+
+//------------------------------------------------------------------------------
+// Adds a ready socket of the set to the ones handed out, its events are not
+// consumed yet. Beyond the limit, the least urgent of them and the new one is
+// held back with its events left pending and put back on the ready list. Of
+// equal ones the socket held back for a shorter time is chosen, and then the
+// one that became ready last.
+static void
+offer_ready(
+    nb_helper_t* const nbh,
+    const nb_helper_poll_t* const candidate,
+    nb_helper_poll_t* const ready,
+    const size_t limit,
+    size_t* const numReady)
+{
+    if (*numReady < limit)
+    {
+        ready[(*numReady)++] = *candidate;
+        return;
+    }
+
+    nb_helper_ev_slot_t* evSlot = ev_slot(nbh, candidate->handle.handleID);
+    size_t victim = limit;
+    unsigned int victimPrio = effective_priority(evSlot);
+    unsigned int victimRounds = atomic_load(&evSlot->deferRounds);
+
+    for (size_t k = 0; k < limit; k++)
+    {
+        evSlot = ev_slot(nbh, ready[k].handle.handleID);
+        const unsigned int prio = effective_priority(evSlot);
+        const unsigned int rounds = atomic_load(&evSlot->deferRounds);
+
+        if ((prio < victimPrio)
+            || ((prio == victimPrio) && (rounds < victimRounds)))
+        {
+            victim = k;
+            victimPrio = prio;
+            victimRounds = rounds;
+        }
+    }
+
+    const int handleID = (victim < limit) ?
+                         ready[victim].handle.handleID :
+                         candidate->handle.handleID;
+    evSlot = ev_slot(nbh, handleID);
+
+    if (victimRounds < UINT8_MAX)
+    {
+        atomic_store(&evSlot->deferRounds, victimRounds + 1);
+    }
+    stats_inc(&nbh->stats.deferredSockets);
+    ready_list_push(nbh, handleID);
+
+    if (victim < limit)
+    {
+        ready[victim] = *candidate;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Consumes the events of the sockets handed out.
+static void
+consume_ready(
+    nb_helper_t* const nbh,
+    const nb_helper_poll_t* const ready,
+    const size_t numReady)
+{
+    for (size_t k = 0; k < numReady; k++)
+    {
+        const uint8_t eventMask = ready[k].revents;
+        const int handleID = ready[k].handle.handleID;
+        nb_helper_ev_slot_t* evSlot = ev_slot(nbh, handleID);
+
+        if (eventMask & OS_SOCK_EV_CLOSE)
+        {
+            atomic_store(&evSlot->eventMask, 0);
+        }
+        else
+        {
+            // FIN stays set until the socket is closed, the reader has to see
+            // the end of the stream.
+            consume_events(nbh, handleID, eventMask & ~OS_SOCK_EV_FIN);
+        }
+
+        // The threads of the other wait slots may update the maximum, too.
+        const uint32_t rounds = atomic_exchange(&evSlot->deferRounds, 0);
+        uint32_t maxRounds = atomic_load(&nbh->stats.maxDeferRounds);
+        while ((rounds > maxRounds)
+               && !atomic_compare_exchange_weak(&nbh->stats.maxDeferRounds,
+                                                &maxRounds, rounds))
+        {
+            // maxRounds has been updated to the current maximum.
+        }
+
+        // Only what the set is interested in keeps the socket on the list, so
+        // a FIN left for a writer does not wake us up over and over.
+        if (atomic_load(&evSlot->eventMask) & reported_events(ready[k].events))
+        {
+            ready_list_push(nbh, handleID);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_wait_any(
+    nb_helper_t* const nbh,
+    nb_helper_poll_set_t* const set,
+    nb_helper_poll_t* const ready,
+    const size_t maxReady,
+    size_t* const numReady)
+{
+    return nb_helper_wait_any_until(
+               nbh,
+               set,
+               NB_HELPER_NO_DEADLINE,
+               ready,
+               maxReady,
+               numReady);
+}
+
+//------------------------------------------------------------------------------
+// Only the sockets of the wait slot of the set that have pending events are
+// visited, the work of a call does not grow with the size of the set.
+OS_Error_t
+nb_helper_wait_any_until(
+    nb_helper_t* const nbh,
+    nb_helper_poll_set_t* const set,
+    const uint64_t deadlineMs,
+    nb_helper_poll_t* const ready,
+    const size_t maxReady,
+    size_t* const numReady)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(set);
+    CHECK_PTR_NOT_NULL(ready);
+    CHECK_PTR_NOT_NULL(numReady);
+    CHECK_VALUE_NOT_ZERO(set->numFds);
+    CHECK_VALUE_NOT_ZERO(maxReady);
+    CHECK_DEADLINE(deadlineMs);
+
+    const size_t slotIdx = set->slotIdx;
+    const size_t limit = ((nbh->dispatchLimit > 0)
+                          && (nbh->dispatchLimit < maxReady)) ?
+                         nbh->dispatchLimit : maxReady;
+
+    // The sockets of the set are registered already, see
+    // nb_helper_poll_set_add().
+    atomic_fetch_add(&nbh->slotState[slotIdx].waiters, 1);
+
+    uint64_t sliceMs = NB_HELPER_DEADLINE_SLICE_MIN_MS;
+    size_t numOut = 0;
+    OS_Error_t ret = OS_SUCCESS;
+
+    for (;;)
+    {
+        // Sockets held back by the dispatch limit keep the ready list busy,
+        // let events that arrived meanwhile compete with them.
+        if (nbh->dispatchLimit > 0)
+        {
+            poll_new_events(nbh, slotIdx);
+        }
+
+        // Read before taking the list, see slot_block().
+        const uint32_t round = slot_round(nbh, slotIdx);
+        int handleID = ready_list_take_all(nbh, slotIdx);
+
+        while (handleID != READY_LIST_EMPTY)
+        {
+            nb_helper_ev_slot_t* evSlot = ev_slot(nbh, handleID);
+            const int next = atomic_load_explicit(
+                                 &evSlot->next,
+                                 memory_order_relaxed);
+
+            stats_inc(&nbh->stats.readyListVisits);
+
+            // Clear the flag before looking at the mask, so an event merged
+            // after this point puts the socket on the list again.
+            atomic_store(&evSlot->queued, false);
+
+            // The events of a socket being closed are about to be cleared.
+            const size_t i = poll_set_find(nbh, set, handleID);
+            const uint8_t eventMask =
+                ((i < set->numFds) && !(atomic_load(&evSlot->generation) & 1)) ?
+                atomic_load(&evSlot->eventMask)
+                & reported_events(set->fds[i].events) : 0;
+
+            // Consumed by consume_ready() once the sockets handed out are
+            // known, until then the socket stays off the list. Sockets with
+            // nothing of interest are left off, too, adding them to a set
+            // interested in their events puts them back.
+            if (eventMask)
+            {
+                nb_helper_poll_t candidate = set->fds[i];
+                candidate.revents = eventMask;
+                offer_ready(nbh, &candidate, ready, limit, &numOut);
+            }
+
+            handleID = next;
+        }
+
+        if (numOut > 0)
+        {
+            consume_ready(nbh, ready, numOut);
+            break;
+        }
+
+        // Wait for the arrival of new events for any socket of the set.
+        ret = wait_for_new_events_until(nbh, slotIdx, deadlineMs, &sliceMs,
+                                        round);
+        if (ret != OS_SUCCESS)
+        {
+            break;
+        }
+
+        stats_inc(&nbh->stats.wakeups);
+    }
+
+    atomic_fetch_sub(&nbh->slotState[slotIdx].waiters, 1);
+
+    *numReady = numOut;
+
+    return ret;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_reset_ev_struct_for_socket(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_VALUE_IN_RANGE(handle.handleID, 0, nbh->maxSockets);
+
+    nb_helper_ev_slot_t* evSlot = get_ev_slot(nbh, handle.handleID);
+    if (NULL == evSlot)
+    {
+        return OS_ERROR_INSUFFICIENT_SPACE;
+    }
+
+    atomic_store(&evSlot->eventMask, 0);
+    atomic_store(&evSlot->parentSocketHandle, 0);
+    atomic_store(&evSlot->currentError, OS_SUCCESS);
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+nb_helper_socket_close(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_VALUE_IN_RANGE(handle.handleID, 0, nbh->maxSockets);
+
+    // Without an entry there is nothing to clean up, the socket is closed
+    // anyway.
+    nb_helper_ev_slot_t* evSlot = get_ev_slot(nbh, handle.handleID);
+    if (NULL != evSlot)
+    {
+        atomic_fetch_add(&evSlot->generation, 1);
+    }
+
+    OS_Error_t err = OS_Socket_close(handle);
+
+    if (NULL == evSlot)
+    {
+        return err;
+    }
+    if (err != OS_SUCCESS)
+    {
+        // The socket is still open, so its entry stays as it is. Going back to
+        // the generation we started from leaves the waiters on it in place.
+        // Events dropped as stale meanwhile are lost, the caller has to close
+        // the socket again anyway.
+        Debug_LOG_ERROR("OS_Socket_close() failed for socket %d, code %d",
+                        handle.handleID, err);
+        atomic_fetch_sub(&evSlot->generation, 1);
+        return err;
+    }
+
+    // Events are fetched and merged with the dataport mutex held. Once we got
+    // it, nobody can still be merging events fetched before the close.
+    const if_OS_Socket_t* ctx = nbh->ctx;
+    ctx->shared_resource_mutex_lock();
+    ctx->shared_resource_mutex_unlock();
+
+    atomic_store(&evSlot->eventMask, 0);
+    atomic_store(&evSlot->parentSocketHandle, 0);
+    atomic_store(&evSlot->currentError, OS_SUCCESS);
+    atomic_store(&evSlot->priority, NB_HELPER_PRIO_NORMAL);
+    atomic_store(&evSlot->deferRounds, 0);
+    atomic_fetch_add(&evSlot->generation, 1);
+
+    // Let a thread still waiting on the socket find out.
+    const size_t slotIdx = get_wait_slot_idx(nbh, evSlot, handle.handleID);
+    if ((atomic_load(&evSlot->waiters) > 0)
+        && (atomic_load(&nbh->slotState[slotIdx].waiters) > 0))
+    {
+        notify_wait_slots(nbh, 1U << slotIdx);
+    }
+
+    return err;
 }
@@ -10,37 +10,509 @@
 
 #pragma once
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "OS_Socket.h"
 #include "OS_Types.h"
+#include "TimeServer.h"
+
+// Maximum number of wait slots a component can register. Every socket handle is
+// mapped to the slot (handleID % number of registered slots), unless it is in a
+// poll set, and a delivered event only wakes the thread waiting on the slot of
+// the affected socket. Several threads may wait on a slot, a thread woken up
+// by its notification passes it on until every thread blocked on the slot has
+// looked at the event table again. A socket must only be waited on by one
+// thread at a time, a second wait on it fails with OS_ERROR_INVALID_STATE.
+#define NB_HELPER_MAX_WAIT_SLOTS 4
+
+// Number of event table entries allocated at once.
+#define NB_HELPER_EV_TABLE_CHUNK_SIZE           16
+
+// Bounds of the backoff while waiting for the network stack to come up.
+#define NB_HELPER_STACK_INIT_BACKOFF_MIN_MS     1
+#define NB_HELPER_STACK_INIT_BACKOFF_MAX_MS     64
+
+// Deadline of the wait functions that never expires. Deadlines are absolute
+// TimeServer times in milliseconds, see nb_helper_deadline_in(). Passing the
+// same deadline to several waits bounds them all together.
+#define NB_HELPER_NO_DEADLINE                   UINT64_MAX
+
+// Deadline that has always passed, the wait functions then only check for
+// events that are already pending. Does not require a timer.
+#define NB_HELPER_DEADLINE_NOW                  0
+
+// Bounds of the sleep slices used to look for events while waiting with a
+// deadline and without a deadline timer, see nb_helper_set_deadline_timer().
+#define NB_HELPER_DEADLINE_SLICE_MIN_MS         1
+#define NB_HELPER_DEADLINE_SLICE_MAX_MS         8
+
+// Lower bound of the self-tuning spin budget, see nb_helper_set_spin().
+#define NB_HELPER_SPIN_BUDGET_MIN               8
+
+// Calls of nb_helper_wait_any() a ready socket is held back by the dispatch
+// limit before it is treated as one priority level more urgent, see
+// nb_helper_set_dispatch_limit().
+#define NB_HELPER_PRIO_AGING_ROUNDS             4
+
+// Data written by different threads is kept in separate cache lines of this
+// size, 64 bytes on the Cortex-A53 and Cortex-A72 of the zynqmp and rpi4.
+#ifndef NB_HELPER_CACHE_LINE_SIZE
+#define NB_HELPER_CACHE_LINE_SIZE               64
+#endif
+
+// Dispatch priority of a socket, see nb_helper_set_priority().
+typedef enum
+{
+    NB_HELPER_PRIO_LOW = 0, // bulk transfers
+    NB_HELPER_PRIO_NORMAL,  // default of every socket
+    NB_HELPER_PRIO_HIGH,    // control connections
+    NB_HELPER_NUM_PRIOS
+} nb_helper_prio_t;
+
+typedef struct
+{
+    event_notify_func_t notify;
+    event_wait_func_t   wait;
+    // Optional, lets the waiter spin on the notification before blocking on
+    // it, see nb_helper_set_spin().
+    event_poll_func_t   poll;
+} nb_helper_wait_slot_t;
+
+typedef struct
+{
+    uint32_t eventsDelivered; // socket events merged into the event table
+    uint32_t eventBatches;    // callback invocations with at least one event
+    uint32_t notifications;   // wait slot notifications emitted
+    uint32_t passedNotifications; // ... passed on to another waiter of a slot
+    uint32_t wakeups;         // waiters returning from a blocking wait
+    uint32_t spuriousWakeups; // wakeups without a relevant event
+    uint32_t readyListVisits; // ready list entries looked at by consumers
+    // RPCs to the network stack for event delivery
+    uint32_t pendingEventsRpcs;     // OS_Socket_getPendingEvents() calls
+    uint32_t callbackRegistrations; // OS_Socket_regCallback() calls
+    uint32_t stackInitWaitMs; // time waited for the network stack to come up
+    uint32_t eventTableChunks; // event table chunks allocated
+    uint32_t eventTableBytes;  // memory used by the event table
+    // Spinning before blocking, see nb_helper_set_spin().
+    uint32_t spinWaits;  // waits that spun before blocking
+    uint32_t spinHits;   // ... and got their event without blocking
+    uint32_t spinPolls;  // notification polls while spinning
+    uint32_t spinBudget; // current spin budget of wait slot 0
+    uint32_t staleEvents; // events dropped for sockets being closed
+    // Dispatch limit, see nb_helper_set_dispatch_limit().
+    uint32_t deferredSockets; // ready sockets held back for more urgent ones
+    uint32_t maxDeferRounds;  // longest a socket was held back, in calls
+    uint32_t deadlineTimerArms; // oneshots armed for waits with a deadline
+} nb_helper_stats_t;
+
+// Entry of a poll set, see nb_helper_poll_set_add(). OS_SOCK_EV_ERROR and
+// OS_SOCK_EV_CLOSE are always reported, even if they are not part of the
+// interest mask. OS_SOCK_EV_FIN is reported with OS_SOCK_EV_READ in the mask
+// only, and then on every call until the socket is closed, like the end of the
+// stream is for the reads.
+typedef struct
+{
+    OS_Socket_Handle_t handle;
+    uint8_t            events;  // interest mask (OS_SOCK_EV_xxx)
+    uint8_t            revents; // ready events, set by nb_helper_wait_any()
+    void*              data;    // caller data, handed back untouched
+} nb_helper_poll_t;
+
+// Sockets waited on together with nb_helper_wait_any(). The sockets stay
+// registered across the waits, so a wait only costs as much as the sockets
+// that are ready and not as the whole set. Owned by the caller and only to be
+// used by one thread at a time through the functions below.
+typedef struct
+{
+    nb_helper_poll_t* fds;     // registered sockets, in no particular order
+    size_t            maxFds;
+    size_t            numFds;
+    size_t            slotIdx; // wait slot of the first socket of the set
+} nb_helper_poll_set_t;
+
+// Event table entry of a socket. Every entry has a cache line of its own, so
+// the thread merging the events of one socket does not steal the line from a
+// thread waiting on a neighbouring socket. All fields are accessed atomically,
+// so the callback and the waiting threads do not need to take a lock. The
+// callback accumulates events with an atomic fetch-or and consumers clear only the
+// events they have handled with an atomic fetch-and, so no event can get lost
+// between reading and clearing the mask.
+typedef struct
+{
+    _Alignas(NB_HELPER_CACHE_LINE_SIZE)
+    _Atomic uint8_t      eventMask;
+    _Atomic int          parentSocketHandle;
+    _Atomic int          currentError;
+    // Number of threads waiting for an event on the socket and poll sets it
+    // is registered with.
+    _Atomic unsigned int waiters;
+    // Position of the socket in the poll set it is registered with, SIZE_MAX
+    // while it is not part of one.
+    _Atomic size_t       pollIndex;
+    // Link of the intrusive ready list, only valid while queued is set.
+    _Atomic int          next;
+    _Atomic bool         queued;
+    // Incremented twice by nb_helper_socket_close(), it is odd while the
+    // socket is being closed. Events arriving then are dropped, and a thread
+    // waiting on the socket sees the change and gives up.
+    _Atomic uint32_t     generation;
+    _Atomic uint8_t      priority; // nb_helper_prio_t
+    // Calls of nb_helper_wait_any() the socket has been held back by the
+    // dispatch limit since it was handed out last.
+    _Atomic uint8_t      deferRounds;
+    // Wait slot the socket was moved to by a poll set, NB_HELPER_MAX_WAIT_SLOTS
+    // while it uses the slot of its handle.
+    _Atomic uint8_t      waitSlot;
+} nb_helper_ev_slot_t;
+
+// State of a wait slot shared between the thread waiting on it and the threads
+// delivering events, in a cache line of its own like the event table entries.
+typedef struct
+{
+    // Lock-free LIFO of sockets with pending events. Every socket of the slot
+    // with events its poll set is interested in is on it (or currently being
+    // looked at by the consumer), so consumers only have to visit sockets that
+    // are ready instead of scanning the whole set. The callback pushes single entries,
+    // consumers always take the whole list at once, so there is no ABA
+    // problem.
+    _Alignas(NB_HELPER_CACHE_LINE_SIZE)
+    _Atomic int          readyListHead;
+    // Number of threads blocked in a wait function.
+    _Atomic unsigned int waiters;
+    // Round of notifications and the threads blocked on the notification of
+    // the slot, packed so they change together, see slot_block().
+    _Atomic uint64_t     waitState;
+    // Polls of the notification before blocking, adapted by whether spinning
+    // paid off the last time.
+    _Atomic uint32_t     spinBudget;
+} nb_helper_slot_state_t;
+
+typedef struct
+{
+    _Atomic uint32_t eventsDelivered;
+    _Atomic uint32_t eventBatches;
+    _Atomic uint32_t notifications;
+    _Atomic uint32_t passedNotifications;
+    _Atomic uint32_t wakeups;
+    _Atomic uint32_t spuriousWakeups;
+    _Atomic uint32_t readyListVisits;
+    _Atomic uint32_t pendingEventsRpcs;
+    _Atomic uint32_t callbackRegistrations;
+    _Atomic uint32_t spinWaits;
+    _Atomic uint32_t spinHits;
+    _Atomic uint32_t spinPolls;
+    _Atomic uint32_t staleEvents;
+    _Atomic uint32_t deferredSockets;
+    _Atomic uint32_t maxDeferRounds;
+    _Atomic uint32_t deadlineTimerArms;
+} nb_helper_atomic_stats_t;
+
+// State of a helper instance, serving the events of one network stack. The
+// instance is owned by the caller and must only be accessed through the
+// functions below, after nb_helper_init(). A component talking to several
+// network stacks uses one instance per stack.
+typedef struct
+{
+    // Network stack the events are collected from.
+    const if_OS_Socket_t* ctx;
+    nb_helper_wait_slot_t wait_slots[NB_HELPER_MAX_WAIT_SLOTS];
+    size_t                num_wait_slots;
+    // The event table does not need the lock anymore, it is kept for helper
+    // state that is not updated atomically.
+    mutex_lock_func_t     shared_resource_lock;
+    mutex_unlock_func_t   shared_resource_unlock;
+    // Set for a persistent subscription, waiting threads then collect the
+    // events themselves instead of relying on the callback.
+    bool                  persistent;
+    // Optional, used to sleep instead of spinning while waiting.
+    const if_OS_Timer_t*  timer;
+    // Optional, wakes up the threads waiting with a deadline.
+    const if_OS_Timer_t*  deadlineTimer;
+    // Deadline the oneshot of deadlineTimer is armed for, NB_HELPER_NO_DEADLINE
+    // if none. Protected by shared_resource_lock.
+    uint64_t              armedDeadlineMs;
+    // Upper bound of the spin budget, 0 if spinning is disabled.
+    uint32_t              maxSpins;
+    // Maximum number of sockets nb_helper_wait_any() hands out at once, 0 for
+    // no limit.
+    size_t                dispatchLimit;
+
+    // Event table, a directory of chunks of NB_HELPER_EV_TABLE_CHUNK_SIZE
+    // entries indexed by the socket handle. Chunks are allocated on first use,
+    // so the memory grows with the handle range in use and not with
+    // maxSockets.
+    _Atomic(nb_helper_ev_slot_t*)* evTable;
+    size_t                evTableSize; // number of directory entries
+    size_t                maxSockets;
+    _Atomic uint32_t      evTableChunks; // number of allocated chunks
+
+    nb_helper_slot_state_t slotState[NB_HELPER_MAX_WAIT_SLOTS];
+
+    // With a persistent subscription, the thread holding this flag is the one
+    // blocked on the network stack event notification, or it is held by the
+    // callback registered for a thread waiting with a deadline.
+    atomic_flag           drainerActive;
+
+    // Updated by every thread, kept away from the rest.
+    _Alignas(NB_HELPER_CACHE_LINE_SIZE)
+    nb_helper_atomic_stats_t stats;
+    uint32_t              stackInitWaitMs;
+} nb_helper_t;
 
 //------------------------------------------------------------------------------
+// Initializes a helper instance for the network stack ctx, tracking the events
+// of socket handles below maxSockets. Must be called before any other function
+// on the instance.
 OS_Error_t
 nb_helper_init(
+    nb_helper_t* const nbh,
+    const if_OS_Socket_t* const ctx,
+    const size_t maxSockets,
     void (*event_notify_func_t)(void),
     void (*event_wait_func_t)(void),
     int (*mutex_lock_func_t)(void),
     int (*mutex_unlock_func_t)(void));
 
+// Frees the event table of an instance no thread is using anymore.
+void
+nb_helper_deinit(
+    nb_helper_t* const nbh);
+
+// Replaces the single wait slot of nb_helper_init() by numSlots slots, one for
+// each thread that waits on the instance. Must be called before the
+// subscription and any wait.
+OS_Error_t
+nb_helper_init_wait_slots(
+    nb_helper_t* const nbh,
+    const nb_helper_wait_slot_t* const slots,
+    const size_t numSlots);
+
+// Sets the timer used to sleep while waiting. Without it, waiting for the
+// network stack falls back to yielding.
+OS_Error_t
+nb_helper_set_timer(
+    nb_helper_t* const nbh,
+    const if_OS_Timer_t* const timer);
+
+// Sets a second timer connection to wake up the threads waiting with a
+// deadline. They then block on their notification like without a deadline, and
+// a oneshot of this timer wakes them up once the deadline has passed. Waits
+// sharing a deadline arm it once. The notification of the timer must be handled
+// by a callback calling nb_helper_deadline_expired(), so it can't be the timer
+// of nb_helper_set_timer(), TimeServer_sleep() waits on that notification.
+// Without a deadline timer, the waits sleep on the TimeServer in slices between
+// NB_HELPER_DEADLINE_SLICE_MIN_MS and NB_HELPER_DEADLINE_SLICE_MAX_MS and look
+// for events in between. Must be called before any thread waits on the
+// instance.
+OS_Error_t
+nb_helper_set_deadline_timer(
+    nb_helper_t* const nbh,
+    const if_OS_Timer_t* const deadlineTimer);
+
+// To be called from the callback of the deadline timer notification, wakes up
+// the waiting threads to check their deadlines.
+void
+nb_helper_deadline_expired(
+    nb_helper_t* const nbh);
+
+// Enables spinning before blocking, 0 for maxSpins disables it again. A waiting
+// thread then polls its notification up to the spin budget of its wait slot
+// before blocking on it, yielding in between. The budget doubles whenever an
+// event arrived while spinning and halves whenever the thread had to block
+// anyway, between NB_HELPER_SPIN_BUDGET_MIN and maxSpins. poll is the poll
+// function of the notification passed to nb_helper_init(), the wait slots of
+// nb_helper_init_wait_slots() bring their own. A thread collecting the events
+// of a persistent subscription polls the network stack notification instead.
+// Must be called before any thread waits on the instance.
+OS_Error_t
+nb_helper_set_spin(
+    nb_helper_t* const nbh,
+    const event_poll_func_t poll,
+    const uint32_t maxSpins);
+
+// Sets the dispatch priority of a socket, it is reset to NB_HELPER_PRIO_NORMAL
+// when the socket is closed with nb_helper_socket_close().
+OS_Error_t
+nb_helper_set_priority(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const nb_helper_prio_t priority);
+
+// Limits the number of sockets nb_helper_wait_any() hands out per call, 0 lifts
+// the limit again. If more sockets of the set are ready, the most urgent ones
+// are handed out and the others keep their events for a later call. Every
+// NB_HELPER_PRIO_AGING_ROUNDS calls a socket is held back, it counts as one
+// priority level more urgent, so sockets of a low priority are delayed but not
+// starved. Without a limit all ready sockets are handed out and the priorities
+// have no effect. Must be called before any thread waits on the instance.
+OS_Error_t
+nb_helper_set_dispatch_limit(
+    nb_helper_t* const nbh,
+    const size_t maxReady);
+
+// Returns the deadline timeoutMs from now. Requires a timer.
+OS_Error_t
+nb_helper_deadline_in(
+    nb_helper_t* const nbh,
+    const uint32_t timeoutMs,
+    uint64_t* const deadlineMs);
+
+// Returns the time of the timer in ns, OS_ERROR_INVALID_STATE without a timer.
+OS_Error_t
+nb_helper_get_time_ns(
+    nb_helper_t* const nbh,
+    uint64_t* const nowNs);
+
+// Subscribes to the socket events of the network stack of the instance. With
+// persistent set, no callback is registered. The threads waiting in the
+// functions below then block on the event notification of the network stack
+// and collect the events themselves, so the subscription stays armed across
+// deliveries. Otherwise nb_helper_collect_pending_ev_handler() is registered as
+// callback with the instance as argument and re-registers itself on every
+// delivery.
+OS_Error_t
+nb_helper_subscribe(
+    nb_helper_t* const nbh,
+    const bool persistent);
+
 void
 nb_helper_collect_pending_ev_handler(
     void* ctx);
 
 OS_Error_t
 nb_helper_wait_for_network_stack_init(
-    const if_OS_Socket_t* const ctx);
+    nb_helper_t* const nbh);
 
 OS_Error_t
 nb_helper_wait_for_read_ev_on_socket(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle);
+
+// The _until variants return OS_ERROR_TIMEOUT once deadlineMs has passed
+// without a relevant event. They require a timer, see nb_helper_set_timer(),
+// and return its error if it fails.
+OS_Error_t
+nb_helper_wait_for_read_ev_on_socket_until(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const uint64_t deadlineMs);
+
+// Waits until the socket has room for more data to write again, for a write
+// that returned OS_ERROR_TRY_AGAIN.
+OS_Error_t
+nb_helper_wait_for_write_ev_on_socket(
+    nb_helper_t* const nbh,
     const OS_Socket_Handle_t handle);
 
+OS_Error_t
+nb_helper_wait_for_write_ev_on_socket_until(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const uint64_t deadlineMs);
+
 OS_Error_t
 nb_helper_wait_for_conn_est_ev_on_socket(
+    nb_helper_t* const nbh,
     const OS_Socket_Handle_t handle);
 
+OS_Error_t
+nb_helper_wait_for_conn_est_ev_on_socket_until(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const uint64_t deadlineMs);
+
 OS_Error_t
 nb_helper_wait_for_conn_acpt_ev_on_socket(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle);
+
+OS_Error_t
+nb_helper_wait_for_conn_acpt_ev_on_socket_until(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const uint64_t deadlineMs);
+
+// Sets up an empty poll set keeping its sockets in fds, which must stay valid
+// as long as the set is used.
+OS_Error_t
+nb_helper_poll_set_init(
+    nb_helper_t* const nbh,
+    nb_helper_poll_set_t* const set,
+    nb_helper_poll_t* const fds,
+    const size_t maxFds);
+
+// Registers a socket with the set until it is removed again. A socket can only
+// be part of one set at a time. The set uses the wait slot of its first socket,
+// the others are moved to that slot until they are removed, so they must not
+// be waited on by the thread of their own slot meanwhile. Events that are
+// pending already are reported by the next wait. A socket must be removed
+// before it is closed.
+OS_Error_t
+nb_helper_poll_set_add(
+    nb_helper_t* const nbh,
+    nb_helper_poll_set_t* const set,
+    const OS_Socket_Handle_t handle,
+    const uint8_t events,
+    void* const data);
+
+// Removes a socket from the set, its pending events are left for the next one
+// waiting on it. Moves the last socket of the set to the free position.
+OS_Error_t
+nb_helper_poll_set_remove(
+    nb_helper_t* const nbh,
+    nb_helper_poll_set_t* const set,
     const OS_Socket_Handle_t handle);
 
+// Blocks until at least one socket of the set has one of its events of
+// interest pending. Up to maxReady ready sockets are copied to ready with their
+// events in revents, numReady tells how many. The events are consumed, like the
+// single socket wait functions above do. With more sockets ready, or more than
+// the dispatch limit, the most urgent ones are handed out and the others keep
+// their events for a later call.
+OS_Error_t
+nb_helper_wait_any(
+    nb_helper_t* const nbh,
+    nb_helper_poll_set_t* const set,
+    nb_helper_poll_t* const ready,
+    const size_t maxReady,
+    size_t* const numReady);
+
+OS_Error_t
+nb_helper_wait_any_until(
+    nb_helper_t* const nbh,
+    nb_helper_poll_set_t* const set,
+    const uint64_t deadlineMs,
+    nb_helper_poll_t* const ready,
+    const size_t maxReady,
+    size_t* const numReady);
+
 OS_Error_t
 nb_helper_reset_ev_struct_for_socket(
+    nb_helper_t* const nbh,
     const OS_Socket_Handle_t handle);
+
+// Closes the socket and resets its event table entry, so the handle can be
+// reused by the network stack right away. Events of the old socket that are
+// still in flight are dropped instead of showing up for the next socket with
+// the same handle, and threads waiting on the socket return
+// OS_ERROR_INVALID_HANDLE. If OS_Socket_close() fails, the entry is left alone
+// and its error is returned.
+OS_Error_t
+nb_helper_socket_close(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle);
+
+void
+nb_helper_get_stats(
+    nb_helper_t* const nbh,
+    nb_helper_stats_t* const stats);
+
+// Returns the number of event table entries with events, waiters, a close in
+// progress or a priority left. Once all sockets are closed and no thread waits,
+// anything but 0 means that state of the closed sockets leaks into the sockets
+// getting their handles next.
+size_t
+nb_helper_count_busy_entries(
+    nb_helper_t* const nbh);
@@ -0,0 +1,325 @@
+/*
+ * Implementation of the cooperative scheduler for stackless coroutines.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ * 
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "OS_Error.h"
+#include "OS_Socket.h"
+
+#include "lib_debug/Debug.h"
+#include "lib_macros/Check.h"
+
+#include "non_blocking_helper.h"
+#include "pt_sched.h"
+#include "worker_pool.h"
+
+//------------------------------------------------------------------------------
+static void
+run_step(
+    pt_sched_t* const sched,
+    pt_task_t* const task)
+{
+    // A wakeup from before the step is consumed by the step itself.
+    atomic_store(&task->wakePending, false);
+
+    pt_task_state_t state = task->func(task);
+
+    if (state == PT_EXITED)
+    {
+        // Count before the slot becomes visible as free to pt_sched_spawn().
+        atomic_fetch_sub(&sched->numTasks, 1);
+        atomic_store(&task->state, PT_EXITED);
+        return;
+    }
+
+    atomic_store(&task->state, state);
+
+    // pt_sched_wake() may have found the task still running, do what it could
+    // not do then.
+    if ((state == PT_SUSPENDED) && atomic_exchange(&task->wakePending, false))
+    {
+        pt_task_state_t expected = PT_SUSPENDED;
+        atomic_compare_exchange_strong(&task->state, &expected, PT_READY);
+    }
+}
+
+//------------------------------------------------------------------------------
+static void
+run_pool_item(
+    worker_pool_item_t* item)
+{
+    pt_task_t* task = (pt_task_t*)((char*)item - offsetof(pt_task_t, poolItem));
+
+    run_step(task->sched, task);
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+pt_sched_init(
+    pt_sched_t* const sched,
+    nb_helper_t* const nbh,
+    const size_t maxTasks)
+{
+    CHECK_PTR_NOT_NULL(sched);
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_VALUE_IN_RANGE(maxTasks, 1, SIZE_MAX / sizeof(pt_task_t));
+
+    memset(sched, 0, sizeof(*sched));
+
+    sched->tasks   = calloc(maxTasks, sizeof(*sched->tasks));
+    sched->pollSet = calloc(maxTasks, sizeof(*sched->pollSet));
+    sched->ready   = calloc(maxTasks, sizeof(*sched->ready));
+    if ((NULL == sched->tasks) || (NULL == sched->pollSet)
+        || (NULL == sched->ready))
+    {
+        Debug_LOG_ERROR("No memory for %zu tasks", maxTasks);
+        pt_sched_deinit(sched);
+        return OS_ERROR_INSUFFICIENT_SPACE;
+    }
+
+    sched->nbh      = nbh;
+    sched->maxTasks = maxTasks;
+
+    return nb_helper_poll_set_init(nbh, &sched->waitSet, sched->pollSet,
+                                   maxTasks);
+}
+
+//------------------------------------------------------------------------------
+void
+pt_sched_deinit(
+    pt_sched_t* const sched)
+{
+    Debug_ASSERT(NULL != sched);
+
+    // Tasks left waiting by a failed pt_sched_run() are still registered.
+    while ((sched->waitSet.numFds > 0)
+           && (nb_helper_poll_set_remove(
+                   sched->nbh,
+                   &sched->waitSet,
+                   sched->waitSet.fds[0].handle) == OS_SUCCESS))
+    {
+        // The last socket has moved to the front.
+    }
+
+    free(sched->tasks);
+    free(sched->pollSet);
+    free(sched->ready);
+
+    memset(sched, 0, sizeof(*sched));
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+pt_sched_set_pool(
+    pt_sched_t* const sched,
+    worker_pool_t* const pool)
+{
+    CHECK_PTR_NOT_NULL(sched);
+
+    sched->pool = pool;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+pt_sched_spawn(
+    pt_sched_t* const sched,
+    const pt_task_func_t func,
+    void* const arg,
+    pt_task_t** const task)
+{
+    CHECK_PTR_NOT_NULL(sched);
+    CHECK_PTR_NOT_NULL(func);
+
+    for (size_t i = 0; i < sched->maxTasks; i++)
+    {
+        pt_task_t* newTask = &sched->tasks[i];
+
+        // Tasks running on the workers may spawn concurrently.
+        pt_task_state_t expected = PT_EXITED;
+        if (!atomic_compare_exchange_strong(&newTask->state, &expected,
+                                            PT_RUNNING))
+        {
+            continue;
+        }
+
+        newTask->lc            = 0;
+        newTask->func          = func;
+        newTask->arg           = arg;
+        newTask->waitEvents    = 0;
+        newTask->revents       = 0;
+        newTask->polled        = false;
+        newTask->sched         = sched;
+        newTask->poolItem.next = NULL;
+        newTask->poolItem.run  = run_pool_item;
+        atomic_store(&newTask->wakePending, false);
+        atomic_fetch_add(&sched->numTasks, 1);
+        atomic_store(&newTask->state, PT_READY);
+
+        if (NULL != task)
+        {
+            *task = newTask;
+        }
+
+        return OS_SUCCESS;
+    }
+
+    Debug_LOG_ERROR("No room for another task, maximum is %zu",
+                    sched->maxTasks);
+    return OS_ERROR_INSUFFICIENT_SPACE;
+}
+
+//------------------------------------------------------------------------------
+void
+pt_sched_wake(
+    pt_task_t* const task)
+{
+    Debug_ASSERT(NULL != task);
+
+    // Leave a note in case the task is running right now, run_step() picks it
+    // up when the task suspends.
+    atomic_store(&task->wakePending, true);
+
+    pt_task_state_t expected = PT_SUSPENDED;
+    atomic_compare_exchange_strong(&task->state, &expected, PT_READY);
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+pt_sched_run(
+    pt_sched_t* const sched)
+{
+    CHECK_PTR_NOT_NULL(sched);
+
+    while (atomic_load(&sched->numTasks) > 0)
+    {
+        bool anyReady = false;
+
+        sched->stats.rounds++;
+
+        // Give every task that can make progress one step. Without a pool,
+        // tasks spawned or woken up during the round may already run in this
+        // round, with a pool they run in the next one.
+        for (size_t i = 0; i < sched->maxTasks; i++)
+        {
+            pt_task_t* task = &sched->tasks[i];
+
+            if (atomic_load(&task->state) != PT_READY)
+            {
+                continue;
+            }
+
+            atomic_store(&task->state, PT_RUNNING);
+            sched->stats.steps++;
+
+            if (NULL != sched->pool)
+            {
+                worker_pool_submit(sched->pool, &task->poolItem);
+            }
+            else
+            {
+                run_step(sched, task);
+            }
+        }
+
+        if (NULL != sched->pool)
+        {
+            worker_pool_wait_idle(sched->pool);
+        }
+
+        for (size_t i = 0; i < sched->maxTasks; i++)
+        {
+            pt_task_t* task = &sched->tasks[i];
+            pt_task_state_t state = atomic_load(&task->state);
+
+            if ((state == PT_WAITING) && !task->polled)
+            {
+                // Started waiting in this round, tasks still waiting from
+                // before are registered already.
+                OS_Error_t err = nb_helper_poll_set_add(
+                                     sched->nbh,
+                                     &sched->waitSet,
+                                     task->waitHandle,
+                                     task->waitEvents,
+                                     task);
+                if (err != OS_SUCCESS)
+                {
+                    Debug_LOG_ERROR("nb_helper_poll_set_add() failed, code %d",
+                                    err);
+                    return err;
+                }
+                task->polled = true;
+            }
+            else if (state == PT_READY)
+            {
+                anyReady = true;
+            }
+        }
+
+        if (0 == sched->waitSet.numFds)
+        {
+            if (!anyReady && (atomic_load(&sched->numTasks) > 0))
+            {
+                // Only suspended tasks are left, nobody can wake them up.
+                Debug_LOG_ERROR("All %zu tasks are suspended",
+                                atomic_load(&sched->numTasks));
+                return OS_ERROR_INVALID_STATE;
+            }
+            continue;
+        }
+
+        // Block only if no task is ready to run, otherwise just pick up the
+        // events that are already pending.
+        size_t numReady = 0;
+        OS_Error_t err = nb_helper_wait_any_until(
+                             sched->nbh,
+                             &sched->waitSet,
+                             anyReady ?
+                             NB_HELPER_DEADLINE_NOW : NB_HELPER_NO_DEADLINE,
+                             sched->ready,
+                             sched->maxTasks,
+                             &numReady);
+        if (err == OS_ERROR_TIMEOUT)
+        {
+            continue;
+        }
+        if (err != OS_SUCCESS)
+        {
+            Debug_LOG_ERROR("nb_helper_wait_any_until() failed, code %d", err);
+            return err;
+        }
+
+        if (!anyReady)
+        {
+            sched->stats.waits++;
+        }
+
+        for (size_t r = 0; r < numReady; r++)
+        {
+            pt_task_t* task = sched->ready[r].data;
+
+            err = nb_helper_poll_set_remove(sched->nbh, &sched->waitSet,
+                                            task->waitHandle);
+            Debug_ASSERT(err == OS_SUCCESS);
+
+            task->polled = false;
+            task->revents = sched->ready[r].revents;
+            atomic_store(&task->state, PT_READY);
+        }
+    }
+
+    return OS_SUCCESS;
+}
@@ -0,0 +1,179 @@
+/*
+ * Cooperative scheduler for stackless coroutines driven by the socket events of
+ * a non-blocking helper instance.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ * 
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "OS_Error.h"
+#include "OS_Socket.h"
+
+#include "non_blocking_helper.h"
+#include "worker_pool.h"
+
+/*
+ * A task is written as sequential code, but returns to the scheduler whenever
+ * it has to wait, like a protothread. On the next step the task function is
+ * entered from the top again and PT_BEGIN() jumps back to where it stopped.
+ * This has some consequences for the task function:
+ *  - local variables are not kept across PT_WAIT_EVENTS(), PT_YIELD() and
+ *    PT_SUSPEND(), anything needed afterwards must live in the object passed
+ *    as argument to pt_sched_spawn(),
+ *  - these macros must not be used inside a switch statement of the task and
+ *    at most once per source line.
+ *
+ * A socket must only be waited on by one task at a time. While a socket is in
+ * the set of the scheduler, no other thread may wait on it or on the wait slot
+ * of the set, see nb_helper_poll_set_init().
+ *
+ * With a worker pool set, the steps of a round are run in parallel by the
+ * workers and the thread calling pt_sched_run() only waits for socket events
+ * between the rounds. A task still never runs on two threads at once, but
+ * anything it shares with other tasks must then be accessed atomically. A task
+ * woken up by pt_sched_wake() must check again whatever it suspended for.
+ */
+
+typedef enum
+{
+    PT_EXITED = 0, // task has finished, its slot is free again
+    PT_READY,      // task is run in the next round
+    PT_WAITING,    // task waits for events of a socket
+    PT_SUSPENDED,  // task waits for pt_sched_wake()
+    PT_RUNNING     // task is being run or set up
+} pt_task_state_t;
+
+typedef struct pt_task pt_task_t;
+
+typedef pt_task_state_t (*pt_task_func_t)(pt_task_t* task);
+
+struct pt_task
+{
+    unsigned int            lc;          // line to continue at, 0 for the start
+    _Atomic pt_task_state_t state;
+    _Atomic bool            wakePending; // pt_sched_wake() during a step
+    pt_task_func_t          func;
+    void*                   arg;
+    OS_Socket_Handle_t      waitHandle;  // socket of PT_WAIT_EVENTS()
+    uint8_t                 waitEvents;  // interest mask of PT_WAIT_EVENTS()
+    uint8_t                 revents;     // events that ended PT_WAIT_EVENTS()
+    bool                    polled;      // waitHandle is in the poll set
+    struct pt_sched*        sched;
+    worker_pool_item_t      poolItem;
+};
+
+typedef struct
+{
+    uint32_t steps;  // task function invocations
+    uint32_t rounds; // scheduler rounds
+    uint32_t waits;  // blocking waits for socket events
+} pt_sched_stats_t;
+
+// Scheduler instance, owned by the caller and only to be accessed through the
+// functions below. Without a worker pool all tasks run on the thread calling
+// pt_sched_run().
+typedef struct pt_sched
+{
+    nb_helper_t*      nbh;
+    worker_pool_t*    pool;
+    pt_task_t*        tasks;
+    size_t            maxTasks;
+    _Atomic size_t    numTasks;
+    // Sockets of the waiting tasks, registered once when a task starts
+    // waiting and removed when it is woken up by an event.
+    nb_helper_poll_set_t waitSet;
+    nb_helper_poll_t* pollSet;
+    nb_helper_poll_t* ready;
+    pt_sched_stats_t  stats;
+} pt_sched_t;
+
+#define PT_BEGIN(task) \
+    switch ((task)->lc) \
+    { \
+    case 0:
+
+#define PT_END(task) \
+    } \
+    (task)->lc = 0; \
+    return PT_EXITED
+
+#define PT_EXIT(task) \
+    do \
+    { \
+        (task)->lc = 0; \
+        return PT_EXITED; \
+    } while (0)
+
+// Stops the task in the given state and continues right here on the next step.
+#define PT_STOP_AND_CONTINUE(task, _state_) \
+    do \
+    { \
+        (task)->lc = __LINE__; \
+        return (_state_); \
+    case __LINE__:; \
+    } while (0)
+
+// Lets the other tasks run once before continuing.
+#define PT_YIELD(task) \
+    PT_STOP_AND_CONTINUE(task, PT_READY)
+
+// Stops the task until another task calls pt_sched_wake() for it.
+#define PT_SUSPEND(task) \
+    PT_STOP_AND_CONTINUE(task, PT_SUSPENDED)
+
+// Stops the task until one of the events (or an error, close or, when waiting
+// for OS_SOCK_EV_READ, FIN) is pending for the socket. The events are consumed
+// and reported in (task)->revents.
+#define PT_WAIT_EVENTS(task, _handle_, _events_) \
+    do \
+    { \
+        (task)->waitHandle = (_handle_); \
+        (task)->waitEvents = (_events_); \
+        PT_STOP_AND_CONTINUE(task, PT_WAITING); \
+    } while (0)
+
+//------------------------------------------------------------------------------
+OS_Error_t
+pt_sched_init(
+    pt_sched_t* const sched,
+    nb_helper_t* const nbh,
+    const size_t maxTasks);
+
+void
+pt_sched_deinit(
+    pt_sched_t* const sched);
+
+// Runs the steps of the tasks on the workers of the pool, NULL runs them on the
+// calling thread again. Must not be called while pt_sched_run() is active.
+OS_Error_t
+pt_sched_set_pool(
+    pt_sched_t* const sched,
+    worker_pool_t* const pool);
+
+// Adds a task, it runs for the first time in the current or next round of the
+// scheduler. The task pointer is optional and returned for pt_sched_wake().
+OS_Error_t
+pt_sched_spawn(
+    pt_sched_t* const sched,
+    const pt_task_func_t func,
+    void* const arg,
+    pt_task_t** const task);
+
+void
+pt_sched_wake(
+    pt_task_t* const task);
+
+// Runs the tasks until all of them have exited.
+OS_Error_t
+pt_sched_run(
+    pt_sched_t* const sched);
@@ -0,0 +1,536 @@
+/*
+ * Implementation of the socket I/O helpers.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "OS_Dataport.h"
+#include "OS_Error.h"
+#include "OS_Socket.h"
+
+#include "lib_debug/Debug.h"
+#include "lib_macros/Check.h"
+
+#include "non_blocking_helper.h"
+#include "socket_io.h"
+
+// Bytes the commits sent straight out of the dataport.
+static _Atomic uint64_t bytesNotCopied;
+
+//------------------------------------------------------------------------------
+static size_t
+dataport_size(
+    const OS_Socket_Handle_t* const handle)
+{
+    return OS_Dataport_getSize(handle->ctx.dataport);
+}
+
+//------------------------------------------------------------------------------
+static void
+stats_start(
+    nb_helper_t* const nbh,
+    socket_io_stats_t* const stats,
+    uint64_t* const startNs)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    // Untimed without a timer.
+    if (nb_helper_get_time_ns(nbh, startNs) != OS_SUCCESS)
+    {
+        *startNs = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+static void
+stats_finish(
+    nb_helper_t* const nbh,
+    socket_io_stats_t* const stats,
+    const uint64_t startNs,
+    const char* const what)
+{
+    uint64_t endNs = 0;
+
+    if ((startNs > 0) && (nb_helper_get_time_ns(nbh, &endNs) == OS_SUCCESS))
+    {
+        stats->elapsedNs = endNs - startNs;
+    }
+
+    Debug_LOG_DEBUG("%s: %zu bytes, %u RPCs, %u waits, %" PRIu64 " bytes/s",
+                    what, stats->bytes, stats->rpcs, stats->waits,
+                    socket_io_bytes_per_sec(stats));
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+socket_io_writev(
+    const OS_Socket_Handle_t handle,
+    const socket_io_vec_t* const vec,
+    const size_t numVec,
+    size_t* const actualLen)
+{
+    CHECK_PTR_NOT_NULL(actualLen);
+
+    *actualLen = 0;
+
+    if (handle.handleID < 0)
+    {
+        return OS_ERROR_INVALID_HANDLE;
+    }
+    if (numVec > 0)
+    {
+        CHECK_PTR_NOT_NULL(vec);
+    }
+    for (size_t i = 0; i < numVec; i++)
+    {
+        if ((vec[i].len > 0) && (NULL == vec[i].buf))
+        {
+            return OS_ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    const if_OS_Socket_t* ctx = &handle.ctx;
+    uint8_t* const dst = OS_Dataport_getBuf(ctx->dataport);
+    const size_t dstSize = OS_Dataport_getSize(ctx->dataport);
+    size_t len = 0;
+
+    ctx->shared_resource_mutex_lock();
+
+    for (size_t i = 0; (i < numVec) && (len < dstSize); i++)
+    {
+        const size_t n = (vec[i].len < dstSize - len) ?
+                         vec[i].len : dstSize - len;
+
+        memcpy(&dst[len], vec[i].buf, n);
+        len += n;
+    }
+
+    OS_Error_t err = OS_SUCCESS;
+    if (len > 0)
+    {
+        err = ctx->socket_write(handle.handleID, &len);
+    }
+
+    ctx->shared_resource_mutex_unlock();
+
+    if (err == OS_SUCCESS)
+    {
+        *actualLen = len;
+    }
+
+    return err;
+}
+
+//------------------------------------------------------------------------------
+void
+socket_io_vec_consume(
+    socket_io_vec_t** const vec,
+    size_t* const numVec,
+    size_t len)
+{
+    Debug_ASSERT((NULL != vec) && (NULL != numVec));
+
+    while ((*numVec > 0) && (len >= (*vec)->len))
+    {
+        len -= (*vec)->len;
+        (*vec)++;
+        (*numVec)--;
+    }
+
+    Debug_ASSERT((*numVec > 0) || (0 == len));
+
+    if (*numVec > 0)
+    {
+        (*vec)->buf  = (const uint8_t*)(*vec)->buf + len;
+        (*vec)->len -= len;
+    }
+}
+
+//------------------------------------------------------------------------------
+size_t
+socket_io_vec_len(
+    const socket_io_vec_t* const vec,
+    const size_t numVec)
+{
+    size_t len = 0;
+
+    for (size_t i = 0; i < numVec; i++)
+    {
+        len += vec[i].len;
+    }
+
+    return len;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+socket_io_write_all(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const void* const buf,
+    const size_t len,
+    const uint64_t deadlineMs,
+    socket_io_stats_t* const stats)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(buf);
+
+    socket_io_stats_t localStats;
+    socket_io_stats_t* const s = (NULL != stats) ? stats : &localStats;
+    const size_t chunkSize = dataport_size(&handle);
+    uint64_t startNs;
+    OS_Error_t err = OS_SUCCESS;
+
+    stats_start(nbh, s, &startNs);
+
+    while (s->bytes < len)
+    {
+        const size_t left = len - s->bytes;
+        size_t lenWritten = 0;
+
+        err = OS_Socket_write(
+                  handle,
+                  (const uint8_t*)buf + s->bytes,
+                  (left < chunkSize) ? left : chunkSize,
+                  &lenWritten);
+        s->rpcs++;
+
+        if ((err == OS_ERROR_TRY_AGAIN)
+            || ((err == OS_SUCCESS) && (0 == lenWritten)))
+        {
+            // The socket buffer is full, wait until the stack has sent some of
+            // it.
+            s->waits++;
+            err = nb_helper_wait_for_write_ev_on_socket_until(
+                      nbh,
+                      handle,
+                      deadlineMs);
+        }
+        if (err != OS_SUCCESS)
+        {
+            break;
+        }
+
+        s->bytes += lenWritten;
+    }
+
+    stats_finish(nbh, s, startNs, "write_all");
+
+    return err;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+socket_io_read_exact(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    void* const buf,
+    const size_t len,
+    const uint64_t deadlineMs,
+    socket_io_stats_t* const stats)
+{
+    CHECK_PTR_NOT_NULL(nbh);
+    CHECK_PTR_NOT_NULL(buf);
+
+    socket_io_stats_t localStats;
+    socket_io_stats_t* const s = (NULL != stats) ? stats : &localStats;
+    const size_t chunkSize = dataport_size(&handle);
+    uint64_t startNs;
+    OS_Error_t err = OS_SUCCESS;
+
+    stats_start(nbh, s, &startNs);
+
+    while (s->bytes < len)
+    {
+        const size_t left = len - s->bytes;
+        size_t lenRead = 0;
+
+        err = OS_Socket_read(
+                  handle,
+                  (uint8_t*)buf + s->bytes,
+                  (left < chunkSize) ? left : chunkSize,
+                  &lenRead);
+        s->rpcs++;
+
+        if ((err == OS_ERROR_TRY_AGAIN)
+            || ((err == OS_SUCCESS) && (0 == lenRead)))
+        {
+            // Everything received so far has been read, wait for more.
+            s->waits++;
+            err = nb_helper_wait_for_read_ev_on_socket_until(
+                      nbh,
+                      handle,
+                      deadlineMs);
+        }
+        if (err != OS_SUCCESS)
+        {
+            break;
+        }
+
+        s->bytes += lenRead;
+    }
+
+    stats_finish(nbh, s, startNs, "read_exact");
+
+    return err;
+}
+
+//------------------------------------------------------------------------------
+uint64_t
+socket_io_bytes_per_sec(
+    const socket_io_stats_t* const stats)
+{
+    Debug_ASSERT(NULL != stats);
+
+    if (0 == stats->elapsedNs)
+    {
+        return 0;
+    }
+
+    return (uint64_t) stats->bytes * 1000000000 / stats->elapsedNs;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+socket_io_read_loan(
+    const OS_Socket_Handle_t handle,
+    const size_t maxLen,
+    socket_io_loan_t* const loan)
+{
+    CHECK_PTR_NOT_NULL(loan);
+
+    memset(loan, 0, sizeof(*loan));
+
+    if (handle.handleID < 0)
+    {
+        return OS_ERROR_INVALID_HANDLE;
+    }
+
+    const if_OS_Socket_t* ctx = &handle.ctx;
+    const size_t dataportSize = OS_Dataport_getSize(ctx->dataport);
+    size_t len = (maxLen < dataportSize) ? maxLen : dataportSize;
+
+    ctx->shared_resource_mutex_lock();
+
+    OS_Error_t err = ctx->socket_read(handle.handleID, &len);
+    if ((err != OS_SUCCESS) || (0 == len))
+    {
+        ctx->shared_resource_mutex_unlock();
+        return err;
+    }
+
+    loan->buf    = OS_Dataport_getBuf(ctx->dataport);
+    loan->len    = len;
+    loan->unlock = ctx->shared_resource_mutex_unlock;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+socket_io_recvfrom_loan(
+    const OS_Socket_Handle_t handle,
+    const size_t maxLen,
+    socket_io_loan_t* const loan,
+    OS_Socket_Addr_t* const srcAddr)
+{
+    CHECK_PTR_NOT_NULL(loan);
+
+    memset(loan, 0, sizeof(*loan));
+
+    CHECK_PTR_NOT_NULL(srcAddr);
+
+    if (handle.handleID < 0)
+    {
+        return OS_ERROR_INVALID_HANDLE;
+    }
+
+    const if_OS_Socket_t* ctx = &handle.ctx;
+    const size_t dataportSize = OS_Dataport_getSize(ctx->dataport);
+    size_t len = (maxLen < dataportSize) ? maxLen : dataportSize;
+
+    ctx->shared_resource_mutex_lock();
+
+    OS_Error_t err = ctx->socket_recvfrom(handle.handleID, &len, srcAddr);
+    if ((err != OS_SUCCESS) || (0 == len))
+    {
+        ctx->shared_resource_mutex_unlock();
+        return err;
+    }
+
+    loan->buf    = OS_Dataport_getBuf(ctx->dataport);
+    loan->len    = len;
+    loan->unlock = ctx->shared_resource_mutex_unlock;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+void
+socket_io_loan_release(
+    socket_io_loan_t* const loan)
+{
+    Debug_ASSERT(NULL != loan);
+
+    if (NULL != loan->unlock)
+    {
+        loan->unlock();
+    }
+
+    memset(loan, 0, sizeof(*loan));
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+socket_io_tx_acquire(
+    const OS_Socket_Handle_t handle,
+    socket_io_tx_t* const tx)
+{
+    CHECK_PTR_NOT_NULL(tx);
+
+    memset(tx, 0, sizeof(*tx));
+
+    if (handle.handleID < 0)
+    {
+        return OS_ERROR_INVALID_HANDLE;
+    }
+
+    const if_OS_Socket_t* ctx = &handle.ctx;
+
+    ctx->shared_resource_mutex_lock();
+
+    tx->buf    = OS_Dataport_getBuf(ctx->dataport);
+    tx->size   = OS_Dataport_getSize(ctx->dataport);
+    tx->unlock = ctx->shared_resource_mutex_unlock;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+void
+socket_io_tx_acquire_loan(
+    socket_io_loan_t* const loan,
+    socket_io_tx_t* const tx)
+{
+    Debug_ASSERT((NULL != loan) && (NULL != loan->unlock));
+    Debug_ASSERT(NULL != tx);
+
+    // The loan does not know the size of the dataport, the buffer is limited
+    // to the received data.
+    tx->buf    = (void*)loan->buf;
+    tx->size   = loan->len;
+    tx->unlock = loan->unlock;
+
+    memset(loan, 0, sizeof(*loan));
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+socket_io_tx_commit(
+    const OS_Socket_Handle_t handle,
+    socket_io_tx_t* const tx,
+    const size_t len,
+    size_t* const actualLen)
+{
+    CHECK_PTR_NOT_NULL(tx);
+    CHECK_PTR_NOT_NULL(actualLen);
+
+    *actualLen = 0;
+
+    if (NULL == tx->unlock)
+    {
+        return OS_ERROR_INVALID_STATE;
+    }
+    if (handle.handleID < 0)
+    {
+        return OS_ERROR_INVALID_HANDLE;
+    }
+    if (len > tx->size)
+    {
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    size_t lenWritten = len;
+    OS_Error_t err = handle.ctx.socket_write(handle.handleID, &lenWritten);
+    if (err == OS_SUCCESS)
+    {
+        *actualLen = lenWritten;
+        atomic_fetch_add_explicit(&bytesNotCopied, lenWritten,
+                                  memory_order_relaxed);
+    }
+
+    return err;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+socket_io_tx_commit_to(
+    const OS_Socket_Handle_t handle,
+    socket_io_tx_t* const tx,
+    const size_t len,
+    size_t* const actualLen,
+    const OS_Socket_Addr_t* const dstAddr)
+{
+    CHECK_PTR_NOT_NULL(tx);
+    CHECK_PTR_NOT_NULL(actualLen);
+    CHECK_PTR_NOT_NULL(dstAddr);
+
+    *actualLen = 0;
+
+    if (NULL == tx->unlock)
+    {
+        return OS_ERROR_INVALID_STATE;
+    }
+    if (handle.handleID < 0)
+    {
+        return OS_ERROR_INVALID_HANDLE;
+    }
+    if (len > tx->size)
+    {
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    size_t lenWritten = len;
+    OS_Error_t err = handle.ctx.socket_sendto(handle.handleID, &lenWritten,
+                                              dstAddr);
+    if (err == OS_SUCCESS)
+    {
+        *actualLen = lenWritten;
+        atomic_fetch_add_explicit(&bytesNotCopied, lenWritten,
+                                  memory_order_relaxed);
+    }
+
+    return err;
+}
+
+//------------------------------------------------------------------------------
+void
+socket_io_tx_release(
+    socket_io_tx_t* const tx)
+{
+    Debug_ASSERT(NULL != tx);
+
+    if (NULL != tx->unlock)
+    {
+        tx->unlock();
+    }
+
+    memset(tx, 0, sizeof(*tx));
+}
+
+//------------------------------------------------------------------------------
+uint64_t
+socket_io_get_bytes_not_copied(void)
+{
+    return atomic_load_explicit(&bytesNotCopied, memory_order_relaxed);
+}
@@ -0,0 +1,208 @@
+/*
+ * Socket I/O on top of the client side of the socket interface.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "OS_Error.h"
+#include "OS_Socket.h"
+
+#include "non_blocking_helper.h"
+
+/*
+ * OS_Socket_write() copies the buffer into the dataport shared with the network
+ * stack and issues one RPC for it. Data that is spread over several buffers
+ * either costs one RPC per buffer or a copy into a buffer of its own first.
+ * socket_io_writev() gathers the buffers straight into the dataport instead and
+ * sends them with a single RPC.
+ *
+ * The dataport is shared by all sockets of the component, it is accessed under
+ * the same mutex the socket client uses.
+ *
+ * A single read or write moves at most the size of the dataport, more is
+ * silently cut off. socket_io_write_all() and socket_io_read_exact() split a
+ * transfer into pieces of the dataport size and issue them back to back, so
+ * the network stack always has the next piece before the previous one is on
+ * the wire. Only if the socket buffer is full or empty they block on the write
+ * or read event of the socket instead of retrying right away.
+ *
+ * socket_io_read_loan() leaves the received data in the dataport and lends it
+ * to the caller instead of copying it out. The dataport stays locked until the
+ * loan is returned, so the caller must not call any other socket function or
+ * wait for events in between, and should return it quickly.
+ *
+ * The transmit side works the same way. socket_io_tx_acquire() locks the
+ * dataport and hands it out, the caller composes the payload in place and
+ * sends it with socket_io_tx_commit() or socket_io_tx_commit_to(), which skip
+ * the copy OS_Socket_write() and OS_Socket_sendto() make. A read loan can be
+ * turned into a transmit buffer with the received data still in place, so an
+ * echo does not copy the data at all.
+ *
+ * socket_io_get_bytes_not_copied() counts the bytes the commits sent straight
+ * out of the dataport, over all sockets of the component. A loan alone does not
+ * count, its data may still be copied out by the caller.
+ */
+
+// Fragment of the data to write.
+typedef struct
+{
+    const void* buf;
+    size_t      len;
+} socket_io_vec_t;
+
+// Cost of a transfer, filled by the streaming functions.
+typedef struct
+{
+    size_t   bytes;     // bytes moved, also if the transfer failed
+    uint32_t rpcs;      // read or write RPCs
+    uint32_t waits;     // waits for the socket to become ready again
+    uint64_t elapsedNs; // duration of the call, 0 without a timer
+} socket_io_stats_t;
+
+// Data received into the dataport, only valid until socket_io_loan_release().
+typedef struct
+{
+    const void*         buf;
+    size_t              len;
+    // Set while the dataport is locked.
+    mutex_unlock_func_t unlock;
+} socket_io_loan_t;
+
+// Dataport handed out for composing data to send in place.
+typedef struct
+{
+    void*               buf;
+    size_t              size;
+    // Set while the dataport is locked.
+    mutex_unlock_func_t unlock;
+} socket_io_tx_t;
+
+//------------------------------------------------------------------------------
+// Writes the fragments in their order with one RPC. Like OS_Socket_write() it
+// may write less than requested, at most the size of the dataport, and returns
+// how much in actualLen. Without any data nothing is sent.
+OS_Error_t
+socket_io_writev(
+    const OS_Socket_Handle_t handle,
+    const socket_io_vec_t* const vec,
+    const size_t numVec,
+    size_t* const actualLen);
+
+// Drops the first len bytes from the fragments, to continue after a partial
+// write. Fragments that are used up are skipped by advancing vec, the first
+// remaining one is shortened in place.
+void
+socket_io_vec_consume(
+    socket_io_vec_t** const vec,
+    size_t* const numVec,
+    size_t len);
+
+// Total length of the fragments.
+size_t
+socket_io_vec_len(
+    const socket_io_vec_t* const vec,
+    const size_t numVec);
+
+// Writes all len bytes, waiting for room in the socket buffer as needed. stats
+// is optional. Returns OS_ERROR_TIMEOUT once deadlineMs has passed, see
+// nb_helper_wait_for_write_ev_on_socket_until().
+OS_Error_t
+socket_io_write_all(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    const void* const buf,
+    const size_t len,
+    const uint64_t deadlineMs,
+    socket_io_stats_t* const stats);
+
+// Reads exactly len bytes, waiting for data as needed. stats is optional. If
+// the peer closes the connection before, OS_ERROR_NETWORK_CONN_SHUTDOWN is
+// returned and stats tells how much was read.
+OS_Error_t
+socket_io_read_exact(
+    nb_helper_t* const nbh,
+    const OS_Socket_Handle_t handle,
+    void* const buf,
+    const size_t len,
+    const uint64_t deadlineMs,
+    socket_io_stats_t* const stats);
+
+// Throughput of a transfer, 0 if it was not timed.
+uint64_t
+socket_io_bytes_per_sec(
+    const socket_io_stats_t* const stats);
+
+// Reads up to maxLen bytes like OS_Socket_read(), at most the size of the
+// dataport, but lends them to the caller in place. On success with a length
+// above 0 the loan must be returned with socket_io_loan_release(), otherwise
+// nothing is held.
+OS_Error_t
+socket_io_read_loan(
+    const OS_Socket_Handle_t handle,
+    const size_t maxLen,
+    socket_io_loan_t* const loan);
+
+// Returns the dataport to the socket client, does nothing if nothing is held.
+void
+socket_io_loan_release(
+    socket_io_loan_t* const loan);
+
+// Like socket_io_read_loan() for a datagram socket, returns the sender in
+// srcAddr.
+OS_Error_t
+socket_io_recvfrom_loan(
+    const OS_Socket_Handle_t handle,
+    const size_t maxLen,
+    socket_io_loan_t* const loan,
+    OS_Socket_Addr_t* const srcAddr);
+
+// Locks the dataport of the socket and hands it out to compose data in place.
+// Must be given back with socket_io_tx_release().
+OS_Error_t
+socket_io_tx_acquire(
+    const OS_Socket_Handle_t handle,
+    socket_io_tx_t* const tx);
+
+// Takes over the dataport of a read loan, the received data stays at the start
+// of the buffer, which is as large as the data. The loan is empty afterwards.
+void
+socket_io_tx_acquire_loan(
+    socket_io_loan_t* const loan,
+    socket_io_tx_t* const tx);
+
+// Sends the first len bytes of the buffer like OS_Socket_write(), returning how
+// much was written in actualLen. The buffer stays acquired, so the rest of a
+// partial write is still in place.
+OS_Error_t
+socket_io_tx_commit(
+    const OS_Socket_Handle_t handle,
+    socket_io_tx_t* const tx,
+    const size_t len,
+    size_t* const actualLen);
+
+// Sends the first len bytes of the buffer like OS_Socket_sendto(). The buffer
+// stays acquired.
+OS_Error_t
+socket_io_tx_commit_to(
+    const OS_Socket_Handle_t handle,
+    socket_io_tx_t* const tx,
+    const size_t len,
+    size_t* const actualLen,
+    const OS_Socket_Addr_t* const dstAddr);
+
+// Gives the dataport back, does nothing if nothing is held.
+void
+socket_io_tx_release(
+    socket_io_tx_t* const tx);
+
+uint64_t
+socket_io_get_bytes_not_copied(void);
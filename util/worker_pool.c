@@ -0,0 +1,406 @@
+/*
+ * Implementation of the work-stealing worker pool.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "OS_Error.h"
+
+#include "lib_debug/Debug.h"
+#include "lib_macros/Check.h"
+
+#include "worker_pool.h"
+
+#define DEQUE_MASK (WORKER_POOL_DEQUE_SIZE - 1)
+
+_Static_assert((WORKER_POOL_DEQUE_SIZE & DEQUE_MASK) == 0,
+               "WORKER_POOL_DEQUE_SIZE must be a power of two");
+
+//------------------------------------------------------------------------------
+// Deque operations, see "Correct and Efficient Work-Stealing for Weak Memory
+// Models" (Lê et al., PPoPP 2013) for the memory orders.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Only called by the worker owning the deque.
+static bool
+deque_push(
+    worker_pool_worker_t* const w,
+    worker_pool_item_t* const item)
+{
+    const int64_t b = atomic_load_explicit(&w->bottom, memory_order_relaxed);
+    const int64_t t = atomic_load_explicit(&w->top, memory_order_acquire);
+
+    if (b - t >= WORKER_POOL_DEQUE_SIZE)
+    {
+        return false;
+    }
+
+    atomic_store_explicit(&w->buffer[b & DEQUE_MASK], item,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Only called by the worker owning the deque, takes the newest item.
+static worker_pool_item_t*
+deque_take(
+    worker_pool_worker_t* const w)
+{
+    const int64_t b = atomic_load_explicit(&w->bottom,
+                                           memory_order_relaxed) - 1;
+    atomic_store_explicit(&w->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&w->top, memory_order_relaxed);
+
+    if (t > b)
+    {
+        // Empty.
+        atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    worker_pool_item_t* item = atomic_load_explicit(&w->buffer[b & DEQUE_MASK],
+                                                    memory_order_relaxed);
+    if (t == b)
+    {
+        // Last item, race against the thieves for it.
+        if (!atomic_compare_exchange_strong_explicit(&w->top, &t, t + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed))
+        {
+            item = NULL;
+        }
+        atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return item;
+}
+
+//------------------------------------------------------------------------------
+// Called by any other worker, takes the oldest item. Returns NULL if the deque
+// is empty or another thread got the item first.
+static worker_pool_item_t*
+deque_steal(
+    worker_pool_worker_t* const w)
+{
+    int64_t t = atomic_load_explicit(&w->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    const int64_t b = atomic_load_explicit(&w->bottom, memory_order_acquire);
+
+    if (t >= b)
+    {
+        return NULL;
+    }
+
+    worker_pool_item_t* item = atomic_load_explicit(&w->buffer[t & DEQUE_MASK],
+                                                    memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&w->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+    {
+        return NULL;
+    }
+
+    return item;
+}
+
+//------------------------------------------------------------------------------
+static bool
+deque_is_empty(
+    worker_pool_worker_t* const w)
+{
+    return atomic_load(&w->top) >= atomic_load(&w->bottom);
+}
+
+//------------------------------------------------------------------------------
+static void
+run_item(
+    worker_pool_t* const pool,
+    worker_pool_worker_t* const w,
+    worker_pool_item_t* const item)
+{
+    item->run(item);
+    atomic_fetch_add_explicit(&w->itemsRun, 1, memory_order_relaxed);
+
+    if (atomic_fetch_sub(&pool->outstanding, 1) == 1)
+    {
+        pool->done_notify();
+    }
+}
+
+//------------------------------------------------------------------------------
+// Moves the submitted items into the deque, oldest first.
+static void
+move_inbox_to_deque(
+    worker_pool_t* const pool,
+    worker_pool_worker_t* const w)
+{
+    worker_pool_item_t* list = atomic_exchange(&w->inbox, NULL);
+    worker_pool_item_t* fifo = NULL;
+
+    while (NULL != list)
+    {
+        worker_pool_item_t* next = list->next;
+        list->next = fifo;
+        fifo = list;
+        list = next;
+    }
+
+    while (NULL != fifo)
+    {
+        worker_pool_item_t* next = fifo->next;
+        if (!deque_push(w, fifo))
+        {
+            // Deque is full, there is no point in queuing it anywhere else.
+            run_item(pool, w, fifo);
+        }
+        fifo = next;
+    }
+}
+
+//------------------------------------------------------------------------------
+static worker_pool_item_t*
+steal_item(
+    worker_pool_t* const pool,
+    worker_pool_worker_t* const w)
+{
+    const size_t self = (size_t)(w - pool->workers);
+
+    for (size_t i = 1; i < pool->numWorkers; i++)
+    {
+        worker_pool_worker_t* victim =
+            &pool->workers[(self + i) % pool->numWorkers];
+
+        worker_pool_item_t* item = deque_steal(victim);
+        if (NULL != item)
+        {
+            atomic_fetch_add_explicit(&w->itemsStolen, 1,
+                                      memory_order_relaxed);
+            return item;
+        }
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+static bool
+has_visible_work(
+    worker_pool_t* const pool,
+    worker_pool_worker_t* const w)
+{
+    if (NULL != atomic_load(&w->inbox))
+    {
+        return true;
+    }
+
+    for (size_t i = 0; i < pool->numWorkers; i++)
+    {
+        if (!deque_is_empty(&pool->workers[i]))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// Runs on the callback thread of the worker notification.
+static void
+worker_wake_handler(
+    void* ctx)
+{
+    worker_pool_worker_t* w = ctx;
+    worker_pool_t* pool = w->pool;
+
+    atomic_fetch_add_explicit(&w->wakeups, 1, memory_order_relaxed);
+    atomic_store(&w->idle, false);
+
+    for (;;)
+    {
+        move_inbox_to_deque(pool, w);
+
+        worker_pool_item_t* item = deque_take(w);
+        if (NULL == item)
+        {
+            item = steal_item(pool, w);
+        }
+        if (NULL != item)
+        {
+            run_item(pool, w, item);
+            continue;
+        }
+
+        // Announce going to sleep before the last look for work, a submit
+        // racing with it then either is seen here or emits a wakeup.
+        atomic_store(&w->idle, true);
+        if (!has_visible_work(pool, w))
+        {
+            break;
+        }
+        atomic_store(&w->idle, false);
+    }
+
+    int ret = w->thread.reg_callback(worker_wake_handler, w);
+    if (0 != ret)
+    {
+        Debug_LOG_ERROR("Failed to re-register worker %zu, code %d",
+                        (size_t)(w - pool->workers), ret);
+    }
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+worker_pool_init(
+    worker_pool_t* const pool,
+    const worker_pool_thread_t* const threads,
+    const size_t numWorkers,
+    const event_notify_func_t done_notify,
+    const event_wait_func_t done_wait)
+{
+    CHECK_PTR_NOT_NULL(pool);
+    CHECK_PTR_NOT_NULL(threads);
+    CHECK_VALUE_IN_RANGE(numWorkers, 1, WORKER_POOL_MAX_WORKERS + 1);
+    CHECK_PTR_NOT_NULL(done_notify);
+    CHECK_PTR_NOT_NULL(done_wait);
+
+    memset(pool, 0, sizeof(*pool));
+
+    for (size_t i = 0; i < numWorkers; i++)
+    {
+        CHECK_PTR_NOT_NULL(threads[i].wake);
+        CHECK_PTR_NOT_NULL(threads[i].reg_callback);
+
+        worker_pool_worker_t* w = &pool->workers[i];
+
+        w->pool   = pool;
+        w->thread = threads[i];
+        atomic_init(&w->inbox, NULL);
+        atomic_init(&w->top, 0);
+        atomic_init(&w->bottom, 0);
+        atomic_init(&w->idle, true);
+    }
+
+    pool->numWorkers    = numWorkers;
+    pool->activeWorkers = numWorkers;
+    pool->done_notify   = done_notify;
+    pool->done_wait     = done_wait;
+    atomic_init(&pool->outstanding, 0);
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+worker_pool_start(
+    worker_pool_t* const pool)
+{
+    CHECK_PTR_NOT_NULL(pool);
+
+    for (size_t i = 0; i < pool->numWorkers; i++)
+    {
+        worker_pool_worker_t* w = &pool->workers[i];
+
+        int ret = w->thread.reg_callback(worker_wake_handler, w);
+        if (0 != ret)
+        {
+            Debug_LOG_ERROR("Failed to register worker %zu, code %d", i, ret);
+            return OS_ERROR_GENERIC;
+        }
+    }
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+OS_Error_t
+worker_pool_set_active(
+    worker_pool_t* const pool,
+    const size_t activeWorkers)
+{
+    CHECK_PTR_NOT_NULL(pool);
+    CHECK_VALUE_IN_RANGE(activeWorkers, 1, pool->numWorkers + 1);
+
+    if (atomic_load(&pool->outstanding) > 0)
+    {
+        Debug_LOG_ERROR("Items are still outstanding");
+        return OS_ERROR_INVALID_STATE;
+    }
+
+    pool->activeWorkers = activeWorkers;
+    pool->nextWorker    = 0;
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+void
+worker_pool_submit(
+    worker_pool_t* const pool,
+    worker_pool_item_t* const item)
+{
+    Debug_ASSERT(NULL != pool);
+    Debug_ASSERT((NULL != item) && (NULL != item->run));
+
+    worker_pool_worker_t* w = &pool->workers[pool->nextWorker];
+    pool->nextWorker = (pool->nextWorker + 1) % pool->activeWorkers;
+
+    atomic_fetch_add(&pool->outstanding, 1);
+
+    item->next = atomic_load_explicit(&w->inbox, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak(&w->inbox, &item->next, item))
+    {
+        // item->next has been updated to the current head.
+    }
+
+    if (atomic_exchange(&w->idle, false))
+    {
+        w->thread.wake();
+    }
+}
+
+//------------------------------------------------------------------------------
+void
+worker_pool_wait_idle(
+    worker_pool_t* const pool)
+{
+    Debug_ASSERT(NULL != pool);
+
+    // A notification left over from an earlier batch just costs one more loop.
+    while (atomic_load(&pool->outstanding) > 0)
+    {
+        pool->done_wait();
+    }
+}
+
+//------------------------------------------------------------------------------
+void
+worker_pool_get_stats(
+    worker_pool_t* const pool,
+    const size_t worker,
+    worker_pool_worker_stats_t* const stats)
+{
+    Debug_ASSERT(NULL != pool);
+    Debug_ASSERT(worker < pool->numWorkers);
+    Debug_ASSERT(NULL != stats);
+
+    const worker_pool_worker_t* w = &pool->workers[worker];
+
+    stats->itemsRun    = atomic_load(&w->itemsRun);
+    stats->itemsStolen = atomic_load(&w->itemsStolen);
+    stats->wakeups     = atomic_load(&w->wakeups);
+}
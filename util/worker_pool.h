@@ -0,0 +1,140 @@
+/*
+ * Pool of worker threads with per-worker deques and work stealing.
+ *
+ * Copyright (C) 2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "OS_Error.h"
+#include "interfaces/if_OS_Socket.h"
+
+/*
+ * The worker threads are the callback threads of CAmkES notifications, one
+ * notification per worker that is connected to the component itself. Emitting
+ * the notification wakes the worker up, it then runs items until there is no
+ * work left and goes back to sleep by re-registering its callback.
+ *
+ * Items are handed out by a single dispatching thread with
+ * worker_pool_submit(). They are queued on the inbox of one worker, which moves
+ * them into its deque. A worker runs the items of its own deque newest first
+ * and, once it is empty, steals the oldest items from the deques of the other
+ * workers.
+ */
+
+// Maximum number of workers, i.e. notifications the component can provide.
+#define WORKER_POOL_MAX_WORKERS 4
+
+// Capacity of a worker deque, must be a power of two.
+#define WORKER_POOL_DEQUE_SIZE  256
+
+typedef int (*event_reg_callback_func_t)(
+    void (*callback)(void*),
+    void* arg);
+
+// Notification of a worker thread.
+typedef struct
+{
+    event_notify_func_t       wake;
+    event_reg_callback_func_t reg_callback;
+} worker_pool_thread_t;
+
+// Unit of work, to be embedded into the object the item stands for.
+typedef struct worker_pool_item
+{
+    struct worker_pool_item* next;
+    void (*run)(struct worker_pool_item* item);
+} worker_pool_item_t;
+
+typedef struct
+{
+    uint32_t itemsRun;    // items run by this worker
+    uint32_t itemsStolen; // items taken from the deque of another worker
+    uint32_t wakeups;     // callback invocations
+} worker_pool_worker_stats_t;
+
+typedef struct worker_pool worker_pool_t;
+
+typedef struct
+{
+    worker_pool_t*               pool;
+    worker_pool_thread_t         thread;
+    // Items submitted to this worker, a lock-free LIFO only emptied by the
+    // worker itself.
+    _Atomic(worker_pool_item_t*) inbox;
+    // Chase-Lev deque, the worker pushes and takes at the bottom, the other
+    // workers steal at the top.
+    _Atomic int64_t              top;
+    _Atomic int64_t              bottom;
+    _Atomic(worker_pool_item_t*) buffer[WORKER_POOL_DEQUE_SIZE];
+    // Set while the worker is not running items, the next submit wakes it.
+    _Atomic bool                 idle;
+    _Atomic uint32_t             itemsRun;
+    _Atomic uint32_t             itemsStolen;
+    _Atomic uint32_t             wakeups;
+} worker_pool_worker_t;
+
+// Pool instance, owned by the caller and only to be accessed through the
+// functions below.
+struct worker_pool
+{
+    worker_pool_worker_t   workers[WORKER_POOL_MAX_WORKERS];
+    size_t                 numWorkers;
+    // Items are only submitted to the first activeWorkers workers.
+    size_t                 activeWorkers;
+    size_t                 nextWorker;
+    // Items submitted but not run to completion yet.
+    _Atomic size_t         outstanding;
+    // Notification the dispatching thread waits on for outstanding to drop to
+    // zero.
+    event_notify_func_t    done_notify;
+    event_wait_func_t      done_wait;
+};
+
+//------------------------------------------------------------------------------
+OS_Error_t
+worker_pool_init(
+    worker_pool_t* const pool,
+    const worker_pool_thread_t* const threads,
+    const size_t numWorkers,
+    const event_notify_func_t done_notify,
+    const event_wait_func_t done_wait);
+
+// Registers the worker callbacks, the workers then wait for items.
+OS_Error_t
+worker_pool_start(
+    worker_pool_t* const pool);
+
+// Limits the workers items are submitted to, the others stay asleep. Must only
+// be called while no items are outstanding.
+OS_Error_t
+worker_pool_set_active(
+    worker_pool_t* const pool,
+    const size_t activeWorkers);
+
+// Hands an item to the next active worker, which calls item->run(). Must only
+// be called from the dispatching thread.
+void
+worker_pool_submit(
+    worker_pool_t* const pool,
+    worker_pool_item_t* const item);
+
+// Blocks the dispatching thread until all submitted items have been run.
+void
+worker_pool_wait_idle(
+    worker_pool_t* const pool);
+
+void
+worker_pool_get_stats(
+    worker_pool_t* const pool,
+    const size_t worker,
+    worker_pool_worker_stats_t* const stats);